@@ -385,6 +385,9 @@ enum {
         __CFTSDKeyWeakReferenceHandler = 14,
         __CFTSDKeyIsInPreferences = 15,
         __CFTSDKeyPendingPreferencesKVONotifications = 16,
+        __CFTSDKeyCollatorIdentifier = 17,
+        __CFTSDKeyRegularExpression = 18,
+        __CFTSDKeyStringTransform = 19,
 	// autorelease pool stuff must be higher than run loop constants
 	__CFTSDKeyAutoreleaseData2 = 61,
 	__CFTSDKeyAutoreleaseData1 = 62,
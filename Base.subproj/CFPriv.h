@@ -299,6 +299,16 @@ typedef CF_ENUM(CFIndex, CFStringCharacterClusterType) {
 
 CF_EXPORT CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex charIndex, CFStringCharacterClusterType type);
 
+/* Walks range forward one cluster at a time, storing up to maxCount cluster ranges and returning how many were stored. The first cluster is the one containing range.location; each following one starts where the previous one ended, and the walk stops after the cluster covering the last character of range. The clusters are the ones CFStringGetRangeOfCharacterClusterAtIndex() would return, but the string is read once instead of once per cluster. To continue a walk that filled the buffer, pass a range starting at the end of the last cluster.
+*/
+CF_EXPORT CFIndex CFStringGetRangesOfCharacterClusters(CFStringRef string, CFRange range, CFStringCharacterClusterType type, CFRange *clusters, CFIndex maxCount);
+
+#if __BLOCKS__
+/* Same walk as CFStringGetRangesOfCharacterClusters(), handing each cluster to block until it sets *stop.
+*/
+CF_EXPORT void CFStringEnumerateCharacterClusters(CFStringRef string, CFRange range, CFStringCharacterClusterType type, void (^block)(CFRange cluster, Boolean *stop));
+#endif
+
 // Compatibility kCFCompare flags. Use the new public kCFCompareDiacriticInsensitive
 enum {
     kCFCompareDiacriticsInsensitive = 128 /* Use kCFCompareDiacriticInsensitive */
@@ -0,0 +1,337 @@
+/*	CFVectorUtilities.h
+	Copyright (c) 2019, Apple Inc. and the Swift project authors
+
+	Portions Copyright (c) 2019, Apple Inc. and the Swift project authors
+	Licensed under Apache License v2.0 with Runtime Library Exception
+	See http://swift.org/LICENSE.txt for license information
+	See http://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+*/
+
+/*
+        NOT TO BE USED OUTSIDE CF!
+*/
+
+#if !defined(__COREFOUNDATION_CFVECTORUTILITIES__)
+#define __COREFOUNDATION_CFVECTORUTILITIES__ 1
+
+#include <CoreFoundation/CFBase.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define __CF_VECTOR_SSE2 1
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define __CF_VECTOR_SSSE3 1
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define __CF_VECTOR_NEON 1
+#endif
+
+/* These helpers classify one block of code units at a time and return a bit mask with bit i set when element i of the block satisfies the predicate. A block is __kCFVectorBlockLength8 bytes or __kCFVectorBlockLength16 UTF-16 units; loads are unaligned, and the caller guarantees that the whole block is readable. Platforms without a supported vector unit get scalar loops with identical results.
+*/
+#define __kCFVectorBlockLength8 16
+#define __kCFVectorBlockLength16 8
+
+#if __CF_VECTOR_NEON
+CF_INLINE uint32_t __CFVectorMoveMask8(uint8x16_t matches) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(matches, vld1q_u8(weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+CF_INLINE uint32_t __CFVectorMoveMask16(uint16x8_t matches) {
+    static const uint8_t weights[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    return (uint32_t)vaddv_u8(vand_u8(vmovn_u16(matches), vld1_u8(weights)));
+}
+#endif
+
+// Elements for which (element | orBits) == value. Passing 0x20 as orBits with a lowercase ASCII letter matches either case.
+CF_INLINE uint32_t __CFVectorEqualMask8(const uint8_t *bytes, uint8_t value, uint8_t orBits) {
+#if __CF_VECTOR_SSE2
+    __m128i block = _mm_or_si128(_mm_loadu_si128((const __m128i *)bytes), _mm_set1_epi8((char)orBits));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8((char)value)));
+#elif __CF_VECTOR_NEON
+    uint8x16_t block = vorrq_u8(vld1q_u8(bytes), vdupq_n_u8(orBits));
+    return __CFVectorMoveMask8(vceqq_u8(block, vdupq_n_u8(value)));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength8; idx++) if ((bytes[idx] | orBits) == value) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+CF_INLINE uint32_t __CFVectorEqualMask16(const UniChar *chars, UniChar value, UniChar orBits) {
+#if __CF_VECTOR_SSE2
+    __m128i block = _mm_or_si128(_mm_loadu_si128((const __m128i *)chars), _mm_set1_epi16((short)orBits));
+    __m128i matches = _mm_cmpeq_epi16(block, _mm_set1_epi16((short)value));
+    return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(matches, _mm_setzero_si128()));
+#elif __CF_VECTOR_NEON
+    uint16x8_t block = vorrq_u16(vld1q_u16(chars), vdupq_n_u16(orBits));
+    return __CFVectorMoveMask16(vceqq_u16(block, vdupq_n_u16(value)));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength16; idx++) if ((chars[idx] | orBits) == value) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+// Elements outside of the ASCII range
+CF_INLINE uint32_t __CFVectorNonASCIIMask8(const uint8_t *bytes) {
+#if __CF_VECTOR_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)bytes));
+#elif __CF_VECTOR_NEON
+    return __CFVectorMoveMask8(vcgeq_u8(vld1q_u8(bytes), vdupq_n_u8(0x80)));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength8; idx++) if (bytes[idx] >= 0x80) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+CF_INLINE uint32_t __CFVectorNonASCIIMask16(const UniChar *chars) {
+#if __CF_VECTOR_SSE2
+    __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i *)chars), _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128());
+    return (~(uint32_t)_mm_movemask_epi8(_mm_packs_epi16(ascii, _mm_setzero_si128()))) & 0xFF;
+#elif __CF_VECTOR_NEON
+    return __CFVectorMoveMask16(vcgeq_u16(vld1q_u16(chars), vdupq_n_u16(0x80)));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength16; idx++) if (chars[idx] >= 0x80) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+// Elements in the closed range [lowest, highest]
+CF_INLINE uint32_t __CFVectorRangeMask8(const uint8_t *bytes, uint8_t lowest, uint8_t highest) {
+#if __CF_VECTOR_SSE2
+    __m128i offsets = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)bytes), _mm_set1_epi8((char)lowest));
+    __m128i excess = _mm_subs_epu8(offsets, _mm_set1_epi8((char)(highest - lowest)));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(excess, _mm_setzero_si128()));
+#elif __CF_VECTOR_NEON
+    uint8x16_t offsets = vsubq_u8(vld1q_u8(bytes), vdupq_n_u8(lowest));
+    return __CFVectorMoveMask8(vcleq_u8(offsets, vdupq_n_u8((uint8_t)(highest - lowest))));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength8; idx++) if ((bytes[idx] >= lowest) && (bytes[idx] <= highest)) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+CF_INLINE uint32_t __CFVectorRangeMask16(const UniChar *chars, UniChar lowest, UniChar highest) {
+#if __CF_VECTOR_SSE2
+    __m128i offsets = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)chars), _mm_set1_epi16((short)lowest));
+    __m128i excess = _mm_subs_epu16(offsets, _mm_set1_epi16((short)(highest - lowest)));
+    return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(excess, _mm_setzero_si128()), _mm_setzero_si128()));
+#elif __CF_VECTOR_NEON
+    uint16x8_t offsets = vsubq_u16(vld1q_u16(chars), vdupq_n_u16(lowest));
+    return __CFVectorMoveMask16(vcleq_u16(offsets, vdupq_n_u16((UniChar)(highest - lowest))));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength16; idx++) if ((chars[idx] >= lowest) && (chars[idx] <= highest)) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+/* Elements that belong to a set of ASCII characters, encoded in 16 bytes so that bit (c >> 4) of table[c & 0xF] is set for each member c. Both nibbles of a block are looked up at once with byte shuffles; SSE2 without SSSE3 has no byte shuffle, so it classifies element by element.
+*/
+CF_INLINE uint32_t __CFVectorASCIISetMask16(const UniChar *chars, const uint8_t *table) {
+#if __CF_VECTOR_SSSE3
+    // Non-ASCII elements are cleared before narrowing, which saturates as signed, and masked out of the result
+    __m128i block = _mm_loadu_si128((const __m128i *)chars);
+    __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(block, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128());
+    __m128i bytes = _mm_packus_epi16(_mm_and_si128(block, ascii), _mm_setzero_si128());
+    __m128i rows = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)table), _mm_and_si128(bytes, _mm_set1_epi8(0x0F)));
+    __m128i columns = _mm_shuffle_epi8(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0), _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F)));
+    uint32_t hits = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(rows, columns), _mm_setzero_si128()));
+    return hits & (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(ascii, _mm_setzero_si128()));
+#elif __CF_VECTOR_NEON
+    static const uint8_t columnBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+    static const uint8_t weights[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x8_t bytes = vqmovn_u16(vld1q_u16(chars));
+    uint8x8_t rows = vqtbl1_u8(vld1q_u8(table), vand_u8(bytes, vdup_n_u8(0x0F)));
+    uint8x8_t columns = vqtbl1_u8(vld1q_u8(columnBits), vshr_n_u8(bytes, 4));
+    return (uint32_t)vaddv_u8(vand_u8(vtst_u8(rows, columns), vld1_u8(weights)));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength16; idx++) if ((chars[idx] < 0x80) && (table[chars[idx] & 0xF] & (1U << (chars[idx] >> 4)))) mask |= (1U << idx);
+    return mask;
+#endif
+}
+
+// Length of the leading run of ASCII code units
+CF_INLINE CFIndex __CFVectorASCIIPrefixLength8(const uint8_t *bytes, CFIndex length) {
+    CFIndex idx = 0;
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        uint32_t mask = __CFVectorNonASCIIMask8(bytes + idx);
+        if (mask) return idx + __builtin_ctz(mask);
+        idx += __kCFVectorBlockLength8;
+    }
+    while ((idx < length) && (bytes[idx] < 0x80)) idx++;
+    return idx;
+}
+
+CF_INLINE CFIndex __CFVectorASCIIPrefixLength16(const UniChar *chars, CFIndex length) {
+    CFIndex idx = 0;
+    while (idx + __kCFVectorBlockLength16 <= length) {
+        uint32_t mask = __CFVectorNonASCIIMask16(chars + idx);
+        if (mask) return idx + __builtin_ctz(mask);
+        idx += __kCFVectorBlockLength16;
+    }
+    while ((idx < length) && (chars[idx] < 0x80)) idx++;
+    return idx;
+}
+
+// Elements that are equal once ASCII uppercase letters in both blocks are mapped to lowercase; other code units must match exactly
+CF_INLINE uint32_t __CFVectorASCIICaseInsensitiveEqualMask8(const uint8_t *bytes1, const uint8_t *bytes2) {
+#if __CF_VECTOR_SSE2
+    __m128i block1 = _mm_loadu_si128((const __m128i *)bytes1), block2 = _mm_loadu_si128((const __m128i *)bytes2);
+    __m128i upper1 = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(block1, _mm_set1_epi8('A')), _mm_set1_epi8(25)), _mm_setzero_si128());
+    __m128i upper2 = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(block2, _mm_set1_epi8('A')), _mm_set1_epi8(25)), _mm_setzero_si128());
+    block1 = _mm_or_si128(block1, _mm_and_si128(upper1, _mm_set1_epi8(0x20)));
+    block2 = _mm_or_si128(block2, _mm_and_si128(upper2, _mm_set1_epi8(0x20)));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block1, block2));
+#elif __CF_VECTOR_NEON
+    uint8x16_t block1 = vld1q_u8(bytes1), block2 = vld1q_u8(bytes2);
+    block1 = vorrq_u8(block1, vandq_u8(vcleq_u8(vsubq_u8(block1, vdupq_n_u8('A')), vdupq_n_u8(25)), vdupq_n_u8(0x20)));
+    block2 = vorrq_u8(block2, vandq_u8(vcleq_u8(vsubq_u8(block2, vdupq_n_u8('A')), vdupq_n_u8(25)), vdupq_n_u8(0x20)));
+    return __CFVectorMoveMask8(vceqq_u8(block1, block2));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength8; idx++) {
+        uint8_t ch1 = bytes1[idx], ch2 = bytes2[idx];
+        if ((uint8_t)(ch1 - 'A') <= 25) ch1 |= 0x20;
+        if ((uint8_t)(ch2 - 'A') <= 25) ch2 |= 0x20;
+        if (ch1 == ch2) mask |= (1U << idx);
+    }
+    return mask;
+#endif
+}
+
+CF_INLINE uint32_t __CFVectorASCIICaseInsensitiveEqualMask16(const UniChar *chars1, const UniChar *chars2) {
+#if __CF_VECTOR_SSE2
+    __m128i block1 = _mm_loadu_si128((const __m128i *)chars1), block2 = _mm_loadu_si128((const __m128i *)chars2);
+    __m128i upper1 = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(block1, _mm_set1_epi16('A')), _mm_set1_epi16(25)), _mm_setzero_si128());
+    __m128i upper2 = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(block2, _mm_set1_epi16('A')), _mm_set1_epi16(25)), _mm_setzero_si128());
+    block1 = _mm_or_si128(block1, _mm_and_si128(upper1, _mm_set1_epi16(0x20)));
+    block2 = _mm_or_si128(block2, _mm_and_si128(upper2, _mm_set1_epi16(0x20)));
+    return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(block1, block2), _mm_setzero_si128()));
+#elif __CF_VECTOR_NEON
+    uint16x8_t block1 = vld1q_u16(chars1), block2 = vld1q_u16(chars2);
+    block1 = vorrq_u16(block1, vandq_u16(vcleq_u16(vsubq_u16(block1, vdupq_n_u16('A')), vdupq_n_u16(25)), vdupq_n_u16(0x20)));
+    block2 = vorrq_u16(block2, vandq_u16(vcleq_u16(vsubq_u16(block2, vdupq_n_u16('A')), vdupq_n_u16(25)), vdupq_n_u16(0x20)));
+    return __CFVectorMoveMask16(vceqq_u16(block1, block2));
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __kCFVectorBlockLength16; idx++) {
+        UniChar ch1 = chars1[idx], ch2 = chars2[idx];
+        if ((UniChar)(ch1 - 'A') <= 25) ch1 |= 0x20;
+        if ((UniChar)(ch2 - 'A') <= 25) ch2 |= 0x20;
+        if (ch1 == ch2) mask |= (1U << idx);
+    }
+    return mask;
+#endif
+}
+
+/* Maps the ASCII letters in the leading run of ASCII code units to lowercase (or uppercase) in place, and returns the length of the run. Unlike the helpers above, these write to the buffer, a whole block at a time.
+*/
+CF_INLINE CFIndex __CFVectorASCIIMapCase8(uint8_t *bytes, CFIndex length, bool uppercase) {
+    const uint8_t first = (uppercase ? 'a' : 'A');
+    CFIndex idx = 0;
+
+#if __CF_VECTOR_SSE2
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + idx));
+        if (_mm_movemask_epi8(block)) break;
+        __m128i letters = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(block, _mm_set1_epi8((char)first)), _mm_set1_epi8(25)), _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(bytes + idx), _mm_xor_si128(block, _mm_and_si128(letters, _mm_set1_epi8(0x20))));
+        idx += __kCFVectorBlockLength8;
+    }
+#elif __CF_VECTOR_NEON
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        uint8x16_t block = vld1q_u8(bytes + idx);
+        if (vmaxvq_u8(block) >= 0x80) break;
+        uint8x16_t letters = vcleq_u8(vsubq_u8(block, vdupq_n_u8(first)), vdupq_n_u8(25));
+        vst1q_u8(bytes + idx, veorq_u8(block, vandq_u8(letters, vdupq_n_u8(0x20))));
+        idx += __kCFVectorBlockLength8;
+    }
+#endif
+    for (; (idx < length) && (bytes[idx] < 0x80); idx++) if ((uint8_t)(bytes[idx] - first) <= 25) bytes[idx] ^= 0x20;
+    return idx;
+}
+
+CF_INLINE CFIndex __CFVectorASCIIMapCase16(UniChar *chars, CFIndex length, bool uppercase) {
+    const UniChar first = (uppercase ? 'a' : 'A');
+    CFIndex idx = 0;
+
+#if __CF_VECTOR_SSE2
+    while (idx + __kCFVectorBlockLength16 <= length) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(chars + idx));
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(block, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128()))) break;
+        __m128i letters = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(block, _mm_set1_epi16((short)first)), _mm_set1_epi16(25)), _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(chars + idx), _mm_xor_si128(block, _mm_and_si128(letters, _mm_set1_epi16(0x20))));
+        idx += __kCFVectorBlockLength16;
+    }
+#elif __CF_VECTOR_NEON
+    while (idx + __kCFVectorBlockLength16 <= length) {
+        uint16x8_t block = vld1q_u16(chars + idx);
+        if (vmaxvq_u16(block) >= 0x80) break;
+        uint16x8_t letters = vcleq_u16(vsubq_u16(block, vdupq_n_u16(first)), vdupq_n_u16(25));
+        vst1q_u16(chars + idx, veorq_u16(block, vandq_u16(letters, vdupq_n_u16(0x20))));
+        idx += __kCFVectorBlockLength16;
+    }
+#endif
+    for (; (idx < length) && (chars[idx] < 0x80); idx++) if ((UniChar)(chars[idx] - first) <= 25) chars[idx] ^= 0x20;
+    return idx;
+}
+
+/* Copy the leading run of ASCII code units from bytes into chars (or from chars into bytes), widening (or narrowing) each element, and return the length of the run. The destination must have room for length elements.
+*/
+CF_INLINE CFIndex __CFVectorASCIIWiden(const uint8_t *bytes, UniChar *chars, CFIndex length) {
+    CFIndex idx = 0;
+
+#if __CF_VECTOR_SSE2
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + idx));
+        if (_mm_movemask_epi8(block)) break;
+        _mm_storeu_si128((__m128i *)(chars + idx), _mm_unpacklo_epi8(block, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(chars + idx + __kCFVectorBlockLength16), _mm_unpackhi_epi8(block, _mm_setzero_si128()));
+        idx += __kCFVectorBlockLength8;
+    }
+#elif __CF_VECTOR_NEON
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        uint8x16_t block = vld1q_u8(bytes + idx);
+        if (vmaxvq_u8(block) >= 0x80) break;
+        vst1q_u16(chars + idx, vmovl_u8(vget_low_u8(block)));
+        vst1q_u16(chars + idx + __kCFVectorBlockLength16, vmovl_high_u8(block));
+        idx += __kCFVectorBlockLength8;
+    }
+#endif
+    for (; (idx < length) && (bytes[idx] < 0x80); idx++) chars[idx] = bytes[idx];
+    return idx;
+}
+
+CF_INLINE CFIndex __CFVectorASCIINarrow(const UniChar *chars, uint8_t *bytes, CFIndex length) {
+    CFIndex idx = 0;
+
+#if __CF_VECTOR_SSE2
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        __m128i low = _mm_loadu_si128((const __m128i *)(chars + idx)), high = _mm_loadu_si128((const __m128i *)(chars + idx + __kCFVectorBlockLength16));
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(low, high), _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128()))) break;
+        _mm_storeu_si128((__m128i *)(bytes + idx), _mm_packus_epi16(low, high));
+        idx += __kCFVectorBlockLength8;
+    }
+#elif __CF_VECTOR_NEON
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        uint16x8_t low = vld1q_u16(chars + idx), high = vld1q_u16(chars + idx + __kCFVectorBlockLength16);
+        if (vmaxvq_u16(vorrq_u16(low, high)) >= 0x80) break;
+        vst1q_u8(bytes + idx, vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+        idx += __kCFVectorBlockLength8;
+    }
+#endif
+    for (; (idx < length) && (chars[idx] < 0x80); idx++) bytes[idx] = (uint8_t)chars[idx];
+    return idx;
+}
+
+#endif /* ! __COREFOUNDATION_CFVECTORUTILITIES__ */
+
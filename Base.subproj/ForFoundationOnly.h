@@ -502,6 +502,32 @@ CF_EXPORT CFIndex __CFBinaryPlistWriteToStreamWithEstimate(CFPropertyListRef pli
 CF_EXPORT CFIndex __CFBinaryPlistWriteToStreamWithOptions(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options); // will be removed soon
 CF_EXPORT CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, CFErrorRef _Nullable *_Nullable error);
 
+// Streaming binary plist writing. Objects are written as the plist is walked, children before their containers, so memory use is bounded by the number of distinct objects rather than the size of the output; the bytes differ from __CFBinaryPlistWrite() but read back the same. stream is a CFWriteStream or CFMutableData. The URL variant writes to a temporary file next to the destination and renames it into place without an fsync().
+CF_EXPORT CFIndex __CFBinaryPlistWriteStreaming(CFPropertyListRef plist, CFTypeRef stream, CFOptionFlags options, CFErrorRef _Nullable *_Nullable error);
+CF_EXPORT CFIndex __CFBinaryPlistWriteToFileDescriptor(CFPropertyListRef plist, int fd, CFOptionFlags options, CFErrorRef _Nullable *_Nullable error);
+CF_EXPORT CFIndex __CFBinaryPlistWriteToURLAtomically(CFPropertyListRef plist, CFURLRef url, CFOptionFlags options, CFErrorRef _Nullable *_Nullable error);
+
+// Writes an XML plist to a file descriptor through a fixed-size buffer, without building the document in memory first; CFPropertyListWrite() does the same for streams. The bytes are the same as CFPropertyListCreateData() produces.
+CF_EXPORT CFIndex _CFPropertyListWriteXMLToFileDescriptor(CFPropertyListRef plist, int fd, CFErrorRef _Nullable *_Nullable error);
+
+// Lazy access to a binary plist. Objects are named by their offset in the data, starting from _CFBinaryPlistReaderGetTopObject(); collections are read in place and only the objects passed to _CFBinaryPlistReaderCopyObject() are created. The reader retains (and does not copy) the data.
+typedef struct __CFBinaryPlistReader *_CFBinaryPlistReaderRef;
+
+typedef CF_OPTIONS(CFOptionFlags, _CFBinaryPlistReaderOptions) {
+    _kCFBinaryPlistReaderCacheObjects = (1UL << 0),    // Objects copied immutably are kept and shared by later copies of the same offset
+};
+
+CF_EXPORT _CFBinaryPlistReaderRef _Nullable _CFBinaryPlistReaderCreate(CFAllocatorRef _Nullable allocator, CFDataRef data, _CFBinaryPlistReaderOptions options);
+CF_EXPORT _CFBinaryPlistReaderRef _CFBinaryPlistReaderRetain(_CFBinaryPlistReaderRef reader);
+CF_EXPORT void _CFBinaryPlistReaderRelease(_CFBinaryPlistReaderRef reader);
+CF_EXPORT uint64_t _CFBinaryPlistReaderGetTopObject(_CFBinaryPlistReaderRef reader);
+CF_EXPORT CFTypeID _CFBinaryPlistReaderGetTypeID(_CFBinaryPlistReaderRef reader, uint64_t object);
+CF_EXPORT CFIndex _CFBinaryPlistReaderGetCount(_CFBinaryPlistReaderRef reader, uint64_t collection); // -1 if not an array, set or dictionary
+CF_EXPORT bool _CFBinaryPlistReaderGetObjectAtIndex(_CFBinaryPlistReaderRef reader, uint64_t collection, CFIndex idx, uint64_t *object); // arrays and sets
+CF_EXPORT bool _CFBinaryPlistReaderGetKeyAndObjectAtIndex(_CFBinaryPlistReaderRef reader, uint64_t dictionary, CFIndex idx, uint64_t *_Nullable key, uint64_t *_Nullable object);
+CF_EXPORT bool _CFBinaryPlistReaderGetObjectForKey(_CFBinaryPlistReaderRef reader, uint64_t dictionary, CFTypeRef key, uint64_t *object);
+CF_EXPORT CFPropertyListRef _Nullable _CFBinaryPlistReaderCopyObject(_CFBinaryPlistReaderRef reader, uint64_t object, CFOptionFlags mutabilityOption);
+
 #pragma mark - Property list parsing in Foundation
 
 CF_EXPORT CFTypeRef _Nullable _CFPropertyListCreateFromXMLData(CFAllocatorRef _Nullable allocator, CFDataRef xmlData, CFOptionFlags option, CFStringRef _Nullable * _Nullable errorString, Boolean allowNewTypes, CFPropertyListFormat *_Nullable format);
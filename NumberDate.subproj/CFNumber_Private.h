@@ -24,6 +24,15 @@ enum {
     kCFNumberSInt128Type = 17
 };
 
+/* Buffer length sufficient for any result of _CFNumberFormatFloat64() and _CFNumberFormatFloat32(), including the terminating null byte.
+*/
+#define _kCFNumberShortestDescriptionMaxLength 32
+
+/* Writes the shortest decimal string that reads back as exactly value, as a null-terminated ASCII C string, without going through printf. The layout is that of %.17g (%.9g for the float variant): positional notation for decimal exponents from -4 up to the precision, scientific notation otherwise. Special values are written as "nan", "inf", "-inf", "0" and "-0". Returns the length of the string, not counting the null byte, or 0 if bufferLength isn't large enough.
+*/
+CF_EXPORT CFIndex _CFNumberFormatFloat64(double value, char *buffer, CFIndex bufferLength) API_UNAVAILABLE(macos, ios, watchos, tvos);
+CF_EXPORT CFIndex _CFNumberFormatFloat32(float value, char *buffer, CFIndex bufferLength) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
 CF_EXTERN_C_END
 CF_IMPLICIT_BRIDGING_DISABLED
 
@@ -30,9 +30,15 @@
 #include "CFInternal.h"
 #include "CFRuntime_Internal.h"
 #include "CFPropertyList_Internal.h"
+#include <CoreFoundation/CFPropertyList_Private.h>
 
 #if !TARGET_OS_WASI
 #include <CoreFoundation/CFStream.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#if __HAS_DISPATCH__
+#include <dispatch/dispatch.h>
 #endif
 
 enum {
@@ -136,8 +142,11 @@ uint32_t _CFKeyedArchiverUIDGetValue(CFKeyedArchiverUIDRef uid) {
 CF_PRIVATE CFErrorRef __CFPropertyListCreateError(CFIndex code, CFStringRef debugString, ...);
 
 #if !TARGET_OS_WASI
+CF_PRIVATE CFIndex __CFPropertyListWriteBytes(CFWriteStreamRef stream, int fd, const UInt8 *bytes, CFIndex length, Boolean binary, CFErrorRef *error);
+
 typedef struct {
     CFTypeRef stream;
+    int fd;	// written with write() when stream is NULL and this is not -1
     void *databytes;
     uint64_t datalen;
     CFErrorRef error;
@@ -162,22 +171,10 @@ static void writeBytes(__CFBinaryPlistWriteBuffer *buf, const UInt8 *bytes, CFIn
     if (buf->streamIsData) {
         if (buf->stream && !dryRun) CFDataAppendBytes((CFMutableDataRef)buf->stream, bytes, length);
         buf->written += length;
+    } else if (dryRun || (!buf->stream && buf->fd < 0)) {
+        buf->written += length;
     } else {
-	while (0 < length) {
-	    CFIndex ret = (buf->stream && !dryRun) ? CFWriteStreamWrite((CFWriteStreamRef)buf->stream, bytes, length) : length;
-            if (ret == 0) {
-		buf->error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because stream is full."));
-                return;
-            }
-            if (ret < 0) {
-                CFErrorRef err = buf->stream ? CFWriteStreamCopyError((CFWriteStreamRef)buf->stream) : NULL;
-                buf->error = err ? err : __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because the stream had an unknown error."));
-                return;
-            }
-	    buf->written += ret;
-	    length -= ret;
-	    bytes += ret;
-	}
+        buf->written += __CFPropertyListWriteBytes((CFWriteStreamRef)buf->stream, buf->fd, bytes, length, true, &buf->error);
     }
 }
 
@@ -194,7 +191,7 @@ static void bufferWrite(__CFBinaryPlistWriteBuffer *buf, const uint8_t *buffer,
 	return;
     }
     CFIndex copyLen = __CFMin(count, (CFIndex)sizeof(buf->buffer) - buf->used);
-    if (!dryRun && (buf->stream || buf->databytes)) {
+    if (!dryRun && (buf->stream || buf->databytes || 0 <= buf->fd)) {
         switch (copyLen) {
         case 4: buf->buffer[buf->used + 3] = buffer[3]; /* FALLTHROUGH */
         case 3: buf->buffer[buf->used + 2] = buffer[2]; /* FALLTHROUGH */
@@ -206,7 +203,7 @@ static void bufferWrite(__CFBinaryPlistWriteBuffer *buf, const uint8_t *buffer,
     buf->used += copyLen;
     if (sizeof(buf->buffer) == buf->used) {
 	writeBytes(buf, buf->buffer, sizeof(buf->buffer), dryRun);
-        if (!dryRun && (buf->stream || buf->databytes)) {
+        if (!dryRun && (buf->stream || buf->databytes || 0 <= buf->fd)) {
             memmove(buf->buffer, buffer + copyLen, count - copyLen);
         }
 	buf->used = count - copyLen;
@@ -308,10 +305,11 @@ static void _appendString(__CFBinaryPlistWriteBuffer *buf, CFStringRef str, Bool
     CFIndex ret, count = CFStringGetLength(str);
     CFIndex needed, idx2;
     uint8_t *bytes, buffer[1024];
-    bytes = (count <= 1024) ? buffer : (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count, 0);
+    // bufferWrite() never looks at the bytes on a dry run, so only the lengths are computed
+    bytes = (dryRun || count <= 1024) ? buffer : (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count, 0);
     // presumption, believed to be true, is that ASCII encoding may need
     // less bytes, but will not need greater, than the # of unichars
-    ret = CFStringGetBytes(str, CFRangeMake(0, count), kCFStringEncodingASCII, 0, false, bytes, count, &needed);
+    ret = CFStringGetBytes(str, CFRangeMake(0, count), kCFStringEncodingASCII, 0, false, dryRun ? NULL : bytes, count, &needed);
     if (ret == count) {
         uint8_t marker = (uint8_t)(kCFBinaryPlistMarkerASCIIString | (needed < 15 ? needed : 0xf));
         bufferWrite(buf, &marker, 1, dryRun);
@@ -326,13 +324,17 @@ static void _appendString(__CFBinaryPlistWriteBuffer *buf, CFStringRef str, Bool
         if (15 <= count) {
 	    _appendInt(buf, (uint64_t)count, dryRun);
         }
-        chars = (UniChar *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(UniChar), 0);
-        CFStringGetCharacters(str, CFRangeMake(0, count), chars);
-        for (idx2 = 0; idx2 < count; idx2++) {
-	    chars[idx2] = CFSwapInt16HostToBig(chars[idx2]);
+        if (dryRun) {
+            bufferWrite(buf, NULL, count * sizeof(UniChar), dryRun);
+        } else {
+            chars = (UniChar *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(UniChar), 0);
+            CFStringGetCharacters(str, CFRangeMake(0, count), chars);
+            for (idx2 = 0; idx2 < count; idx2++) {
+	        chars[idx2] = CFSwapInt16HostToBig(chars[idx2]);
+            }
+            bufferWrite(buf, (uint8_t *)chars, count * sizeof(UniChar), dryRun);
+            CFAllocatorDeallocate(kCFAllocatorSystemDefault, chars);
         }
-        bufferWrite(buf, (uint8_t *)chars, count * sizeof(UniChar), dryRun);
-        CFAllocatorDeallocate(kCFAllocatorSystemDefault, chars);
     }
     if (bytes != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, bytes);
 }
@@ -385,8 +387,109 @@ static void _appendNumber(__CFBinaryPlistWriteBuffer *buf, CFNumberRef num, Bool
     }
 }
 
-static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFDictionaryRef objtable, uint32_t objRefSize, Boolean dryRun) {
-    uint64_t refnum;
+/* Object reference numbers for the objects being written, in an open-addressed table with linear probing. The identity table is keyed on pointers and holds every object in the plist; the uniquing table is keyed on CFHash() and CFEqual() and holds the first of each set of equal strings and datas. Numbers and dates are uniqued by identity only, as CFEqual() finds 1 and 1.0, or 0.0 and -0.0, equal, and merging them would change what reads back. Neither retains what it holds, since the plist being written keeps everything alive, so the writer pays for no callbacks or retain counting per object.
+ */
+typedef struct {
+    CFTypeRef object;
+    CFHashCode hash;
+    uint32_t refnum;
+} __CFBinaryPlistRefTableEntry;
+
+typedef struct {
+    __CFBinaryPlistRefTableEntry *entries;
+    CFIndex capacity;	// always a power of 2, and at least twice count
+    CFIndex count;
+    Boolean byEquality;
+} __CFBinaryPlistRefTable;
+
+CF_INLINE CFHashCode _refTableHashPointer(CFTypeRef obj) {
+    uint64_t h = (uint64_t)(uintptr_t)obj;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (CFHashCode)h;
+}
+
+static void _refTableInit(__CFBinaryPlistRefTable *table, uint64_t estimate, Boolean byEquality) {
+    CFIndex capacity = 64;
+    while ((uint64_t)capacity < 2 * estimate && capacity < (CFIndex)1 << 30) capacity *= 2;
+    table->entries = (__CFBinaryPlistRefTableEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(__CFBinaryPlistRefTableEntry), 0);
+    memset(table->entries, 0, capacity * sizeof(__CFBinaryPlistRefTableEntry));
+    table->capacity = capacity;
+    table->count = 0;
+    table->byEquality = byEquality;
+}
+
+static void _refTableDestroy(__CFBinaryPlistRefTable *table) {
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, table->entries);
+    table->entries = NULL;
+}
+
+static Boolean _refTableGetRefnum(const __CFBinaryPlistRefTable *table, CFTypeRef obj, CFHashCode hash, uint32_t *refnum) {
+    CFIndex mask = table->capacity - 1;
+    for (CFIndex idx = (CFIndex)(hash & mask); ; idx = (idx + 1) & mask) {
+        const __CFBinaryPlistRefTableEntry *entry = &table->entries[idx];
+        if (!entry->object) return false;
+        if (entry->object == obj || (table->byEquality && entry->hash == hash && CFEqual(entry->object, obj))) {
+            if (refnum) *refnum = entry->refnum;
+            return true;
+        }
+    }
+}
+
+// The caller has already checked that obj is not in the table
+static void _refTableAdd(__CFBinaryPlistRefTable *table, CFTypeRef obj, CFHashCode hash, uint32_t refnum) {
+    if (2 * (table->count + 1) > table->capacity) {
+        __CFBinaryPlistRefTableEntry *old = table->entries;
+        CFIndex oldCapacity = table->capacity;
+        table->capacity = 2 * oldCapacity;
+        table->entries = (__CFBinaryPlistRefTableEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, table->capacity * sizeof(__CFBinaryPlistRefTableEntry), 0);
+        memset(table->entries, 0, table->capacity * sizeof(__CFBinaryPlistRefTableEntry));
+        CFIndex mask = table->capacity - 1;
+        for (CFIndex oldIdx = 0; oldIdx < oldCapacity; oldIdx++) {
+            if (!old[oldIdx].object) continue;
+            CFIndex idx = (CFIndex)(old[oldIdx].hash & mask);
+            while (table->entries[idx].object) idx = (idx + 1) & mask;
+            table->entries[idx] = old[oldIdx];
+        }
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, old);
+    }
+    CFIndex mask = table->capacity - 1;
+    CFIndex idx = (CFIndex)(hash & mask);
+    while (table->entries[idx].object) idx = (idx + 1) & mask;
+    table->entries[idx].object = obj;
+    table->entries[idx].hash = hash;
+    table->entries[idx].refnum = refnum;
+    table->count++;
+}
+
+/* The objects of a plist in the order they are written, which is also their object reference number order, along with the tables mapping each object to its reference number. Built once by _flattenPlist() and then shared by every pass over the objects.
+ */
+typedef struct {
+    CFTypeRef *objects;
+    CFIndex count;
+    CFIndex capacity;
+    __CFBinaryPlistRefTable refs;	// every object, by identity
+    __CFBinaryPlistRefTable uniqued;	// strings and datas, by equality
+} __CFBinaryPlistObjectList;
+
+static void _objectListInit(__CFBinaryPlistObjectList *list, uint64_t estimate) {
+    list->capacity = (CFIndex)(estimate ? __CFMin(estimate, (uint64_t)1 << 24) : 650);
+    list->objects = (CFTypeRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, list->capacity * sizeof(CFTypeRef), 0);
+    list->count = 0;
+    _refTableInit(&list->refs, estimate ? estimate : 650, false);
+    _refTableInit(&list->uniqued, estimate ? estimate : 1000, true);
+}
+
+static void _objectListDestroy(__CFBinaryPlistObjectList *list) {
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, list->objects);
+    list->objects = NULL;
+    _refTableDestroy(&list->refs);
+    _refTableDestroy(&list->uniqued);
+}
+
+static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, const __CFBinaryPlistRefTable *objtable, uint32_t objRefSize, Boolean dryRun) {
+    uint32_t refnum;
     CFIndex idx2;
     CFTypeID type = CFGetTypeID(obj);
 	if (_kCFRuntimeIDCFString == type) {
@@ -425,8 +528,9 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
 		if (objtable) {
 		    uint32_t swapped = 0;
 		    uint8_t *source = (uint8_t *)&swapped;
-		    refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, value);
-		    swapped = CFSwapInt32HostToBig((uint32_t)refnum);
+		    refnum = 0;
+		    _refTableGetRefnum(objtable, value, _refTableHashPointer(value), &refnum);
+		    swapped = CFSwapInt32HostToBig(refnum);
 		    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize, dryRun);
 		} else {
 		    Boolean ret = _appendObject(buf, value, objtable, objRefSize, dryRun);
@@ -452,8 +556,9 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
 		if (objtable) {
 		    uint32_t swapped = 0;
 		    uint8_t *source = (uint8_t *)&swapped;
-		    refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, value);
-		    swapped = CFSwapInt32HostToBig((uint32_t)refnum);
+		    refnum = 0;
+		    _refTableGetRefnum(objtable, value, _refTableHashPointer(value), &refnum);
+		    swapped = CFSwapInt32HostToBig(refnum);
 		    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize, dryRun);
 		} else {
 		    Boolean ret = _appendObject(buf, value, objtable, objRefSize, dryRun);
@@ -472,36 +577,44 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
     return true;
 }
 
-static void _flattenPlist(CFPropertyListRef plist, CFMutableArrayRef objlist, CFMutableDictionaryRef objtable, CFMutableSetRef uniquingset) {
+static void _flattenPlist(CFPropertyListRef plist, __CFBinaryPlistObjectList *objlist) {
     uint32_t refnum;
     CFTypeID type = CFGetTypeID(plist);
 
     // Do not unique dictionaries or arrays, because: they
     // are slow to compare, and have poor hash codes.
     // Uniquing bools is unnecessary.
-    if (_kCFRuntimeIDCFString == type || _kCFRuntimeIDCFNumber == type || _kCFRuntimeIDCFDate == type || _kCFRuntimeIDCFData == type) {
-	CFIndex before = CFSetGetCount(uniquingset);
-	CFSetAddValue(uniquingset, plist);
-	CFIndex after = CFSetGetCount(uniquingset);
-	if (after == before) {	// already in set
-	    CFPropertyListRef unique = CFSetGetValue(uniquingset, plist);
-	    if (unique != plist) {
-		refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, unique);
-		CFDictionaryAddValue(objtable, plist, (const void *)(uintptr_t)refnum);
+    if (_kCFRuntimeIDCFString == type || _kCFRuntimeIDCFData == type) {
+	CFHashCode hash = CFHash(plist);
+	if (_refTableGetRefnum(&objlist->uniqued, plist, hash, &refnum)) {	// already seen this value
+	    CFHashCode ptrHash = _refTableHashPointer(plist);
+	    if (!_refTableGetRefnum(&objlist->refs, plist, ptrHash, NULL)) {
+		_refTableAdd(&objlist->refs, plist, ptrHash, refnum);
 	    }
 	    return;
 	}
+	_refTableAdd(&objlist->uniqued, plist, hash, (uint32_t)objlist->count);
+    } else if (_kCFRuntimeIDCFNumber == type || _kCFRuntimeIDCFDate == type) {
+	if (_refTableGetRefnum(&objlist->refs, plist, _refTableHashPointer(plist), NULL)) return;
+    }
+    refnum = (uint32_t)objlist->count;
+    if (objlist->count == objlist->capacity) {
+	objlist->capacity *= 2;
+	objlist->objects = (CFTypeRef *)CFAllocatorReallocate(kCFAllocatorSystemDefault, objlist->objects, objlist->capacity * sizeof(CFTypeRef), 0);
+    }
+    objlist->objects[objlist->count++] = plist;
+    // A container that appears more than once is written each time, but every reference goes to the first copy
+    CFHashCode ptrHash = _refTableHashPointer(plist);
+    if (!_refTableGetRefnum(&objlist->refs, plist, ptrHash, NULL)) {
+	_refTableAdd(&objlist->refs, plist, ptrHash, refnum);
     }
-    refnum = CFArrayGetCount(objlist);
-    CFArrayAppendValue(objlist, plist);
-    CFDictionaryAddValue(objtable, plist, (const void *)(uintptr_t)refnum);
     if (_kCFRuntimeIDCFDictionary == type) {
         CFIndex count = CFDictionaryGetCount((CFDictionaryRef)plist);
         STACK_BUFFER_DECL(CFPropertyListRef, buffer, (count > 0 && count <= 128) ? count * 2 : 1);
         CFPropertyListRef *list = (count <= 128) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * count * sizeof(CFTypeRef), 0);
         CFDictionaryGetKeysAndValues((CFDictionaryRef)plist, list, list + count);
         for (CFIndex idx = 0; idx < 2 * count; idx++) {
-            _flattenPlist(list[idx], objlist, objtable, uniquingset);
+            _flattenPlist(list[idx], objlist);
         }
         if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
     } else if (_kCFRuntimeIDCFArray == type) {
@@ -510,7 +623,7 @@ static void _flattenPlist(CFPropertyListRef plist, CFMutableArrayRef objlist, CF
         CFPropertyListRef *list = (count <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(CFTypeRef), 0);
         CFArrayGetValues((CFArrayRef)plist, CFRangeMake(0, count), list);
         for (CFIndex idx = 0; idx < count; idx++) {
-            _flattenPlist(list[idx], objlist, objtable, uniquingset);
+            _flattenPlist(list[idx], objlist);
         }
         if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
     }
@@ -537,48 +650,41 @@ CF_INLINE uint8_t _byteCount(uint64_t count) {
     return size;
 }
 
+/* Write the offset table and trailer that follow the last object, and flush the buffer. The offset int size is only chosen here, once the offset table's own offset is known. Returns the total length of the plist.
+ */
+static uint64_t _appendOffsetTableAndTrailer(__CFBinaryPlistWriteBuffer *buf, const uint64_t *offsets, int64_t cnt, CFBinaryPlistTrailer *trailer, Boolean dryRun) {
+    uint64_t length_so_far = buf->written + buf->used;
+    trailer->_offsetTableOffset = CFSwapInt64HostToBig(length_so_far);
+    trailer->_offsetIntSize = _byteCount(length_so_far);
+
+    for (int64_t idx = 0; idx < cnt; idx++) {
+	uint64_t swapped = CFSwapInt64HostToBig(offsets[idx]);
+	uint8_t *source = (uint8_t *)&swapped;
+	bufferWrite(buf, source + sizeof(*offsets) - trailer->_offsetIntSize, trailer->_offsetIntSize, dryRun);
+    }
+    length_so_far += cnt * trailer->_offsetIntSize;
+
+    bufferWrite(buf, (uint8_t *)trailer, sizeof(*trailer), dryRun);
+    bufferFlush(buf, dryRun);
+    length_so_far += sizeof(*trailer);
+    return length_so_far;
+}
+
 // stream can be a CFWriteStreamRef (on supported platforms) or a CFMutableDataRef
-/* Write a property list to a stream, in binary format. plist is the property list to write (one of the basic property list types), stream is the destination of the property list, and estimate is a best-guess at the total number of objects in the property list. The estimate parameter is for efficiency in pre-allocating memory for the uniquing step. Pass in a 0 if no estimate is available. The options flag specifies sort options. If sizeOnly is true, then no actual buffer allocations will be done, but the necessary buffer size will be calculated and return. If the error parameter is non-NULL and an error occurs, it will be used to return a CFError explaining the problem. It is the callers responsibility to release the error. */
-CF_PRIVATE CFIndex __CFBinaryPlistWriteOrPresize(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, Boolean sizeOnly, CFErrorRef *error) {
-    CFMutableDictionaryRef objtable = NULL;
-    CFMutableArrayRef objlist = NULL;
-    CFMutableSetRef uniquingset = NULL;
+/* Write the flattened objects of a property list to a stream, in binary format. The object reference size is known from the object count before anything is written, and the offset int size is chosen once the last object has been written, since the offset table follows the objects; so each object is encoded exactly once per pass. If sizeOnly is true nothing is written, but the number of bytes that would be is returned.
+ */
+static CFIndex __CFBinaryPlistWriteObjectList(const __CFBinaryPlistObjectList *objlist, CFTypeRef stream, Boolean sizeOnly, CFErrorRef *error) {
     CFBinaryPlistTrailer trailer;
     uint64_t *offsets, length_so_far;
     int64_t idx, cnt;
     __CFBinaryPlistWriteBuffer *buf;
 
-    //If we're actually serializing, rather than just pre-sizing, we have to have something to serialize into.
-    CFAssert(stream || sizeOnly, __kCFLogAssertion, "Passing NULL for the stream argument to __CFBinaryPlistWriteOrPresize is only valid if sizeOnly is true");
-
-    /*
-     This is exactly the same as a CFDictionary with NULL callbacks, except that it has the "aggressive growth" flag set, since we're not keeping it around. Radar 21883482
-     */
-    CFBasicHashCallbacks callbacks = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    objtable = 	(CFMutableDictionaryRef)CFBasicHashCreate(kCFAllocatorSystemDefault, kCFBasicHashHasKeys | kCFBasicHashLinearHashing | kCFBasicHashAggressiveGrowth, &callbacks);
-    _CFRuntimeSetInstanceTypeIDAndIsa(objtable, _kCFRuntimeIDCFDictionary);
-    
-    const CFArrayCallBacks arrayCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0};
-    objlist = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &arrayCallbacks);
-    
-    const CFSetCallBacks setCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0, 0};
-    uniquingset = CFSetCreateMutable(kCFAllocatorSystemDefault, 0, &setCallbacks);
-
-#if TARGET_OS_OSX
-    _CFDictionarySetCapacity(objtable, estimate ? estimate : 650);
-    _CFArraySetCapacity(objlist, estimate ? estimate : 650);
-    _CFSetSetCapacity(uniquingset, estimate ? estimate : 1000);
-#endif
-
-    _flattenPlist(plist, objlist, objtable, uniquingset);
-
-    CFRelease(uniquingset);
-    
-    cnt = CFArrayGetCount(objlist);
+    cnt = objlist->count;
     offsets = (uint64_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, (CFIndex)(cnt * sizeof(*offsets)), 0);
 
     buf = (__CFBinaryPlistWriteBuffer *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFBinaryPlistWriteBuffer), 0);
     buf->stream = stream;
+    buf->fd = -1;
     buf->databytes = NULL;
     buf->datalen = 0;
     buf->error = NULL;
@@ -593,11 +699,8 @@ CF_PRIVATE CFIndex __CFBinaryPlistWriteOrPresize(CFPropertyListRef plist, CFType
     trailer._objectRefSize = _byteCount(cnt);    
     for (idx = 0; idx < cnt; idx++) {
 	offsets[idx] = buf->written + buf->used;
-	CFPropertyListRef obj = CFArrayGetValueAtIndex(objlist, (CFIndex)idx);
-	Boolean success = _appendObject(buf, obj, objtable, trailer._objectRefSize, sizeOnly);
+	Boolean success = _appendObject(buf, objlist->objects[idx], &objlist->refs, trailer._objectRefSize, sizeOnly);
 	if (!success) {
-	    CFRelease(objtable);
-	    CFRelease(objlist);
 	    if (error && buf->error) {
 		// caller will release error
 		*error = buf->error;
@@ -610,24 +713,9 @@ CF_PRIVATE CFIndex __CFBinaryPlistWriteOrPresize(CFPropertyListRef plist, CFType
 	    return 0;
 	}
     }
-    CFRelease(objtable);
-    CFRelease(objlist);
-    
-    length_so_far = buf->written + buf->used;
-    trailer._offsetTableOffset = CFSwapInt64HostToBig(length_so_far);
-    trailer._offsetIntSize = _byteCount(length_so_far);
     
-    for (idx = 0; idx < cnt; idx++) {
-	uint64_t swapped = CFSwapInt64HostToBig(offsets[idx]);
-	uint8_t *source = (uint8_t *)&swapped;
-	bufferWrite(buf, source + sizeof(*offsets) - trailer._offsetIntSize, trailer._offsetIntSize, sizeOnly);
-    }
-    length_so_far += cnt * trailer._offsetIntSize;
+    length_so_far = _appendOffsetTableAndTrailer(buf, offsets, cnt, &trailer, sizeOnly);
     CFAllocatorDeallocate(kCFAllocatorSystemDefault, offsets);
-
-    bufferWrite(buf, (uint8_t *)&trailer, sizeof(trailer), sizeOnly);
-    bufferFlush(buf, sizeOnly);
-    length_so_far += sizeof(trailer);
     if (buf->error) {
 	if (error) {
 	    // caller will release error
@@ -642,6 +730,20 @@ CF_PRIVATE CFIndex __CFBinaryPlistWriteOrPresize(CFPropertyListRef plist, CFType
     return (CFIndex)length_so_far;
 }
 
+/* Write a property list to a stream, in binary format. plist is the property list to write (one of the basic property list types), stream is the destination of the property list, and estimate is a best-guess at the total number of objects in the property list. The estimate parameter is for efficiency in pre-allocating memory for the uniquing step. Pass in a 0 if no estimate is available. The options flag specifies sort options. If sizeOnly is true, then no actual buffer allocations will be done, but the necessary buffer size will be calculated and return. If the error parameter is non-NULL and an error occurs, it will be used to return a CFError explaining the problem. It is the callers responsibility to release the error. */
+CF_PRIVATE CFIndex __CFBinaryPlistWriteOrPresize(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, Boolean sizeOnly, CFErrorRef *error) {
+    __CFBinaryPlistObjectList objlist;
+
+    //If we're actually serializing, rather than just pre-sizing, we have to have something to serialize into.
+    CFAssert(stream || sizeOnly, __kCFLogAssertion, "Passing NULL for the stream argument to __CFBinaryPlistWriteOrPresize is only valid if sizeOnly is true");
+
+    _objectListInit(&objlist, estimate);
+    _flattenPlist(plist, &objlist);
+    CFIndex result = __CFBinaryPlistWriteObjectList(&objlist, stream, sizeOnly, error);
+    _objectListDestroy(&objlist);
+    return result;
+}
+
 CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, CFErrorRef *error) {
     return __CFBinaryPlistWriteOrPresize(plist, stream, estimate, options, false, error);
 }
@@ -663,7 +765,11 @@ CFIndex __CFBinaryPlistWriteToStreamWithOptions(CFPropertyListRef plist, CFTypeR
 CF_PRIVATE CFMutableDataRef _CFDataCreateFixedMutableWithBuffer(CFAllocatorRef allocator, CFIndex capacity, const uint8_t *bytes, CFAllocatorRef bytesDeallocator);
 
 CF_PRIVATE CFDataRef __CFBinaryPlistCreateDataUsingExternalBufferAllocator(CFPropertyListRef plist, uint64_t estimate, CFOptionFlags options, CFAllocatorRef (^allocatorCreator)(CFIndex bufferSize), CFErrorRef *error) {
-    CFIndex size = __CFBinaryPlistWriteOrPresize(plist, NULL, estimate, options, true, error);
+    // Flatten once; the sizing pass and the writing pass both walk the same object list
+    __CFBinaryPlistObjectList objlist;
+    _objectListInit(&objlist, estimate);
+    _flattenPlist(plist, &objlist);
+    CFIndex size = __CFBinaryPlistWriteObjectList(&objlist, NULL, true, error);
     CFDataRef result = NULL;
     if (size > 0) {
         CFAllocatorRef allocator = allocatorCreator(size);
@@ -673,7 +779,7 @@ CF_PRIVATE CFDataRef __CFBinaryPlistCreateDataUsingExternalBufferAllocator(CFPro
                 CFMutableDataRef data = _CFDataCreateFixedMutableWithBuffer(kCFAllocatorSystemDefault, size, buffer, allocator);
                 if (data) {
                     CFRelease(allocator);
-                    if (size == __CFBinaryPlistWriteOrPresize(plist, data, estimate, options, false, error)) {
+                    if (size == __CFBinaryPlistWriteObjectList(&objlist, data, false, error)) {
                         result = data;
                     } else {
                         CFRelease(data);
@@ -694,8 +800,248 @@ CF_PRIVATE CFDataRef __CFBinaryPlistCreateDataUsingExternalBufferAllocator(CFPro
             *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because an allocator could not be created."));
         }
     }
+    _objectListDestroy(&objlist);
     return result;
 }
+
+#pragma mark -
+#pragma mark Streaming
+
+/* The streaming writer emits each object as soon as everything it refers to has been written, so children come before their containers and the top object is the last one in the file. Apart from the containers along the current path, all that is kept per object is its offset and its entries in the reference tables; the encoded bytes go straight out through the write buffer. The object reference size has to be fixed before the first container is written, so a counting pass that does no encoding first finds an upper bound on the number of objects. It counts distinct objects by identity only; uniquing by equality can merge some of them later, never add to them.
+ */
+typedef struct {
+    __CFBinaryPlistWriteBuffer *buf;
+    __CFBinaryPlistRefTable refs;	// every object written so far, by identity
+    __CFBinaryPlistRefTable uniqued;	// strings and datas written so far, by equality
+    uint64_t *offsets;
+    CFIndex count;
+    CFIndex capacity;
+    uint32_t objRefSize;
+} __CFBinaryPlistStreamWriter;
+
+// Counts each distinct object once, without descending into containers already seen, and stops early once the count no longer fits in an object reference
+static uint64_t _countPlistObjects(CFPropertyListRef plist, __CFBinaryPlistRefTable *seen, uint64_t count) {
+    CFHashCode ptrHash = _refTableHashPointer(plist);
+    if (_refTableGetRefnum(seen, plist, ptrHash, NULL)) return count;
+    _refTableAdd(seen, plist, ptrHash, 0);
+    CFTypeID type = CFGetTypeID(plist);
+    count++;
+    if (UINT32_MAX < count) return count;
+    if (_kCFRuntimeIDCFDictionary == type || _kCFRuntimeIDCFArray == type) {
+        Boolean isDict = (_kCFRuntimeIDCFDictionary == type);
+        CFIndex total = isDict ? 2 * CFDictionaryGetCount((CFDictionaryRef)plist) : CFArrayGetCount((CFArrayRef)plist);
+        STACK_BUFFER_DECL(CFPropertyListRef, buffer, (total > 0 && total <= 256) ? total : 1);
+        CFPropertyListRef *list = (total <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, total * sizeof(CFTypeRef), 0);
+        if (isDict) {
+            CFDictionaryGetKeysAndValues((CFDictionaryRef)plist, list, list + total / 2);
+        } else {
+            CFArrayGetValues((CFArrayRef)plist, CFRangeMake(0, total), list);
+        }
+        for (CFIndex idx = 0; idx < total && count <= UINT32_MAX; idx++) {
+            count = _countPlistObjects(list[idx], seen, count);
+        }
+        if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
+    }
+    return count;
+}
+
+// Records where the next object starts and returns its object reference number
+static uint32_t _streamBeginObject(__CFBinaryPlistStreamWriter *writer) {
+    if (writer->count == writer->capacity) {
+        writer->capacity = writer->capacity ? 2 * writer->capacity : 256;
+        writer->offsets = (uint64_t *)CFAllocatorReallocate(kCFAllocatorSystemDefault, writer->offsets, writer->capacity * sizeof(uint64_t), 0);
+    }
+    writer->offsets[writer->count] = writer->buf->written + writer->buf->used;
+    return (uint32_t)writer->count++;
+}
+
+static Boolean _streamObject(__CFBinaryPlistStreamWriter *writer, CFPropertyListRef plist, uint32_t *refnum) {
+    CFHashCode ptrHash = _refTableHashPointer(plist);
+    if (_refTableGetRefnum(&writer->refs, plist, ptrHash, refnum)) return true;
+
+    CFTypeID type = CFGetTypeID(plist);
+    CFHashCode hash = 0;
+    Boolean unique = (_kCFRuntimeIDCFString == type || _kCFRuntimeIDCFData == type);
+    if (unique) {
+        hash = CFHash(plist);
+        if (_refTableGetRefnum(&writer->uniqued, plist, hash, refnum)) {
+            _refTableAdd(&writer->refs, plist, ptrHash, *refnum);
+            return true;
+        }
+    }
+
+    if (_kCFRuntimeIDCFDictionary == type || _kCFRuntimeIDCFArray == type) {
+        Boolean isDict = (_kCFRuntimeIDCFDictionary == type);
+        CFIndex count = isDict ? CFDictionaryGetCount((CFDictionaryRef)plist) : CFArrayGetCount((CFArrayRef)plist);
+        CFIndex total = isDict ? 2 * count : count;
+        STACK_BUFFER_DECL(CFPropertyListRef, buffer, (total > 0 && total <= 256) ? total : 1);
+        CFPropertyListRef *list = (total <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, total * sizeof(CFTypeRef), 0);
+        uint8_t refBuffer[1024];
+        uint8_t *refs = (total * writer->objRefSize <= (CFIndex)sizeof(refBuffer)) ? refBuffer : (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, total * writer->objRefSize, 0);
+        if (isDict) {
+            CFDictionaryGetKeysAndValues((CFDictionaryRef)plist, list, list + count);
+        } else {
+            CFArrayGetValues((CFArrayRef)plist, CFRangeMake(0, count), list);
+        }
+        Boolean success = true;
+        for (CFIndex idx = 0; success && idx < total; idx++) {
+            uint32_t childRef = 0;
+            success = _streamObject(writer, list[idx], &childRef);
+            uint32_t swapped = CFSwapInt32HostToBig(childRef);
+            if (success) memmove(refs + idx * writer->objRefSize, (uint8_t *)&swapped + sizeof(swapped) - writer->objRefSize, writer->objRefSize);
+        }
+        if (success) {
+            *refnum = _streamBeginObject(writer);
+            uint8_t marker = (uint8_t)((isDict ? kCFBinaryPlistMarkerDict : kCFBinaryPlistMarkerArray) | (count < 15 ? count : 0xf));
+            bufferWrite(writer->buf, &marker, 1, false);
+            if (15 <= count) {
+                _appendInt(writer->buf, (uint64_t)count, false);
+            }
+            bufferWrite(writer->buf, refs, total * writer->objRefSize, false);
+        }
+        if (refs != refBuffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, refs);
+        if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
+        if (!success) return false;
+    } else {
+        *refnum = _streamBeginObject(writer);
+        if (!_appendObject(writer->buf, plist, NULL, writer->objRefSize, false)) return false;
+    }
+    if (writer->buf->error) return false;
+
+    _refTableAdd(&writer->refs, plist, ptrHash, *refnum);
+    if (unique) _refTableAdd(&writer->uniqued, plist, hash, *refnum);
+    return true;
+}
+
+static CFIndex __CFBinaryPlistStream(CFPropertyListRef plist, CFTypeRef stream, int fd, CFErrorRef *error) {
+    __CFBinaryPlistStreamWriter writer;
+    CFBinaryPlistTrailer trailer;
+    uint32_t top = 0;
+
+    __CFBinaryPlistRefTable seen;
+    _refTableInit(&seen, 650, false);
+    uint64_t upperBound = _countPlistObjects(plist, &seen, 0);
+    _refTableDestroy(&seen);
+    if (UINT32_MAX < upperBound) {
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because the property list has too many objects."));
+        return 0;
+    }
+
+    __CFBinaryPlistWriteBuffer *buf = (__CFBinaryPlistWriteBuffer *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFBinaryPlistWriteBuffer), 0);
+    buf->stream = stream;
+    buf->fd = stream ? -1 : fd;
+    buf->databytes = NULL;
+    buf->datalen = 0;
+    buf->error = NULL;
+    buf->streamIsData = stream && (CFGetTypeID(stream) == CFDataGetTypeID());
+    buf->written = 0;
+    buf->used = 0;
+    bufferWrite(buf, (uint8_t *)"bplist00", 8, false);	// header
+
+    writer.buf = buf;
+    writer.offsets = NULL;
+    writer.count = 0;
+    writer.capacity = 0;
+    writer.objRefSize = _byteCount(upperBound);
+    _refTableInit(&writer.refs, upperBound, false);
+    _refTableInit(&writer.uniqued, 1000, true);
+
+    Boolean success = _streamObject(&writer, plist, &top);
+    _refTableDestroy(&writer.refs);
+    _refTableDestroy(&writer.uniqued);
+
+    uint64_t length_so_far = 0;
+    if (success) {
+        memset(&trailer, 0, sizeof(trailer));
+        trailer._numObjects = CFSwapInt64HostToBig(writer.count);
+        trailer._topObject = CFSwapInt64HostToBig(top);
+        trailer._objectRefSize = writer.objRefSize;
+        length_so_far = _appendOffsetTableAndTrailer(buf, writer.offsets, writer.count, &trailer, false);
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, writer.offsets);
+
+    if (!success || buf->error) {
+	if (error && buf->error) {
+	    // caller will release error
+	    *error = buf->error;
+	} else if (buf->error) {
+	    CFRelease(buf->error);
+	}
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, buf);
+	return 0;
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, buf);
+    return (CFIndex)length_so_far;
+}
+
+CFIndex __CFBinaryPlistWriteStreaming(CFPropertyListRef plist, CFTypeRef stream, CFOptionFlags options, CFErrorRef *error) {
+    return __CFBinaryPlistStream(plist, stream, -1, error);
+}
+
+CFIndex __CFBinaryPlistWriteToFileDescriptor(CFPropertyListRef plist, int fd, CFOptionFlags options, CFErrorRef *error) {
+    return __CFBinaryPlistStream(plist, NULL, fd, error);
+}
+
+CFIndex __CFBinaryPlistWriteToURLAtomically(CFPropertyListRef plist, CFURLRef url, CFOptionFlags options, CFErrorRef *error) {
+    char path[CFMaxPathSize], tempPath[CFMaxPathSize];
+    if (!CFURLGetFileSystemRepresentation(url, true, (uint8_t *)path, CFMaxPathSize) || (int)sizeof(tempPath) <= snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path)) {
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because the URL does not have a usable file system path."));
+        return 0;
+    }
+#if TARGET_OS_WIN32
+    int fd = _NS_mkstemp(tempPath, sizeof(tempPath));
+#else
+    // Not mkstemp(), which creates files readable only by their owner: open() gives a new file the permissions the umask allows, the same as writing the destination directly would
+    static _Atomic(uint32_t) tempCounter = 0;
+    int fd = -1;
+    for (int attempt = 0; fd < 0 && attempt < 100; attempt++) {
+        uint32_t count = atomic_fetch_add_explicit(&tempCounter, 1, memory_order_relaxed);
+        if ((int)sizeof(tempPath) <= snprintf(tempPath, sizeof(tempPath), "%s.%d.%u", path, (int)getpid(), (unsigned)count)) {
+            errno = ENAMETOOLONG;
+            break;
+        }
+        fd = open(tempPath, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666);
+        if (fd < 0 && EEXIST != errno) break;
+    }
+#endif
+    if (fd < 0) {
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because a temporary file could not be created: %s"), strerror(errno));
+        return 0;
+    }
+#if !TARGET_OS_WIN32
+    // A replaced file keeps its permissions
+    struct stat statBuf;
+    if (0 == stat(path, &statBuf) && 0 != fchmod(fd, statBuf.st_mode & 07777)) {
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because the permissions of the temporary file could not be set: %s"), strerror(errno));
+        close(fd);
+        unlink(tempPath);
+        return 0;
+    }
+#endif
+
+    // There is deliberately no fsync(). The rename is what makes the new contents visible, so readers see either the old file or the complete new one.
+    CFIndex length = __CFBinaryPlistStream(plist, NULL, fd, error);
+    if (0 != close(fd) && 0 < length) {
+        length = 0;
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because the temporary file could not be closed: %s"), strerror(errno));
+    }
+#if TARGET_OS_WIN32
+    if (0 < length && 0 != _NS_rename(tempPath, path)) {
+#else
+    if (0 < length && 0 != rename(tempPath, path)) {
+#endif
+        length = 0;
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Binary property list writing could not be completed because the temporary file could not be renamed: %s"), strerror(errno));
+    }
+    if (0 == length) {
+#if TARGET_OS_WIN32
+        _NS_unlink(tempPath);
+#else
+        unlink(tempPath);
+#endif
+    }
+    return length;
+}
 #endif
 
 #pragma mark -
@@ -961,6 +1307,40 @@ CF_PRIVATE bool __CFBinaryPlistIsDictionary(const uint8_t *databytes, uint64_t d
     return result;
 }
 
+/* Finds the object references of an array, set or dictionary. For a dictionary, *outCount is the number of entries; the key references come first, followed by as many value references.
+*/
+static bool __CFBinaryPlistGetCollectionRefs(const uint8_t *databytes, const CFBinaryPlistTrailer *trailer, uint64_t object, uint8_t *outMarker, uint64_t *outCount, const uint8_t **outRefs) {
+    const uint64_t objectsRangeEnd = _CFBinaryPlistTrailer_objectsRangeEnd(trailer);
+    if (object < 8 || objectsRangeEnd < object) FAIL_FALSE;
+    const uint8_t *ptr = databytes + object;
+    uint8_t marker = *ptr;
+    uint8_t kind = marker & 0xf0;
+    if (kind != kCFBinaryPlistMarkerArray && kind != kCFBinaryPlistMarkerSet && kind != kCFBinaryPlistMarkerDict) FAIL_FALSE;
+
+    int32_t err = CF_NO_ERROR;
+    ptr = check_ptr_add(ptr, 1, &err);
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    uint64_t cnt = marker & 0x0f;
+    if (0xf == cnt) {
+        uint64_t bigint = 0;
+        if (!_readInt(ptr, databytes + objectsRangeEnd, &bigint, &ptr)) FAIL_FALSE;
+        if (LONG_MAX < bigint) FAIL_FALSE;
+        cnt = bigint;
+    }
+    uint64_t refCount = (kind == kCFBinaryPlistMarkerDict) ? check_size_t_mul(cnt, 2, &err) : cnt;
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    size_t byte_cnt = check_size_t_mul(refCount, trailer->_objectRefSize, &err);
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    const uint8_t *extent = check_ptr_add(ptr, byte_cnt, &err) - 1;
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    if (databytes + objectsRangeEnd < extent) FAIL_FALSE;
+
+    if (outMarker) *outMarker = kind;
+    if (outCount) *outCount = cnt;
+    if (outRefs) *outRefs = ptr;
+    return true;
+}
+
 CFSetRef __CFBinaryPlistCopyTopLevelKeys(CFAllocatorRef allocator, const uint8_t *databytes, uint64_t datalen, uint64_t startOffset, const CFBinaryPlistTrailer *trailer) {
     uint64_t cnt = 0;
     const uint8_t *ptr = NULL;
@@ -1773,6 +2153,157 @@ bool __CFBinaryPlistCreateObject(const uint8_t *databytes, uint64_t datalen, uin
     return __CFBinaryPlistCreateObjectFiltered(databytes, datalen, startOffset, trailer, allocator, mutabilityOption, objects, NULL, 0, NULL, plist, NULL);
 }
 
+#if __HAS_DISPATCH__
+
+#pragma mark -
+#pragma mark Concurrent Reading
+
+// Top level collections with fewer elements than this are not worth splitting across threads
+#define __CFBinaryPlistConcurrentDecodeThreshold 4096
+
+// Whether __CFBinaryPlistCreateObjectFiltered() keeps an object with this marker in its objects cache
+static bool __CFBinaryPlistObjectIsCached(uint8_t marker, CFOptionFlags mutabilityOption) {
+    switch (marker & 0xf0) {
+    case kCFBinaryPlistMarkerNull:
+        return false;
+    case kCFBinaryPlistMarkerData:
+    case kCFBinaryPlistMarkerASCIIString:
+    case kCFBinaryPlistMarkerUnicode16String:
+        return mutabilityOption != kCFPropertyListMutableContainersAndLeaves;
+    case kCFBinaryPlistMarkerArray:
+    case kCFBinaryPlistMarkerSet:
+    case kCFBinaryPlistMarkerDict:
+        return mutabilityOption == kCFPropertyListImmutable;
+    }
+    return true;
+}
+
+/* Counts the references to each object from every array, set and dictionary in the object table, saturating at 2. Counts are kept per object reference; if the offset table names the same offset twice, references through the two entries are not recognized as shared, and those objects are simply created twice.
+ */
+static void __CFBinaryPlistCountReferences(const uint8_t *databytes, const CFBinaryPlistTrailer *trailer, uint8_t *refCounts) {
+    for (uint64_t idx = 0; idx < trailer->_numObjects; idx++) {
+        uint64_t offset = _getSizedInt(databytes + trailer->_offsetTableOffset + idx * trailer->_offsetIntSize, trailer->_offsetIntSize);
+        uint8_t marker;
+        uint64_t cnt;
+        const uint8_t *refs;
+        if (!__CFBinaryPlistGetCollectionRefs(databytes, trailer, offset, &marker, &cnt, &refs)) continue;
+        uint64_t refCount = (kCFBinaryPlistMarkerDict == marker) ? 2 * cnt : cnt;
+        for (uint64_t refIdx = 0; refIdx < refCount; refIdx++) {
+            uint64_t ref = _getSizedInt(refs + refIdx * trailer->_objectRefSize, trailer->_objectRefSize);
+            if (ref < trailer->_numObjects && refCounts[ref] < 2) refCounts[ref]++;
+        }
+    }
+}
+
+/* Creates a large top level array, set or dictionary by decoding ranges of its elements on several threads. Every object referenced from more than one place is created up front, on this thread, into the shared objects cache; each worker then starts from its own copy of that cache, so shared references still come back as one object and no two workers ever create the same one. Returns false, leaving the caller to decode sequentially, if the collection is too small to be worth it or anything fails.
+ */
+static bool __CFBinaryPlistCreateObjectConcurrently(const uint8_t *databytes, uint64_t datalen, uint64_t startOffset, const CFBinaryPlistTrailer *trailer, CFAllocatorRef allocator, CFOptionFlags mutabilityOption, CFMutableDictionaryRef objects, CFPropertyListRef *outPlist) {
+    uint8_t marker;
+    uint64_t cnt;
+    const uint8_t *refs;
+    if (!__CFBinaryPlistGetCollectionRefs(databytes, trailer, startOffset, &marker, &cnt, &refs)) FAIL_FALSE;
+    CFIndex ncores = __CFActiveProcessorCount();
+    if (cnt < __CFBinaryPlistConcurrentDecodeThreshold || ncores < 2) FAIL_FALSE;
+    if (16 < ncores) ncores = 16;
+    CFIndex const count = (CFIndex)cnt;
+    CFIndex const total = (kCFBinaryPlistMarkerDict == marker) ? 2 * count : count;
+
+    uint8_t *refCounts = (uint8_t *)calloc(trailer->_numObjects, sizeof(uint8_t));
+    if (!refCounts) FAIL_FALSE;
+    __CFBinaryPlistCountReferences(databytes, trailer, refCounts);
+    const uint64_t objectsRangeEnd = _CFBinaryPlistTrailer_objectsRangeEnd(trailer);
+    bool success = true;
+    for (uint64_t idx = 0; success && idx < trailer->_numObjects; idx++) {
+        if (refCounts[idx] < 2) continue;
+        uint64_t offset = _getSizedInt(databytes + trailer->_offsetTableOffset + idx * trailer->_offsetIntSize, trailer->_offsetIntSize);
+        if (offset < 8 || objectsRangeEnd < offset || offset == startOffset || !__CFBinaryPlistObjectIsCached(databytes[offset], mutabilityOption)) continue;
+        CFPropertyListRef pl = NULL;
+        success = __CFBinaryPlistCreateObjectFiltered(databytes, datalen, offset, trailer, allocator, mutabilityOption, objects, NULL, 1, NULL, &pl, NULL);
+        if (pl) CFRelease(pl);
+    }
+    free(refCounts);
+    if (!success) FAIL_FALSE;
+
+    CFPropertyListRef *list = (CFPropertyListRef *)calloc(total, sizeof(CFPropertyListRef));
+    if (!list) FAIL_FALSE;
+    CFMutableDictionaryRef caches[16];
+    bool chunkSucceeded[16];
+    for (CFIndex n = 0; n < ncores; n++) {
+        caches[n] = CFDictionaryCreateMutableCopy(kCFAllocatorSystemDefault, 0, objects);
+    }
+    CFIndex const chunk = (total + ncores - 1) / ncores;
+    CFIndex const keyCount = (kCFBinaryPlistMarkerDict == marker) ? count : 0;
+    CFMutableDictionaryRef *cachesPtr = caches;
+    bool *chunkSucceededPtr = chunkSucceeded;
+    dispatch_apply(ncores, DISPATCH_APPLY_AUTO, ^(size_t n) {
+            CFIndex idx = n * chunk, lim = __CFMin(idx + chunk, total);
+            chunkSucceededPtr[n] = true;
+            for (; idx < lim; idx++) {
+                uint64_t off;
+                CFTypeID typeID = _kCFRuntimeNotATypeID;
+                if (!_getOffsetOfRefAt(databytes, refs + idx * trailer->_objectRefSize, trailer, &off) ||
+                    !__CFBinaryPlistCreateObjectFiltered(databytes, datalen, off, trailer, allocator, mutabilityOption, cachesPtr[n], NULL, 1, NULL, &list[idx], &typeID) ||
+                    (idx < keyCount && !_typeIsPlistPrimitive(typeID))) {
+                    chunkSucceededPtr[n] = false;
+                    return;
+                }
+            }
+        });
+    for (CFIndex n = 0; n < ncores; n++) {
+        if (!chunkSucceeded[n]) success = false;
+        CFRelease(caches[n]);
+    }
+    if (!success) {
+        for (CFIndex idx = 0; idx < total; idx++) {
+            if (list[idx]) CFRelease(list[idx]);
+        }
+        free(list);
+        FAIL_FALSE;
+    }
+
+    // Put the collection together exactly as __CFBinaryPlistCreateObjectFiltered() would
+    if (kCFBinaryPlistMarkerDict == marker) {
+        if (mutabilityOption != kCFPropertyListImmutable) {
+            CFMutableDictionaryRef dict = CFDictionaryCreateMutable(allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+            for (CFIndex idx = 0; idx < count; idx++) {
+                CFDictionaryAddValue(dict, list[idx], list[idx + count]);
+            }
+            for (CFIndex idx = 0; idx < total; idx++) {
+                CFRelease(list[idx]);
+            }
+            *outPlist = dict;
+        } else {
+            *outPlist = __CFDictionaryCreateTransfer(allocator, list, list + count, count);
+        }
+    } else if (kCFBinaryPlistMarkerArray == marker) {
+        if (mutabilityOption != kCFPropertyListImmutable) {
+            *outPlist = CFArrayCreateMutable(allocator, 0, &kCFTypeArrayCallBacks);
+            CFArrayReplaceValues((CFMutableArrayRef)*outPlist, CFRangeMake(0, 0), list, count);
+            for (CFIndex idx = 0; idx < count; idx++) {
+                CFRelease(list[idx]);
+            }
+        } else {
+            *outPlist = __CFArrayCreateTransfer(allocator, list, count);
+        }
+    } else {
+        if (mutabilityOption != kCFPropertyListImmutable) {
+            *outPlist = CFSetCreateMutable(allocator, 0, &kCFTypeSetCallBacks);
+            for (CFIndex idx = 0; idx < count; idx++) {
+                CFSetAddValue((CFMutableSetRef)*outPlist, list[idx]);
+            }
+            for (CFIndex idx = 0; idx < count; idx++) {
+                CFRelease(list[idx]);
+            }
+        } else {
+            *outPlist = __CFSetCreateTransfer(allocator, list, count);
+        }
+    }
+    free(list);
+    return true;
+}
+
+#endif
+
 CF_PRIVATE bool __CFTryParseBinaryPlist(CFAllocatorRef allocator, CFDataRef data, CFOptionFlags option, CFPropertyListRef *plist, CFStringRef *errorString) {
     uint8_t marker;    
     CFBinaryPlistTrailer trailer;
@@ -1791,7 +2322,14 @@ CF_PRIVATE bool __CFTryParseBinaryPlist(CFAllocatorRef allocator, CFDataRef data
 	_CFDictionarySetCapacity(objects, trailer._numObjects);
 	CFPropertyListRef pl = NULL;
         bool result = true;
-        if (__CFBinaryPlistCreateObjectFiltered(databytes, datalen, offset, &trailer, allocator, option, objects, NULL, 0, NULL, &pl, NULL)) {
+        CFOptionFlags mutabilityOption = option & kCFPropertyListMutabilityMask;
+        bool decoded = false;
+#if __HAS_DISPATCH__
+        if (option & kCFPropertyListReadConcurrently) {
+            decoded = __CFBinaryPlistCreateObjectConcurrently(databytes, datalen, offset, &trailer, allocator, mutabilityOption, objects, &pl);
+        }
+#endif
+        if (decoded || __CFBinaryPlistCreateObjectFiltered(databytes, datalen, offset, &trailer, allocator, mutabilityOption, objects, NULL, 0, NULL, &pl, NULL)) {
 	    if (plist) *plist = pl;
 #if 0
 // code to check the 1.5 version code against any binary plist successfully parsed above
@@ -1817,3 +2355,136 @@ if (!CFEqual(pl, pl2)) CFLog(3, CFSTR("*** error: plists before and after are no
     FAIL_FALSE;
 }
 
+
+#pragma mark -
+#pragma mark Lazy Reading
+
+/* A reader gives access to the objects of a binary plist in place. Objects are identified by their offset in the data; collections are walked through their object references and only the objects that are asked for get created. The data is retained rather than copied, so for data that maps a file only the pages actually touched are read.
+*/
+struct __CFBinaryPlistReader {
+    volatile int32_t retainCount;
+    CFAllocatorRef allocator;
+    CFDataRef data;
+    const uint8_t *databytes;
+    uint64_t datalen;
+    uint64_t topObject;
+    CFBinaryPlistTrailer trailer;
+    CFMutableDictionaryRef objects;     // Immutable objects created so far, by offset; NULL unless caching
+    CFLock_t lock;                      // Protects objects
+};
+
+_CFBinaryPlistReaderRef _CFBinaryPlistReaderCreate(CFAllocatorRef allocator, CFDataRef data, _CFBinaryPlistReaderOptions options) {
+    const uint8_t *databytes = CFDataGetBytePtr(data);
+    uint64_t datalen = CFDataGetLength(data);
+    CFBinaryPlistTrailer trailer;
+    uint64_t offset;
+    if (datalen < 8 || !__CFBinaryPlistGetTopLevelInfo(databytes, datalen, NULL, &offset, &trailer)) FAIL_NULL;
+
+    _CFBinaryPlistReaderRef reader = (_CFBinaryPlistReaderRef)calloc(1, sizeof(struct __CFBinaryPlistReader));
+    if (!reader) FAIL_NULL;
+    reader->retainCount = 1;
+    reader->allocator = allocator ? (CFAllocatorRef)CFRetain(allocator) : NULL;
+    reader->data = (CFDataRef)CFRetain(data);
+    reader->databytes = databytes;
+    reader->datalen = datalen;
+    reader->topObject = offset;
+    reader->trailer = trailer;
+    reader->lock = CFLockInit;
+    if (options & _kCFBinaryPlistReaderCacheObjects) {
+        // Not retaining keys; they are offsets (see __CFTryParseBinaryPlist)
+        reader->objects = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+    }
+    return reader;
+}
+
+_CFBinaryPlistReaderRef _CFBinaryPlistReaderRetain(_CFBinaryPlistReaderRef reader) {
+    OSAtomicIncrement32Barrier(&reader->retainCount);
+    return reader;
+}
+
+void _CFBinaryPlistReaderRelease(_CFBinaryPlistReaderRef reader) {
+    if (OSAtomicDecrement32Barrier(&reader->retainCount) != 0) return;
+    if (reader->objects) CFRelease(reader->objects);
+    CFRelease(reader->data);
+    if (reader->allocator) CFRelease(reader->allocator);
+    free(reader);
+}
+
+uint64_t _CFBinaryPlistReaderGetTopObject(_CFBinaryPlistReaderRef reader) {
+    return reader->topObject;
+}
+
+CFTypeID _CFBinaryPlistReaderGetTypeID(_CFBinaryPlistReaderRef reader, uint64_t object) {
+    if (object < 8 || _CFBinaryPlistTrailer_objectsRangeEnd(&reader->trailer) < object) return _kCFRuntimeNotATypeID;
+    uint8_t marker = *(reader->databytes + object);
+    switch (marker & 0xf0) {
+    case kCFBinaryPlistMarkerNull:
+        if (marker == kCFBinaryPlistMarkerNull) return _kCFRuntimeIDCFNull;
+        if (marker == kCFBinaryPlistMarkerFalse || marker == kCFBinaryPlistMarkerTrue) return _kCFRuntimeIDCFBoolean;
+        return _kCFRuntimeNotATypeID;
+    case kCFBinaryPlistMarkerInt:
+    case kCFBinaryPlistMarkerReal:
+        return _kCFRuntimeIDCFNumber;
+    case kCFBinaryPlistMarkerDate & 0xf0:
+        return (marker == kCFBinaryPlistMarkerDate) ? _kCFRuntimeIDCFDate : _kCFRuntimeNotATypeID;
+    case kCFBinaryPlistMarkerData:
+        return _kCFRuntimeIDCFData;
+    case kCFBinaryPlistMarkerASCIIString:
+    case kCFBinaryPlistMarkerUnicode16String:
+        return _kCFRuntimeIDCFString;
+    case kCFBinaryPlistMarkerUID:
+        return _kCFRuntimeIDCFKeyedArchiverUID;
+    case kCFBinaryPlistMarkerArray:
+        return _kCFRuntimeIDCFArray;
+    case kCFBinaryPlistMarkerSet:
+        return _kCFRuntimeIDCFSet;
+    case kCFBinaryPlistMarkerDict:
+        return _kCFRuntimeIDCFDictionary;
+    }
+    return _kCFRuntimeNotATypeID;
+}
+
+CFIndex _CFBinaryPlistReaderGetCount(_CFBinaryPlistReaderRef reader, uint64_t collection) {
+    uint64_t cnt;
+    if (!__CFBinaryPlistGetCollectionRefs(reader->databytes, &reader->trailer, collection, NULL, &cnt, NULL)) return -1;
+    return (CFIndex)cnt;
+}
+
+bool _CFBinaryPlistReaderGetObjectAtIndex(_CFBinaryPlistReaderRef reader, uint64_t collection, CFIndex idx, uint64_t *object) {
+    uint8_t marker;
+    uint64_t cnt;
+    const uint8_t *refs;
+    if (!__CFBinaryPlistGetCollectionRefs(reader->databytes, &reader->trailer, collection, &marker, &cnt, &refs)) FAIL_FALSE;
+    if (marker == kCFBinaryPlistMarkerDict || idx < 0 || cnt <= idx) FAIL_FALSE;
+    return _getOffsetOfRefAt(reader->databytes, refs + idx * reader->trailer._objectRefSize, &reader->trailer, object);
+}
+
+bool _CFBinaryPlistReaderGetKeyAndObjectAtIndex(_CFBinaryPlistReaderRef reader, uint64_t dictionary, CFIndex idx, uint64_t *key, uint64_t *object) {
+    uint8_t marker;
+    uint64_t cnt;
+    const uint8_t *refs;
+    if (!__CFBinaryPlistGetCollectionRefs(reader->databytes, &reader->trailer, dictionary, &marker, &cnt, &refs)) FAIL_FALSE;
+    if (marker != kCFBinaryPlistMarkerDict || idx < 0 || cnt <= idx) FAIL_FALSE;
+    const uint8_t *keyRef = refs + idx * reader->trailer._objectRefSize;
+    if (key && !_getOffsetOfRefAt(reader->databytes, keyRef, &reader->trailer, key)) FAIL_FALSE;
+    if (object && !_getOffsetOfRefAt(reader->databytes, keyRef + cnt * reader->trailer._objectRefSize, &reader->trailer, object)) FAIL_FALSE;
+    return true;
+}
+
+bool _CFBinaryPlistReaderGetObjectForKey(_CFBinaryPlistReaderRef reader, uint64_t dictionary, CFTypeRef key, uint64_t *object) {
+    return __CFBinaryPlistGetOffsetForValueFromDictionary3(reader->databytes, reader->datalen, dictionary, &reader->trailer, key, NULL, object, false, NULL);
+}
+
+CFPropertyListRef _CFBinaryPlistReaderCopyObject(_CFBinaryPlistReaderRef reader, uint64_t object, CFOptionFlags mutabilityOption) {
+    CFPropertyListRef plist = NULL;
+    bool success;
+    // Only immutable objects can be shared between callers
+    if (reader->objects && mutabilityOption == kCFPropertyListImmutable) {
+        __CFLock(&reader->lock);
+        success = __CFBinaryPlistCreateObjectFiltered(reader->databytes, reader->datalen, object, &reader->trailer, reader->allocator, mutabilityOption, reader->objects, NULL, 0, NULL, &plist, NULL);
+        __CFUnlock(&reader->lock);
+    } else {
+        success = __CFBinaryPlistCreateObjectFiltered(reader->databytes, reader->datalen, object, &reader->trailer, reader->allocator, mutabilityOption, NULL, NULL, 0, NULL, &plist, NULL);
+    }
+    return success ? plist : NULL;
+}
@@ -38,6 +38,7 @@
 #include <ctype.h>
 
 #include "CFOverflow.h"
+#include "CFVectorUtilities.h"
 
 #define PLIST_IX    0
 #define ARRAY_IX    1
@@ -121,6 +122,51 @@ CF_PRIVATE CFErrorRef __CFPropertyListCreateError(CFIndex code, CFStringRef debu
     return error;
 }
 
+#if !TARGET_OS_WASI
+/* Writes bytes to stream, or with write() to fd when stream is NULL, until all of them are written or one write fails; interrupted writes are retried. Returns the number of bytes written, and on failure also sets *error, which the caller releases. Both the XML and the binary writers send their output through here; binary keeps that writer's own error messages and returns a stream's error as is rather than wrapping it.
+*/
+CF_PRIVATE CFIndex __CFPropertyListWriteBytes(CFWriteStreamRef stream, int fd, const UInt8 *bytes, CFIndex length, Boolean binary, CFErrorRef *error) {
+    const char *kind = binary ? "Binary property list" : "Property list";
+    CFIndex written = 0;
+    while (written < length) {
+        CFIndex ret;
+        if (stream) {
+            ret = CFWriteStreamWrite(stream, bytes + written, length - written);
+            if (ret == 0) {
+                *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("%s writing could not be completed because stream is full."), kind);
+                break;
+            }
+            if (ret < 0) {
+                CFErrorRef underlyingError = CFWriteStreamCopyError(stream);
+                if (underlyingError && binary) {
+                    *error = underlyingError;
+                } else if (underlyingError) {
+                    // Wrap the error from CFWriteStreamCopy in a new error
+                    CFMutableDictionaryRef userInfo = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFCopyStringDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+                    CFDictionarySetValue(userInfo, kCFErrorDebugDescriptionKey, CFSTR("Property list writing could not be completed because the stream had an unknown error."));
+                    CFDictionarySetValue(userInfo, kCFErrorUnderlyingErrorKey, underlyingError);
+                    *error = CFErrorCreate(kCFAllocatorSystemDefault, kCFErrorDomainCocoa, kCFPropertyListWriteStreamError, userInfo);
+                    CFRelease(userInfo);
+                    CFRelease(underlyingError);
+                } else {
+                    *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("%s writing could not be completed because the stream had an unknown error."), kind);
+                }
+                break;
+            }
+        } else {
+            ret = (CFIndex)write(fd, bytes + written, length - written);
+            if (ret < 0) {
+                if (EINTR == errno) continue;
+                *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("%s writing could not be completed because write() failed: %s"), kind, strerror(errno));
+                break;
+            }
+        }
+        written += ret;
+    }
+    return written;
+}
+#endif
+
 static CFStringRef __copyErrorDebugDescription(CFErrorRef error) {
     CFStringRef result = NULL;
     if (error) {
@@ -351,67 +397,156 @@ CF_INLINE void __CFPListRelease(CFTypeRef cf, CFAllocatorRef allocator) {
 }
 
 
-// The following set of _plist... functions append various things to a mutable data which is in UTF8 encoding. These are pretty general. Assumption is call characters and CFStrings can be converted to UTF8 and appended.
+// The following set of _plist... functions append various things, in UTF8 encoding, to an XML plist writer. These are pretty general. Assumption is call characters and CFStrings can be converted to UTF8 and appended.
 
-// Null-terminated, ASCII or UTF8 string
-//
-static void _plistAppendUTF8CString(CFMutableDataRef mData, const char *cString) {
-    CFDataAppendBytes (mData, (const UInt8 *)cString, strlen(cString));
+// The writer collects output in a fixed-size buffer and hands it on a buffer at a time, either to a mutable data or, so that large plists need not be built in memory first, to a stream or file descriptor. After a failure the error is kept and everything else is dropped.
+typedef struct {
+    CFMutableDataRef data;
+#if !TARGET_OS_WASI
+    CFWriteStreamRef stream;
+    int fd;	// written with write() when data and stream are NULL
+#endif
+    CFErrorRef error;
+    CFIndex written;
+    CFIndex used;
+    UInt8 buffer[8192 - 48];
+} _CFXMLPlistWriter;
+
+static _CFXMLPlistWriter *_plistWriterCreate(CFMutableDataRef data, CFTypeRef stream, int fd) {
+    _CFXMLPlistWriter *writer = (_CFXMLPlistWriter *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(_CFXMLPlistWriter), 0);
+    writer->data = data;
+#if !TARGET_OS_WASI
+    writer->stream = (CFWriteStreamRef)stream;
+    writer->fd = fd;
+#endif
+    writer->error = NULL;
+    writer->written = 0;
+    writer->used = 0;
+    return writer;
 }
 
-// UniChars
-//
-static void _plistAppendCharacters(CFMutableDataRef mData, const UniChar *chars, CFIndex length) {
-    CFIndex curLoc = 0;
-
-    do {	// Flush out ASCII chars, BUFLEN at a time
-        #define BUFLEN 400
-	UInt8 buf[BUFLEN], *bufPtr = buf;
-	CFIndex cnt = 0;
-        while (cnt < length && (cnt - curLoc < BUFLEN) && (chars[cnt] < 128)) *bufPtr++ = (UInt8)(chars[cnt++]);
-        if (cnt > curLoc) {	// Flush any ASCII bytes
-            CFDataAppendBytes(mData, buf, cnt - curLoc);
-            curLoc = cnt;
-        }
-    } while (curLoc < length && (chars[curLoc] < 128));	// We will exit out of here when we run out of chars or hit a non-ASCII char
-
-    if (curLoc < length) {	// Now deal with non-ASCII chars
-        CFDataRef data = NULL;
-        CFStringRef str = NULL;
-        if ((str = CFStringCreateWithCharactersNoCopy(kCFAllocatorSystemDefault, chars + curLoc, length - curLoc, kCFAllocatorNull))) {
-            if ((data = CFStringCreateExternalRepresentation(kCFAllocatorSystemDefault, str, kCFStringEncodingUTF8, 0))) {
-                CFDataAppendBytes (mData, CFDataGetBytePtr(data), CFDataGetLength(data));
-                CFRelease(data);
-            }
-            CFRelease(str);
+static void _plistWriteBytes(_CFXMLPlistWriter *writer, const UInt8 *bytes, CFIndex length) {
+    if (writer->error) return;
+    if (writer->data) {
+        CFDataAppendBytes(writer->data, bytes, length);
+        writer->written += length;
+        return;
+    }
+#if !TARGET_OS_WASI
+    writer->written += __CFPropertyListWriteBytes(writer->stream, writer->fd, bytes, length, false, &writer->error);
+#endif
+}
+
+static void _plistWriterFlush(_CFXMLPlistWriter *writer) {
+    if (writer->used) _plistWriteBytes(writer, writer->buffer, writer->used);
+    writer->used = 0;
+}
+
+// Flushes the writer and frees it, returning the number of bytes written, or 0 and the error
+static CFIndex _plistWriterFinish(_CFXMLPlistWriter *writer, CFErrorRef *error) {
+    _plistWriterFlush(writer);
+    CFIndex written = writer->written;
+    if (writer->error) {
+        written = 0;
+        if (error) {
+            // caller will release error
+            *error = writer->error;
+        } else {
+            CFRelease(writer->error);
         }
-        CFAssert1(str && data, __kCFLogAssertion, "%s(): Error writing plist", __PRETTY_FUNCTION__); 
     }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, writer);
+    return written;
 }
 
-// Append CFString
+static void _plistAppendBytes(_CFXMLPlistWriter *writer, const UInt8 *bytes, CFIndex length) {
+    if (writer->error || length <= 0) return;
+    if ((CFIndex)sizeof(writer->buffer) - writer->used < length) {
+        _plistWriterFlush(writer);
+        if ((CFIndex)sizeof(writer->buffer) <= length) {
+            // Too big to be worth copying; goes straight out
+            _plistWriteBytes(writer, bytes, length);
+            return;
+        }
+    }
+    memmove(writer->buffer + writer->used, bytes, length);
+    writer->used += length;
+}
+
+// Null-terminated, ASCII or UTF8 string
+//
+static void _plistAppendUTF8CString(_CFXMLPlistWriter *writer, const char *cString) {
+    _plistAppendBytes(writer, (const UInt8 *)cString, strlen(cString));
+}
+
+// UniChars
 //
-static void _plistAppendString(CFMutableDataRef mData, CFStringRef str) {
+static void _plistAppendCharacters(_CFXMLPlistWriter *writer, const UniChar *chars, CFIndex length) {
+    while (0 < length && !writer->error) {
+        // A surrogate pair takes 4 bytes; with less room than that a character might never fit
+        if ((CFIndex)sizeof(writer->buffer) - writer->used < 4) _plistWriterFlush(writer);
+
+        // ASCII is narrowed straight into the buffer, a block at a time
+        CFIndex room = (CFIndex)sizeof(writer->buffer) - writer->used;
+        CFIndex ascii = __CFVectorASCIINarrow(chars, writer->buffer + writer->used, __CFMin(length, room));
+        writer->used += ascii;
+        chars += ascii;
+        length -= ascii;
+        if (0 == length || ascii == room) continue;
+
+        // Then the characters up to the next ASCII one go through the UTF-8 converter, as many as fit
+        CFIndex run = 1, usedChars = 0, usedBytes = 0;
+        while (run < length && chars[run] >= 0x80) run ++;
+        room -= ascii;
+        CFStringEncodingUnicodeToBytes(kCFStringEncodingUTF8, 0, chars, run, &usedChars, writer->buffer + writer->used, room, &usedBytes);
+        writer->used += usedBytes;
+        if (0 == usedChars && 4 <= room) {
+            // An unpaired surrogate has no UTF-8 form; leave it out
+            CFAssert1(false, __kCFLogAssertion, "%s(): Error writing plist", __PRETTY_FUNCTION__);
+            usedChars = 1;
+        }
+        chars += usedChars;
+        length -= usedChars;
+    }
+}
+
+#define XML_PLIST_CHARACTER_CHUNK 256
+
+// Passes the contents of str to the given function, straight from its backing store when that is available
+static void _plistAppendStringContents(_CFXMLPlistWriter *writer, CFStringRef str, void (*appendBytes)(_CFXMLPlistWriter *, const UInt8 *, CFIndex), void (*appendCharacters)(_CFXMLPlistWriter *, const UniChar *, CFIndex)) {
     const UniChar *chars;
     const char *cStr;
-    CFDataRef data;
+    CFIndex length = CFStringGetLength(str);
     if ((chars = CFStringGetCharactersPtr(str))) {
-        _plistAppendCharacters(mData, chars, CFStringGetLength(str));
+        appendCharacters(writer, chars, length);
     } else if ((cStr = CFStringGetCStringPtr(str, kCFStringEncodingASCII)) || (cStr = CFStringGetCStringPtr(str, kCFStringEncodingUTF8))) {
-        _plistAppendUTF8CString(mData, cStr);
-    } else if ((data = CFStringCreateExternalRepresentation(kCFAllocatorSystemDefault, str, kCFStringEncodingUTF8, 0))) {
-        CFDataAppendBytes (mData, CFDataGetBytePtr(data), CFDataGetLength(data));
-        CFRelease(data);
+        // Either way the contents are ASCII, one byte per character
+        appendBytes(writer, (const UInt8 *)cStr, length);
     } else {
-	CFAssert1(TRUE, __kCFLogAssertion, "%s(): Error in plist writing", __PRETTY_FUNCTION__);
+        UniChar buffer[XML_PLIST_CHARACTER_CHUNK];
+        CFIndex idx = 0;
+        while (idx < length && !writer->error) {
+            CFIndex count = __CFMin(length - idx, XML_PLIST_CHARACTER_CHUNK);
+            CFStringGetCharacters(str, CFRangeMake(idx, count), buffer);
+            // Do not split a surrogate pair between chunks
+            if (idx + count < length && 1 < count && CFStringIsSurrogateHighCharacter(buffer[count - 1])) count --;
+            appendCharacters(writer, buffer, count);
+            idx += count;
+        }
     }
 }
 
+// Append CFString
+//
+static void _plistAppendString(_CFXMLPlistWriter *writer, CFStringRef str) {
+    _plistAppendStringContents(writer, str, _plistAppendBytes, _plistAppendCharacters);
+}
+
 
 // Append CFString-style format + arguments
 //
-static void _plistAppendFormat(CFMutableDataRef mData, CFStringRef format, ...) {
-    CFStringRef fStr; 
+static void _plistAppendFormat(_CFXMLPlistWriter *writer, CFStringRef format, ...) {
+    CFStringRef fStr;
     va_list argList;
 
     va_start(argList, format);
@@ -419,63 +554,74 @@ static void _plistAppendFormat(CFMutableDataRef mData, CFStringRef format, ...)
     va_end(argList);
 
     CFAssert1(fStr, __kCFLogAssertion, "%s(): Error writing plist", __PRETTY_FUNCTION__);
-    _plistAppendString(mData, fStr);
+    _plistAppendString(writer, fStr);
     CFRelease(fStr);
 }
 
 
 
-static void _appendIndents(CFIndex numIndents, CFMutableDataRef str) {
-#define NUMTABS 4
-    static const UniChar tabs[NUMTABS] = {'\t','\t','\t','\t'};
-    for (; numIndents > 0; numIndents -= NUMTABS) _plistAppendCharacters(str, tabs, (numIndents >= NUMTABS) ? NUMTABS : numIndents);
+static void _appendIndents(CFIndex numIndents, _CFXMLPlistWriter *writer) {
+#define NUMTABS 8
+    static const char tabs[NUMTABS] = {'\t','\t','\t','\t','\t','\t','\t','\t'};
+    for (; numIndents > 0; numIndents -= NUMTABS) _plistAppendBytes(writer, (const UInt8 *)tabs, (numIndents >= NUMTABS) ? NUMTABS : numIndents);
 }
 
-/* Append the escaped version of origStr to mStr.
-*/
-static void _appendEscapedString(CFStringRef origStr, CFMutableDataRef mStr) {
-#define BUFSIZE 64
-    CFIndex i, length = CFStringGetLength(origStr);
-    CFIndex bufCnt = 0;
-    UniChar buf[BUFSIZE];
-    CFStringInlineBuffer inlineBuffer;
-
-    CFStringInitInlineBuffer(origStr, &inlineBuffer, CFRangeMake(0, length));
-
-    for (i = 0; i < length; i ++) {
-	UniChar ch = __CFStringGetCharacterFromInlineBufferQuick(&inlineBuffer, i);
-	if (CFStringIsSurrogateHighCharacter(ch) && (bufCnt + 2 >= BUFSIZE)) {
-	    // flush the buffer first so we have room for a low/high pair and do not split them
-	    _plistAppendCharacters(mStr, buf, bufCnt);
-	    bufCnt = 0;
-	}
-	
-        switch(ch) {
-            case '<':
-		if (bufCnt) _plistAppendCharacters(mStr, buf, bufCnt);
-		bufCnt = 0;
-	  	_plistAppendUTF8CString(mStr, "&lt;");
-                break;
-            case '>':
-		if (bufCnt) _plistAppendCharacters(mStr, buf, bufCnt);
-		bufCnt = 0;
-	  	_plistAppendUTF8CString(mStr, "&gt;");
+// Bit i is set when element i of the block is one of the characters that _appendEscapedString() replaces with an entity
+CF_INLINE uint32_t _xmlEscapeMask8(const UInt8 *bytes) {
+    return __CFVectorEqualMask8(bytes, '<', 0) | __CFVectorEqualMask8(bytes, '>', 0) | __CFVectorEqualMask8(bytes, '&', 0);
+}
+
+CF_INLINE uint32_t _xmlEscapeMask16(const UniChar *chars) {
+    return __CFVectorEqualMask16(chars, '<', 0) | __CFVectorEqualMask16(chars, '>', 0) | __CFVectorEqualMask16(chars, '&', 0);
+}
+
+CF_INLINE const char *_xmlEntityForCharacter(UniChar ch) {
+    return (ch == '<') ? "&lt;" : ((ch == '>') ? "&gt;" : "&amp;");
+}
+
+// Runs that need no escaping are appended whole; only the characters in between are replaced
+static void _appendEscapedBytes(_CFXMLPlistWriter *writer, const UInt8 *bytes, CFIndex length) {
+    CFIndex idx = 0, start = 0;
+    while (idx < length) {
+        while (length - idx >= __kCFVectorBlockLength8) {
+            uint32_t mask = _xmlEscapeMask8(bytes + idx);
+            if (mask) {
+                idx += __builtin_ctz(mask);
                 break;
-            case '&':
-		if (bufCnt) _plistAppendCharacters(mStr, buf, bufCnt);
-		bufCnt = 0;
-	  	_plistAppendUTF8CString(mStr, "&amp;");
+            }
+            idx += __kCFVectorBlockLength8;
+        }
+        while (idx < length && bytes[idx] != '<' && bytes[idx] != '>' && bytes[idx] != '&') idx ++;
+        _plistAppendBytes(writer, bytes + start, idx - start);
+        if (idx == length) break;
+        _plistAppendUTF8CString(writer, _xmlEntityForCharacter(bytes[idx]));
+        start = ++idx;
+    }
+}
+
+static void _appendEscapedCharacters(_CFXMLPlistWriter *writer, const UniChar *chars, CFIndex length) {
+    CFIndex idx = 0, start = 0;
+    while (idx < length) {
+        while (length - idx >= __kCFVectorBlockLength16) {
+            uint32_t mask = _xmlEscapeMask16(chars + idx);
+            if (mask) {
+                idx += __builtin_ctz(mask);
                 break;
-            default:
-		buf[bufCnt++] = ch;
-		if (bufCnt == BUFSIZE) {
-		    _plistAppendCharacters(mStr, buf, bufCnt);
-		    bufCnt = 0;
-		}
-		break;
+            }
+            idx += __kCFVectorBlockLength16;
         }
+        while (idx < length && chars[idx] != '<' && chars[idx] != '>' && chars[idx] != '&') idx ++;
+        _plistAppendCharacters(writer, chars + start, idx - start);
+        if (idx == length) break;
+        _plistAppendUTF8CString(writer, _xmlEntityForCharacter(chars[idx]));
+        start = ++idx;
     }
-    if (bufCnt) _plistAppendCharacters(mStr, buf, bufCnt);
+}
+
+/* Append the escaped version of origStr to the writer.
+*/
+static void _appendEscapedString(CFStringRef origStr, _CFXMLPlistWriter *writer) {
+    _plistAppendStringContents(writer, origStr, _appendEscapedBytes, _appendEscapedCharacters);
 }
 
 
@@ -497,7 +643,7 @@ static void _appendEscapedString(CFStringRef origStr, CFMutableDataRef mStr) {
 
 // Write the inputData to the mData using Base 64 encoding
 
-static void _XMLPlistAppendDataUsingBase64(CFMutableDataRef mData, CFDataRef inputData, CFIndex indent) {
+static void _XMLPlistAppendDataUsingBase64(_CFXMLPlistWriter *writer, CFDataRef inputData, CFIndex indent) {
     static const char __CFPLDataEncodeTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     #define MAXLINELEN 76
     char buf[MAXLINELEN + 4 + 2];	// For the slop and carriage return and terminating NULL
@@ -529,8 +675,8 @@ static void _XMLPlistAppendDataUsingBase64(CFMutableDataRef mData, CFDataRef inp
         if (pos >= MAXLINELEN - 8 * indent) {
             buf[pos++] = '\n';
             buf[pos++] = 0;
-            _appendIndents(indent, mData);
-            _plistAppendUTF8CString(mData, buf);
+            _appendIndents(indent, writer);
+            _plistAppendUTF8CString(writer, buf);
             pos = 0;
         }
     }
@@ -552,84 +698,85 @@ static void _XMLPlistAppendDataUsingBase64(CFMutableDataRef mData, CFDataRef inp
     if (pos > 0) {
         buf[pos++] = '\n';
         buf[pos++] = 0;
-        _appendIndents(indent, mData);
-        _plistAppendUTF8CString(mData, buf);
+        _appendIndents(indent, writer);
+        _plistAppendUTF8CString(writer, buf);
     }
 }
 
-extern CFStringRef __CFNumberCopyFormattingDescriptionAsFloat64(CFTypeRef cf);
+extern CFIndex __CFNumberGetFormattingDescriptionAsFloat64(CFTypeRef cf, char *buffer);
 
-static void _CFAppendXML0(CFTypeRef object, UInt32 indentation, CFMutableDataRef xmlString) {
+static void _CFAppendXML0(CFTypeRef object, UInt32 indentation, _CFXMLPlistWriter *writer) {
+    if (writer->error) return;
     UInt32 typeID = CFGetTypeID(object);
-    _appendIndents(indentation, xmlString);
+    _appendIndents(indentation, writer);
     if (typeID == _kCFRuntimeIDCFString) {
-        _plistAppendUTF8CString(xmlString, "<");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[STRING_IX], STRING_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">");
-	_appendEscapedString((CFStringRef)object, xmlString);
-        _plistAppendUTF8CString(xmlString, "</");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[STRING_IX], STRING_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _plistAppendUTF8CString(writer, "<");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[STRING_IX], STRING_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">");
+	_appendEscapedString((CFStringRef)object, writer);
+        _plistAppendUTF8CString(writer, "</");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[STRING_IX], STRING_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
     } else if (typeID == _CFKeyedArchiverUIDGetTypeID()) {
         // This is only used for the keyed archiver
-        _plistAppendUTF8CString(xmlString, "<");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
-	    _appendIndents(indentation+1, xmlString);
-	    _plistAppendUTF8CString(xmlString, "<");
-	    _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
-	    _plistAppendUTF8CString(xmlString, ">");
-	    _appendEscapedString(CFSTR("CF$UID"), xmlString);
-	    _plistAppendUTF8CString(xmlString, "</");
-	    _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
-	    _plistAppendUTF8CString(xmlString, ">\n");
-	    _appendIndents(indentation + 1, xmlString);
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">");
+        _plistAppendUTF8CString(writer, "<");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
+	    _appendIndents(indentation+1, writer);
+	    _plistAppendUTF8CString(writer, "<");
+	    _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
+	    _plistAppendUTF8CString(writer, ">");
+	    _appendEscapedString(CFSTR("CF$UID"), writer);
+	    _plistAppendUTF8CString(writer, "</");
+	    _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
+	    _plistAppendUTF8CString(writer, ">\n");
+	    _appendIndents(indentation + 1, writer);
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">");
 
 	    uint64_t v = _CFKeyedArchiverUIDGetValue((CFKeyedArchiverUIDRef)object);
 	    CFNumberRef num = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberSInt64Type, &v);
-            _plistAppendFormat(xmlString, CFSTR("%@"), num);
+            _plistAppendFormat(writer, CFSTR("%@"), num);
 	    CFRelease(num);
 
-            _plistAppendUTF8CString(xmlString, "</");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">\n");
-        _appendIndents(indentation, xmlString);
-        _plistAppendUTF8CString(xmlString, "</");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+            _plistAppendUTF8CString(writer, "</");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">\n");
+        _appendIndents(indentation, writer);
+        _plistAppendUTF8CString(writer, "</");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
     } else if (typeID == _kCFRuntimeIDCFArray) {
         UInt32 i, count = CFArrayGetCount((CFArrayRef)object);
         if (count == 0) {
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[ARRAY_IX], ARRAY_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, "/>\n");
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[ARRAY_IX], ARRAY_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, "/>\n");
             return;
         }
-        _plistAppendUTF8CString(xmlString, "<");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[ARRAY_IX], ARRAY_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _plistAppendUTF8CString(writer, "<");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[ARRAY_IX], ARRAY_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
         for (i = 0; i < count; i ++) {
-            _CFAppendXML0(CFArrayGetValueAtIndex((CFArrayRef)object, i), indentation+1, xmlString);
+            _CFAppendXML0(CFArrayGetValueAtIndex((CFArrayRef)object, i), indentation+1, writer);
         }
-        _appendIndents(indentation, xmlString);
-        _plistAppendUTF8CString(xmlString, "</");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[ARRAY_IX], ARRAY_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _appendIndents(indentation, writer);
+        _plistAppendUTF8CString(writer, "</");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[ARRAY_IX], ARRAY_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
     } else if (typeID == _kCFRuntimeIDCFDictionary) {
         UInt32 i, count = CFDictionaryGetCount((CFDictionaryRef)object);
         CFMutableArrayRef keyArray;
         if (count == 0) {
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, "/>\n");
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, "/>\n");
             return;
         }
-        _plistAppendUTF8CString(xmlString, "<");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _plistAppendUTF8CString(writer, "<");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
         new_cftype_array(keys, count);
         CFDictionaryGetKeysAndValues((CFDictionaryRef)object, keys, NULL);
         keyArray = CFArrayCreateMutable(kCFAllocatorSystemDefault, count, &kCFTypeArrayCallBacks);
@@ -639,30 +786,30 @@ static void _CFAppendXML0(CFTypeRef object, UInt32 indentation, CFMutableDataRef
         CFRelease(keyArray);
         for (i = 0; i < count; i ++) {
             CFTypeRef key = keys[i];
-            _appendIndents(indentation+1, xmlString);
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">");
-	    _appendEscapedString((CFStringRef)key, xmlString);
-            _plistAppendUTF8CString(xmlString, "</");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">\n");
-            _CFAppendXML0(CFDictionaryGetValue((CFDictionaryRef)object, key), indentation+1, xmlString);
+            _appendIndents(indentation+1, writer);
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">");
+	    _appendEscapedString((CFStringRef)key, writer);
+            _plistAppendUTF8CString(writer, "</");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[KEY_IX], KEY_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">\n");
+            _CFAppendXML0(CFDictionaryGetValue((CFDictionaryRef)object, key), indentation+1, writer);
         }
         free_cftype_array(keys);
-        _appendIndents(indentation, xmlString);
-        _plistAppendUTF8CString(xmlString, "</");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _appendIndents(indentation, writer);
+        _plistAppendUTF8CString(writer, "</");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DICT_IX], DICT_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
     } else if (typeID == _kCFRuntimeIDCFData) {
-        _plistAppendUTF8CString(xmlString, "<");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DATA_IX], DATA_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
-        _XMLPlistAppendDataUsingBase64(xmlString, (CFDataRef)object, indentation);       
-        _appendIndents(indentation, xmlString);
-        _plistAppendUTF8CString(xmlString, "</");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DATA_IX], DATA_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _plistAppendUTF8CString(writer, "<");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DATA_IX], DATA_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
+        _XMLPlistAppendDataUsingBase64(writer, (CFDataRef)object, indentation);       
+        _appendIndents(indentation, writer);
+        _plistAppendUTF8CString(writer, "</");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DATA_IX], DATA_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
     } else if (typeID == _kCFRuntimeIDCFDate) {
         // YYYY '-' MM '-' DD 'T' hh ':' mm ':' ss 'Z'
 	int32_t y = 0, M = 0, d = 0, H = 0, m = 0, s = 0;
@@ -698,60 +845,60 @@ if (date.year != y || date.month != M || date.day != d || date.hour != H || date
         m = date.minute;
         s = (int32_t)date.second;
 
-        _plistAppendUTF8CString(xmlString, "<");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DATE_IX], DATE_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">");
-        _plistAppendFormat(xmlString, CFSTR("%04d-%02d-%02dT%02d:%02d:%02dZ"), y, M, d, H, m, s);
-        _plistAppendUTF8CString(xmlString, "</");
-        _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[DATE_IX], DATE_TAG_LENGTH);
-        _plistAppendUTF8CString(xmlString, ">\n");
+        _plistAppendUTF8CString(writer, "<");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DATE_IX], DATE_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">");
+        _plistAppendFormat(writer, CFSTR("%04d-%02d-%02dT%02d:%02d:%02dZ"), y, M, d, H, m, s);
+        _plistAppendUTF8CString(writer, "</");
+        _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[DATE_IX], DATE_TAG_LENGTH);
+        _plistAppendUTF8CString(writer, ">\n");
     } else if (typeID == _kCFRuntimeIDCFNumber) {
         if (CFNumberIsFloatType((CFNumberRef)object)) {
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[REAL_IX], REAL_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">");
-                CFStringRef s = __CFNumberCopyFormattingDescriptionAsFloat64(object);
-                _plistAppendString(xmlString, s);
-                CFRelease(s);
-            _plistAppendUTF8CString(xmlString, "</");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[REAL_IX], REAL_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">\n");
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[REAL_IX], REAL_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">");
+                char buffer[_kCFNumberShortestDescriptionMaxLength];
+                __CFNumberGetFormattingDescriptionAsFloat64(object, buffer);
+                _plistAppendUTF8CString(writer, buffer);
+            _plistAppendUTF8CString(writer, "</");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[REAL_IX], REAL_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">\n");
         } else {
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">");
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">");
 
-            _plistAppendFormat(xmlString, CFSTR("%@"), object);
+            _plistAppendFormat(writer, CFSTR("%@"), object);
 
-            _plistAppendUTF8CString(xmlString, "</");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, ">\n");
+            _plistAppendUTF8CString(writer, "</");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[INTEGER_IX], INTEGER_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, ">\n");
         }
     } else if (typeID == _kCFRuntimeIDCFBoolean) {
         if (CFBooleanGetValue((CFBooleanRef)object)) {
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[TRUE_IX], TRUE_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, "/>\n");
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[TRUE_IX], TRUE_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, "/>\n");
         } else {
-            _plistAppendUTF8CString(xmlString, "<");
-            _plistAppendCharacters(xmlString, CFXMLPlistTagsUnicode[FALSE_IX], FALSE_TAG_LENGTH);
-            _plistAppendUTF8CString(xmlString, "/>\n");
+            _plistAppendUTF8CString(writer, "<");
+            _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[FALSE_IX], FALSE_TAG_LENGTH);
+            _plistAppendUTF8CString(writer, "/>\n");
         }
     }
 }
 
-static void _CFGenerateXMLPropertyListToData(CFMutableDataRef xml, CFTypeRef propertyList) {
-    _plistAppendUTF8CString(xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE ");
-    _plistAppendCharacters(xml, CFXMLPlistTagsUnicode[PLIST_IX], PLIST_TAG_LENGTH);
-    _plistAppendUTF8CString(xml, " PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n<");
-    _plistAppendCharacters(xml, CFXMLPlistTagsUnicode[PLIST_IX], PLIST_TAG_LENGTH);
-    _plistAppendUTF8CString(xml, " version=\"1.0\">\n");
+static void _CFGenerateXMLPropertyList(_CFXMLPlistWriter *writer, CFTypeRef propertyList) {
+    _plistAppendUTF8CString(writer, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE ");
+    _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[PLIST_IX], PLIST_TAG_LENGTH);
+    _plistAppendUTF8CString(writer, " PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n<");
+    _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[PLIST_IX], PLIST_TAG_LENGTH);
+    _plistAppendUTF8CString(writer, " version=\"1.0\">\n");
 
-    _CFAppendXML0(propertyList, 0, xml);
+    _CFAppendXML0(propertyList, 0, writer);
 
-    _plistAppendUTF8CString(xml, "</");
-    _plistAppendCharacters(xml, CFXMLPlistTagsUnicode[PLIST_IX], PLIST_TAG_LENGTH);
-    _plistAppendUTF8CString(xml, ">\n");
+    _plistAppendUTF8CString(writer, "</");
+    _plistAppendCharacters(writer, CFXMLPlistTagsUnicode[PLIST_IX], PLIST_TAG_LENGTH);
+    _plistAppendUTF8CString(writer, ">\n");
 }
 
 // ========================================================================
@@ -766,7 +913,9 @@ CFDataRef _CFPropertyListCreateXMLData(CFAllocatorRef allocator, CFPropertyListR
         return NULL;
     }
     xml = CFDataCreateMutable(allocator, 0);
-    _CFGenerateXMLPropertyListToData(xml, propertyList);
+    _CFXMLPlistWriter *writer = _plistWriterCreate(xml, NULL, -1);
+    _CFGenerateXMLPropertyList(writer, propertyList);
+    _plistWriterFinish(writer, NULL);
     return xml;
 }
 
@@ -819,47 +968,59 @@ static UInt32 lineNumber(_CFXMLPlistParseInfo *pInfo) {
     return count;
 }
 
+CF_INLINE Boolean isXMLWhitespace(char ch) {
+    return (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r');
+}
+
+// Bit i is set when byte i of the block is one of the characters isXMLWhitespace() accepts
+CF_INLINE uint32_t xmlWhitespaceMask(const char *bytes) {
+    return __CFVectorEqualMask8((const uint8_t *)bytes, ' ', 0) | __CFVectorRangeMask8((const uint8_t *)bytes, '\t', '\n') | __CFVectorEqualMask8((const uint8_t *)bytes, '\r', 0);
+}
+
 // warning: doesn't have a good idea of Unicode white space
 CF_INLINE void skipWhitespace(_CFXMLPlistParseInfo *pInfo) {
-    while (pInfo->curr < pInfo->end) {
-        switch (*(pInfo->curr)) {
-            case ' ':
-            case '\t':
-            case '\n':
-            case '\r':
-                pInfo->curr ++;
-                continue;
-            default:
-                return;
+    // Most runs are a newline and a few tabs of indentation, and many are empty, so the first byte is checked on its own
+    const char *p = pInfo->curr, *end = pInfo->end;
+    if (p >= end || !isXMLWhitespace(*p)) return;
+    while (end - p >= __kCFVectorBlockLength8) {
+        uint32_t mask = ~xmlWhitespaceMask(p) & 0xFFFF;
+        if (mask) {
+            pInfo->curr = p + __builtin_ctz(mask);
+            return;
         }
+        p += __kCFVectorBlockLength8;
     }
+    while (p < end && isXMLWhitespace(*p)) p ++;
+    pInfo->curr = p;
 }
 
 /* All of these advance to the end of the given construct and return a pointer to the first character beyond the construct.  If the construct doesn't parse properly, NULL is returned. */
 
 // pInfo should be just past "<!--"
 static void skipXMLComment(_CFXMLPlistParseInfo *pInfo) {
-    const char *p = pInfo->curr;
-    const char *end = pInfo->end - 3; // Need at least 3 characters to compare against
-    while (p < end) {
-        if (*p == '-' && *(p+1) == '-' && *(p+2) == '>') {
-            pInfo->curr = p+3;
+    // Find each '>' with memchr and check for the "--" in front of it
+    const char *p = pInfo->curr + 2;
+    const char *end = pInfo->end - 1; // Need at least 3 characters to compare against
+    while (p < end && (p = (const char *)memchr(p, '>', end - p))) {
+        if (*(p-2) == '-' && *(p-1) == '-') {
+            pInfo->curr = p+1;
             return;
         }
-        p ++; 
+        p ++;
     }
     pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unterminated comment started on line %d"), lineNumber(pInfo));
 }
 
 // pInfo should be set to the first character after "<?"
 static void skipXMLProcessingInstruction(_CFXMLPlistParseInfo *pInfo) {
-    const char *begin = pInfo->curr, *end = pInfo->end - 2; // Looking for "?>" so we need at least 2 characters
-    while (pInfo->curr < end) {
-        if (*(pInfo->curr) == '?' && *(pInfo->curr+1) == '>') {
-            pInfo->curr += 2;
+    const char *begin = pInfo->curr, *end = pInfo->end - 1; // Looking for "?>" so we need at least 2 characters
+    const char *p = begin + 1;
+    while (p < end && (p = (const char *)memchr(p, '>', end - p))) {
+        if (*(p-1) == '?') {
+            pInfo->curr = p+1;
             return;
         }
-        pInfo->curr ++; 
+        p ++;
     }
     pInfo->curr = begin;
     pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Encountered unexpected EOF while parsing the processing instruction begun on line %d"), lineNumber(pInfo));
@@ -978,15 +1139,17 @@ static void parseCDSect_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRef stringD
     }
     pInfo->curr += CDSECT_TAG_LENGTH;
     begin = pInfo->curr; // Marks the first character of the CDATA content
-    end = pInfo->end-2; // So we can safely look 2 characters beyond p
-    while (pInfo->curr < end) {
-        if (*(pInfo->curr) == ']' && *(pInfo->curr+1) == ']' && *(pInfo->curr+2) == '>') {
+    // Find each '>' with memchr and check for the "]]" in front of it
+    const char *p = begin + 2;
+    end = pInfo->end;
+    while (p < end && (p = (const char *)memchr(p, '>', end - p))) {
+        if (*(p-2) == ']' && *(p-1) == ']') {
             // Found the end!
-            CFDataAppendBytes(stringData, (const UInt8 *)begin, pInfo->curr-begin);
-            pInfo->curr += 3;
+            CFDataAppendBytes(stringData, (const UInt8 *)begin, p-2-begin);
+            pInfo->curr = p+1;
             return;
         }
-        pInfo->curr ++;
+        p ++;
     }
     // Never found the end mark
     pInfo->curr = begin;
@@ -1125,7 +1288,44 @@ static void _cleanupStringMap(_CFXMLPlistParseInfo *pInfo) {
     pInfo->stringCache = NULL;
 }
 
-static CFStringRef _createUniqueStringWithUTF8Bytes(_CFXMLPlistParseInfo *pInfo, const char *base, CFIndex length) {
+// The scan that finds the end of a string also records whether it was all ASCII, which most plist strings are; those become eight-bit strings as they are. Other strings have their ASCII runs widened a block at a time, and only the runs in between go through the UTF-8 converter, which validates them.
+static CFStringRef _createStringWithUTF8Bytes(CFAllocatorRef allocator, const char *base, CFIndex length, Boolean isASCII) {
+    const uint8_t *bytes = (const uint8_t *)base;
+    if (isASCII) return CFStringCreateWithBytes(allocator, bytes, length, kCFStringEncodingASCII, false);
+    // CFStringCreateWithBytes() drops a leading byte order mark; leave that case to it
+    if ((length >= 3) && (bytes[0] == 0xEF) && (bytes[1] == 0xBB) && (bytes[2] == 0xBF)) return CFStringCreateWithBytes(allocator, bytes, length, kCFStringEncodingUTF8, false);
+
+    // No sequence decodes to more UTF-16 units than it has bytes
+    UniChar *chars = (UniChar *)CFAllocatorAllocate(allocator, length * sizeof(UniChar), 0);
+    if (!chars) return NULL;
+    CFIndex idx = 0, numChars = 0;
+    while (idx < length) {
+        CFIndex asciiLength = __CFVectorASCIIWiden(bytes + idx, chars + numChars, length - idx);
+        idx += asciiLength;
+        numChars += asciiLength;
+        if (idx == length) break;
+
+        // ASCII bytes never occur inside a multibyte sequence, so everything up to the next one converts on its own
+        CFIndex runEnd = idx + 1, usedBytes = 0, usedChars = 0;
+        while ((runEnd < length) && (bytes[runEnd] >= 0x80)) runEnd ++;
+        if (CFStringEncodingBytesToUnicode(kCFStringEncodingUTF8, 0, bytes + idx, runEnd - idx, &usedBytes, chars + numChars, length - numChars, &usedChars) != kCFStringEncodingConversionSuccess || usedBytes != runEnd - idx) {
+            CFAllocatorDeallocate(allocator, chars);
+            return NULL;
+        }
+        idx = runEnd;
+        numChars += usedChars;
+    }
+    // Multibyte sequences leave the buffer partly unused, and the string keeps it for its lifetime; give back anything past a quarter of it
+    if (numChars < length - length / 4) {
+        UniChar *shrunk = (UniChar *)CFAllocatorReallocate(allocator, chars, numChars * sizeof(UniChar), 0);
+        if (shrunk) chars = shrunk;
+    }
+    CFStringRef result = CFStringCreateWithCharactersNoCopy(allocator, chars, numChars, allocator);
+    if (!result) CFAllocatorDeallocate(allocator, chars);
+    return result;
+}
+
+static CFStringRef _createUniqueStringWithUTF8Bytes(_CFXMLPlistParseInfo *pInfo, const char *base, CFIndex length, Boolean isASCII) {
     if (length == 0) return (CFStringRef)CFRetain(CFSTR(""));
     
     CFStringRef result = NULL;
@@ -1136,7 +1336,7 @@ static CFStringRef _createUniqueStringWithUTF8Bytes(_CFXMLPlistParseInfo *pInfo,
         result = (CFStringRef)CFArrayGetValueAtIndex(pInfo->stringCache, (CFIndex)payload - 1);
         CFRetain(result);
     } else {
-        result = CFStringCreateWithBytes(pInfo->allocator, (const UInt8 *)base, length, kCFStringEncodingUTF8, NO);
+        result = _createStringWithUTF8Bytes(pInfo->allocator, base, length, isASCII);
         if (!result) return NULL;
         // Payload must be >0, so the actual index of the value is at payload - 1
         // We also get add to the array after we make sure that CFBurstTrieAddUTF8String succeeds (it can fail, if the string is too large, for example)
@@ -1149,11 +1349,36 @@ static CFStringRef _createUniqueStringWithUTF8Bytes(_CFXMLPlistParseInfo *pInfo,
     return result;
 }
 
+// Advances pInfo->curr to the next '<' or '&', or to the end of the buffer, clearing *isASCII if any byte it passes is not ASCII
+CF_INLINE void scanToMarkup(_CFXMLPlistParseInfo *pInfo, Boolean *isASCII) {
+    const char *p = pInfo->curr, *end = pInfo->end;
+    while (end - p >= __kCFVectorBlockLength8) {
+        uint32_t stops = __CFVectorEqualMask8((const uint8_t *)p, '<', 0) | __CFVectorEqualMask8((const uint8_t *)p, '&', 0);
+        uint32_t nonASCII = __CFVectorNonASCIIMask8((const uint8_t *)p);
+        if (stops) {
+            CFIndex offset = __builtin_ctz(stops);
+            if (nonASCII & ((1U << offset) - 1)) *isASCII = false;
+            pInfo->curr = p + offset;
+            return;
+        }
+        if (nonASCII) *isASCII = false;
+        p += __kCFVectorBlockLength8;
+    }
+    while (p < end && *p != '<' && *p != '&') {
+        if (*p & 0x80) *isASCII = false;
+        p ++;
+    }
+    pInfo->curr = p;
+}
+
 // String could be comprised of characters, CDSects, or references to one of the "well-known" entities ('<', '>', '&', ''', '"')
 static Boolean parseStringTag(_CFXMLPlistParseInfo *pInfo, CFStringRef *out) {
     const char *mark = pInfo->curr;
     CFMutableDataRef stringData = NULL;
+    Boolean isASCII = true;
     while (!pInfo->error && pInfo->curr < pInfo->end) {
+        scanToMarkup(pInfo, &isASCII);
+        if (pInfo->curr >= pInfo->end) break;
         char ch = *(pInfo->curr);
         if (ch == '<') {
 	    if (pInfo->curr + 1 >= pInfo->end) break;
@@ -1168,8 +1393,6 @@ static Boolean parseStringTag(_CFXMLPlistParseInfo *pInfo, CFStringRef *out) {
             CFDataAppendBytes(stringData, (const UInt8 *)mark, pInfo->curr - mark);
             parseEntityReference_pl(pInfo, stringData); // TODO: move to return boolean
             mark = pInfo->curr;
-        } else {
-            pInfo->curr ++;
         }
     }
 
@@ -1183,14 +1406,14 @@ static Boolean parseStringTag(_CFXMLPlistParseInfo *pInfo, CFStringRef *out) {
             *out = NULL;
         } else {
             if (pInfo->mutabilityOption != kCFPropertyListMutableContainersAndLeaves) {
-                CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, mark, pInfo->curr - mark);
+                CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, mark, pInfo->curr - mark, isASCII);
                 if (!s) {
                     pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
                     return false;
                 }                    
                 *out = s;
             } else {
-                CFStringRef s = CFStringCreateWithBytes(pInfo->allocator, (const UInt8 *)mark, pInfo->curr - mark, kCFStringEncodingUTF8, NO);
+                CFStringRef s = _createStringWithUTF8Bytes(pInfo->allocator, mark, pInfo->curr - mark, isASCII);
                 if (!s) {
                     pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
                     return false;
@@ -1205,8 +1428,12 @@ static Boolean parseStringTag(_CFXMLPlistParseInfo *pInfo, CFStringRef *out) {
             *out = NULL;
         } else {
             CFDataAppendBytes(stringData, (const UInt8 *)mark, pInfo->curr - mark);
+            // Character references and CDATA sections can add bytes the scan never saw
+            const char *bytes = (const char *)CFDataGetBytePtr(stringData);
+            CFIndex length = CFDataGetLength(stringData);
+            isASCII = (__CFVectorASCIIPrefixLength8((const uint8_t *)bytes, length) == length);
             if (pInfo->mutabilityOption != kCFPropertyListMutableContainersAndLeaves) {
-                CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, (const char *)CFDataGetBytePtr(stringData), CFDataGetLength(stringData));
+                CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, bytes, length, isASCII);
                 if (!s) {
                     CFRelease(stringData);
                     pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
@@ -1214,7 +1441,7 @@ static Boolean parseStringTag(_CFXMLPlistParseInfo *pInfo, CFStringRef *out) {
                 }
                 *out = s;
             } else {
-                CFStringRef s = CFStringCreateWithBytes(pInfo->allocator, (const UInt8 *)CFDataGetBytePtr(stringData), CFDataGetLength(stringData), kCFStringEncodingUTF8, NO);
+                CFStringRef s = _createStringWithUTF8Bytes(pInfo->allocator, bytes, length, isASCII);
                 if (!s) {
                     CFRelease(stringData);
                     pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
@@ -2011,15 +2238,22 @@ static Boolean parseXMLElement(_CFXMLPlistParseInfo * _Nonnull pInfo, Boolean *
     int markerIx = -1;
     
     if (isKey) *isKey = false;
-    while (pInfo->curr < pInfo->end) {
-        char ch = *(pInfo->curr);
-        if (ch == ' ' || ch ==  '\t' || ch == '\n' || ch =='\r') {
-            if (markerLength == -1) markerLength = pInfo->curr - marker;
-        } else if (ch == '>') {
+    // The tag name runs to the first whitespace or '>'; anything after whitespace is only searched for the '>'
+    const char *p = marker, *end = pInfo->end;
+    while (end - p >= __kCFVectorBlockLength8) {
+        uint32_t mask = xmlWhitespaceMask(p) | __CFVectorEqualMask8((const uint8_t *)p, '>', 0);
+        if (mask) {
+            p += __builtin_ctz(mask);
             break;
         }
-        pInfo->curr ++;
+        p += __kCFVectorBlockLength8;
+    }
+    while (p < end && *p != '>' && !isXMLWhitespace(*p)) p ++;
+    if (p < end && *p != '>') {
+        markerLength = p - marker;
+        p = (const char *)memchr(p, '>', end - p);
     }
+    pInfo->curr = p ? p : end;
     if (pInfo->curr >= pInfo->end) {
         return false;
     }
@@ -2531,7 +2765,7 @@ static Boolean _CFPropertyListCreateWithData(CFAllocatorRef allocator, CFDataRef
     // Ignore the error from CFTryParseBinaryPlist -- if it doesn't work, we're going to try again anyway using the XML parser.
     // It would be lovely to be able to not just ignore the error and
     // have the error message actually relay issues with bplists.
-    if (doBinary && __CFTryParseBinaryPlist(allocator, data, (option&kCFPropertyListMutabilityMask), out, NULL)) {
+    if (doBinary && __CFTryParseBinaryPlist(allocator, data, (option&(kCFPropertyListMutabilityMask|kCFPropertyListReadConcurrently)), out, NULL)) {
 	if (format) *format = kCFPropertyListBinaryFormat_v1_0;
         return true;
     }
@@ -2938,6 +3172,28 @@ CFDataRef CFPropertyListCreateData(CFAllocatorRef allocator, CFPropertyListRef p
     return data;
 }
 
+// The document goes out through the writer's buffer as the plist is walked, so it is never held in memory whole
+static CFIndex _CFPropertyListWriteXML(CFPropertyListRef propertyList, CFWriteStreamRef stream, int fd, CFErrorRef *error) {
+    _CFXMLPlistWriter *writer = _plistWriterCreate(NULL, stream, fd);
+    _CFGenerateXMLPropertyList(writer, propertyList);
+    return _plistWriterFinish(writer, error);
+}
+
+CFIndex _CFPropertyListWriteXMLToFileDescriptor(CFPropertyListRef propertyList, int fd, CFErrorRef *error) {
+    CFAssert1(propertyList != NULL, __kCFLogAssertion, "%s(): Cannot be called with a NULL property list", __PRETTY_FUNCTION__);
+    __CFAssertIsPList(propertyList);
+
+    CFStringRef validErr = NULL;
+    if (!_CFPropertyListIsValidWithErrorString(propertyList, kCFPropertyListXMLFormat_v1_0, &validErr)) {
+        if (error) {
+            *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Property list invalid for format: %d (%@)"), kCFPropertyListXMLFormat_v1_0, validErr);
+        }
+        if (validErr) CFRelease(validErr);
+        return 0;
+    }
+    return _CFPropertyListWriteXML(propertyList, NULL, fd, error);
+}
+
 CFIndex CFPropertyListWrite(CFPropertyListRef propertyList, CFWriteStreamRef stream, CFPropertyListFormat format, CFOptionFlags options, CFErrorRef *error) {
     CFAssert1(stream != NULL, __kCFLogAssertion, "%s(): NULL stream not allowed", __PRETTY_FUNCTION__);
     CFAssert1(format != kCFPropertyListOpenStepFormat, __kCFLogAssertion, "%s(): kCFPropertyListOpenStepFormat not supported for writing", __PRETTY_FUNCTION__);
@@ -2960,42 +3216,7 @@ CFIndex CFPropertyListWrite(CFPropertyListRef propertyList, CFWriteStreamRef str
         return 0;
     }
     if (format == kCFPropertyListXMLFormat_v1_0) {
-        CFDataRef data = _CFPropertyListCreateXMLData(kCFAllocatorSystemDefault, propertyList, true);
-        if (!data) {
-            CFLog(kCFLogLevelError, CFSTR("Property list format kCFPropertyListXMLFormat_v1_0 specified but was not a valid property list type"));
-            return 0;
-        }
-        CFIndex len = CFDataGetLength(data);
-	const uint8_t *ptr = CFDataGetBytePtr(data);
-	while (0 < len) {
-	    CFIndex ret = CFWriteStreamWrite(stream, ptr, len);
-	    if (ret == 0) {
-                if (error) *error = __CFPropertyListCreateError(kCFPropertyListWriteStreamError, CFSTR("Property list writing could not be completed because stream is full."));
-                CFRelease(data);
-	        return 0;
-	    }
-	    if (ret < 0) {
-		CFErrorRef underlyingError = CFWriteStreamCopyError(stream);
-                if (underlyingError) {
-                    if (error) {
-                        // Wrap the error from CFWriteStreamCopy in a new error
-                        CFMutableDictionaryRef userInfo = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFCopyStringDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks); 
-                        CFDictionarySetValue(userInfo, kCFErrorDebugDescriptionKey, CFSTR("Property list writing could not be completed because the stream had an unknown error."));
-                        CFDictionarySetValue(userInfo, kCFErrorUnderlyingErrorKey, underlyingError);
-                        *error = CFErrorCreate(kCFAllocatorSystemDefault, kCFErrorDomainCocoa, kCFPropertyListWriteStreamError, userInfo);
-                        CFRelease(userInfo);
-                    }
-                    CFRelease(underlyingError);
-                }
-		CFRelease(data);
-		return 0;
-	    }
-	    ptr += ret;
-	    len -= ret;
-	}
-	len = CFDataGetLength(data);
-	CFRelease(data);
-        return len;
+        return _CFPropertyListWriteXML(propertyList, stream, -1, error);
     }
     if (format == kCFPropertyListBinaryFormat_v1_0) {
         CFIndex len = __CFBinaryPlistWrite(propertyList, stream, 0, options, error);
@@ -17,3 +17,6 @@ typedef CF_OPTIONS(CFOptionFlags, CFPropertyListSupportedFormats) {
 };
 
 #define kCFPropertyListMutabilityMask 0xFF  // first 8 bits
+
+// Lets the binary plist reader decode the elements of a large top level array, set or dictionary on several threads
+#define kCFPropertyListReadConcurrently (1UL << 16)
@@ -11,6 +11,7 @@
 
 #include <CoreFoundation/CFBase.h>
 #include <CoreFoundation/CFAttributedString.h>
+#include <CoreFoundation/CFAttributedStringPriv.h>
 #include "CFRunArray.h"
 #include <CoreFoundation/ForFoundationOnly.h>
 #include "CFInternal.h"
@@ -615,6 +616,189 @@ void CFAttributedStringRemoveAttribute(CFMutableAttributedStringRef attrStr, CFR
     // CFAttributedStringEndEditing(attrStr);
 }
 
+/* Attribute edits are applied in one sweep over the affected region. The region is cut wherever a run or an edit starts or ends; each piece gets its existing attributes with the edits covering it applied in order. Pieces with the same starting dictionary and the same edits share one resulting dictionary, which is only created the first time it is needed.
+*/
+typedef struct {
+    CFHashCode hash;
+    CFDictionaryRef base;
+    CFIndex firstPair, numPairs;    /* The (name, value) pairs applied to base, in __CFAttributeEditCache.pairs */
+    CFDictionaryRef attrs;          /* Retained; NULL for an unused slot */
+} __CFAttributeEditResult;
+
+typedef struct {
+    __CFAttributeEditResult *results;
+    CFIndex capacity, count;
+    CFTypeRef *pairs;
+    CFIndex numPairs, maxPairs;
+} __CFAttributeEditCache;
+
+typedef struct {
+    CFDictionaryRef attrs;
+    CFIndex length;
+} __CFAttributeEditSegment;
+
+static void __CFAttributeEditCacheInsert(__CFAttributeEditCache *cache, __CFAttributeEditResult *result) {
+    CFIndex mask = cache->capacity - 1;
+    CFIndex idx = result->hash & mask;
+    while (cache->results[idx].attrs) idx = (idx + 1) & mask;
+    cache->results[idx] = *result;
+    cache->count++;
+}
+
+static void __CFAttributeEditCacheGrow(__CFAttributeEditCache *cache) {
+    __CFAttributeEditResult *oldResults = cache->results;
+    CFIndex oldCapacity = cache->capacity;
+    cache->capacity = oldCapacity ? oldCapacity * 2 : 64;
+    cache->results = (__CFAttributeEditResult *)calloc(cache->capacity, sizeof(__CFAttributeEditResult));
+    cache->count = 0;
+    for (CFIndex idx = 0; idx < oldCapacity; idx++) {
+        if (oldResults[idx].attrs) __CFAttributeEditCacheInsert(cache, &oldResults[idx]);
+    }
+    free(oldResults);
+}
+
+/* Returns (without retaining) the dictionary for base with the active edits applied in order.
+*/
+static CFDictionaryRef __CFAttributeEditCacheGetAttributes(__CFAttributeEditCache *cache, CFAllocatorRef alloc, CFDictionaryRef base, const _CFAttributedStringAttributeEdit *edits, const CFIndex *active, CFIndex numActive) {
+    CFHashCode hash = (CFHashCode)base;
+    for (CFIndex cnt = 0; cnt < numActive; cnt++) {
+        hash = hash * 31 + (CFHashCode)edits[active[cnt]].name;
+        hash = hash * 31 + (CFHashCode)edits[active[cnt]].value;
+    }
+    
+    if (cache->count >= cache->capacity * 3 / 4) __CFAttributeEditCacheGrow(cache);
+    CFIndex mask = cache->capacity - 1;
+    for (CFIndex idx = hash & mask; cache->results[idx].attrs; idx = (idx + 1) & mask) {
+        __CFAttributeEditResult *result = &cache->results[idx];
+        if (result->hash != hash || result->base != base || result->numPairs != numActive) continue;
+        CFTypeRef *pairs = cache->pairs + result->firstPair * 2;
+        CFIndex cnt;
+        for (cnt = 0; cnt < numActive; cnt++) {
+            if (pairs[cnt * 2] != edits[active[cnt]].name || pairs[cnt * 2 + 1] != edits[active[cnt]].value) break;
+        }
+        if (cnt == numActive) return result->attrs;
+    }
+    
+    // Not seen yet; apply the edits to a copy, keeping the original if they turn out not to change anything
+    CFMutableDictionaryRef attrs = __CFAttributedStringCreateAttributesDictionary(alloc, base);
+    for (CFIndex cnt = 0; cnt < numActive; cnt++) {
+        const _CFAttributedStringAttributeEdit *edit = &edits[active[cnt]];
+        if (edit->value) {
+            CFDictionarySetValue(attrs, edit->name, edit->value);
+        } else {
+            CFDictionaryRemoveValue(attrs, edit->name);
+        }
+    }
+    __CFAttributeEditResult result = {hash, base, cache->numPairs, numActive, attrs};
+    if (CFEqual(attrs, base)) {
+        CFRelease(attrs);
+        result.attrs = (CFDictionaryRef)CFRetain(base);
+    }
+    if (cache->numPairs + numActive > cache->maxPairs) {
+        cache->maxPairs = __CFMax(cache->maxPairs * 2, cache->numPairs + numActive + 16);
+        cache->pairs = (CFTypeRef *)__CFSafelyReallocate(cache->pairs, cache->maxPairs * 2 * sizeof(CFTypeRef), NULL);
+    }
+    for (CFIndex cnt = 0; cnt < numActive; cnt++) {
+        cache->pairs[(cache->numPairs + cnt) * 2] = edits[active[cnt]].name;
+        cache->pairs[(cache->numPairs + cnt) * 2 + 1] = edits[active[cnt]].value;
+    }
+    cache->numPairs += numActive;
+    __CFAttributeEditCacheInsert(cache, &result);
+    return result.attrs;
+}
+
+void _CFAttributedStringApplyAttributeEdits(CFMutableAttributedStringRef attrStr, const _CFAttributedStringAttributeEdit *edits, CFIndex numEdits) {
+    if (CF_IS_OBJC(CFAttributedStringGetTypeID(), attrStr)) {	// No bulk equivalent on the other side; apply the edits one at a time
+        for (CFIndex cnt = 0; cnt < numEdits; cnt++) {
+            if (edits[cnt].value) {
+                CFAttributedStringSetAttribute(attrStr, edits[cnt].range, edits[cnt].name, edits[cnt].value);
+            } else {
+                CFAttributedStringRemoveAttribute(attrStr, edits[cnt].range, edits[cnt].name);
+            }
+        }
+        return;
+    }
+    __CFAssertIsAttributedStringAndMutable(attrStr);
+
+    // Find the region the edits touch
+    CFIndex start = -1, end = -1;
+    for (CFIndex cnt = 0; cnt < numEdits; cnt++) {
+        __CFAssertRangeIsInBounds(attrStr, edits[cnt].range.location, edits[cnt].range.length);
+        CFAssert1(cnt == 0 || edits[cnt - 1].range.location <= edits[cnt].range.location, __kCFLogAssertion, "%s(): edits are not sorted by location", __PRETTY_FUNCTION__);
+        if (edits[cnt].range.length == 0) continue;
+        if (start < 0) start = edits[cnt].range.location;
+        if (edits[cnt].range.location + edits[cnt].range.length > end) end = edits[cnt].range.location + edits[cnt].range.length;
+    }
+    if (start < 0) return;
+
+    CFAllocatorRef alloc = CFGetAllocator(attrStr);
+    __CFAttributeEditCache cache = {0};
+    __CFAttributeEditSegment *segments = NULL;
+    CFIndex numSegments = 0, maxSegments = 0;
+    CFIndex *active = (CFIndex *)malloc(numEdits * sizeof(CFIndex));
+    CFIndex numActive = 0, nextEdit = 0;
+    CFIndex loc = start;
+    CFRange runRange;
+    CFDictionaryRef base = (CFDictionaryRef)CFRunArrayGetValueAtIndex(attrStr->attributeArray, loc, &runRange, NULL);
+
+    while (loc < end) {
+        // Retire the edits that ended here and pick up the ones that start here; active stays in list order
+        CFIndex kept = 0;
+        for (CFIndex cnt = 0; cnt < numActive; cnt++) {
+            if (edits[active[cnt]].range.location + edits[active[cnt]].range.length > loc) active[kept++] = active[cnt];
+        }
+        numActive = kept;
+        while (nextEdit < numEdits && edits[nextEdit].range.location <= loc) {
+            if (edits[nextEdit].range.length > 0) active[numActive++] = nextEdit;
+            nextEdit++;
+        }
+
+        // The piece goes to the nearest run or edit boundary
+        CFIndex pieceEnd = runRange.location + runRange.length;
+        if (pieceEnd > end) pieceEnd = end;
+        if (nextEdit < numEdits && edits[nextEdit].range.location < pieceEnd) pieceEnd = edits[nextEdit].range.location;
+        for (CFIndex cnt = 0; cnt < numActive; cnt++) {
+            CFIndex editEnd = edits[active[cnt]].range.location + edits[active[cnt]].range.length;
+            if (editEnd < pieceEnd) pieceEnd = editEnd;
+        }
+
+        CFDictionaryRef attrs = numActive ? __CFAttributeEditCacheGetAttributes(&cache, alloc, base, edits, active, numActive) : base;
+        if (numSegments > 0 && segments[numSegments - 1].attrs == attrs) {
+            segments[numSegments - 1].length += pieceEnd - loc;
+        } else {
+            if (numSegments == maxSegments) {
+                maxSegments = maxSegments ? maxSegments * 2 : 16;
+                segments = (__CFAttributeEditSegment *)__CFSafelyReallocate(segments, maxSegments * sizeof(__CFAttributeEditSegment), NULL);
+            }
+            segments[numSegments].attrs = (CFDictionaryRef)CFRetain(attrs);
+            segments[numSegments].length = pieceEnd - loc;
+            numSegments++;
+        }
+
+        loc = pieceEnd;
+        if (loc < end && loc == runRange.location + runRange.length) {
+            base = (CFDictionaryRef)CFRunArrayGetValueAtIndex(attrStr->attributeArray, loc, &runRange, NULL);
+        }
+    }
+
+    // Swap the region for the new pieces; inserting them in order merges each with an equal neighbor
+    CFRunArrayReplace(attrStr->attributeArray, CFRangeMake(start, end - start), segments[0].attrs, segments[0].length);
+    loc = start + segments[0].length;
+    for (CFIndex cnt = 1; cnt < numSegments; cnt++) {
+        CFRunArrayInsert(attrStr->attributeArray, CFRangeMake(loc, segments[cnt].length), segments[cnt].attrs);
+        loc += segments[cnt].length;
+    }
+
+    for (CFIndex cnt = 0; cnt < numSegments; cnt++) CFRelease(segments[cnt].attrs);
+    for (CFIndex idx = 0; idx < cache.capacity; idx++) {
+        if (cache.results[idx].attrs) CFRelease(cache.results[idx].attrs);
+    }
+    free(segments);
+    free(cache.results);
+    free(cache.pairs);
+    free(active);
+}
+
 void CFAttributedStringReplaceAttributedString(CFMutableAttributedStringRef attrStr, CFRange range, CFAttributedStringRef replacement) {
     CF_OBJC_FUNCDISPATCHV(CFAttributedStringGetTypeID(), void, (NSMutableAttributedString *)attrStr, replaceCharactersInRange:NSMakeRange(range.location, range.length) withAttributedString:(NSAttributedString *)replacement);
     __CFAssertIsAttributedStringAndMutable(attrStr);
@@ -18,6 +18,18 @@ CF_EXPORT CFAttributedStringRef _CFAttributedStringCreateWithRuns(CFAllocatorRef
 CF_EXPORT void _CFAttributedStringGetRuns(CFAttributedStringRef attrStr, Boolean includeEmpty, CFDictionaryRef *attrDictionaries, CFRange *runRanges);
 CF_EXPORT CFIndex _CFAttributedStringGetNumberOfRuns(CFAttributedStringRef attrStr, Boolean includeEmpty);
 
+/* One attribute change for _CFAttributedStringApplyAttributeEdits(): sets name to value over range, or removes name from range if value is NULL.
+*/
+typedef struct {
+    CFRange range;
+    CFStringRef name;
+    CFTypeRef value;
+} _CFAttributedStringAttributeEdit;
+
+/* _CFAttributedStringApplyAttributeEdits() has the same result as calling CFAttributedStringSetAttribute() (or CFAttributedStringRemoveAttribute() for NULL values) for each edit in turn, but makes a single pass over the affected runs. Edits must be ordered by range.location; they may overlap, in which case later edits win. Identical resulting attribute dictionaries are shared, and adjacent runs that end up equal are coalesced.
+*/
+CF_EXPORT void _CFAttributedStringApplyAttributeEdits(CFMutableAttributedStringRef attrStr, const _CFAttributedStringAttributeEdit *edits, CFIndex numEdits);
+
 
 CF_EXTERN_C_END
 
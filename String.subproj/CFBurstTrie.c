@@ -68,6 +68,8 @@ static int pwrite(int fd, const void *buf, size_t nbyte, off_t offset) {
 #define MAX_LIST_SIZE               256 // 64
 #define MAX_BITMAP_SIZE             200
 #define MAX_BUFFER_SIZE             (4096<<2)
+#define MAX_SERIALIZE_BUFFER_SIZE   (1024 * 1024)
+#define MAX_BUILDER_MEMORY_SIZE     (64 * 1024 * 1024)
 
 #define NextTrie_GetPtr(p)  (p & ((~(uintptr_t)0)-3))
 #define NextTrie_GetKind(p) (p & 3)
@@ -632,6 +634,27 @@ Boolean CFBurstTrieSerialize(CFBurstTrieRef trie, CFStringRef path, CFBurstTrieO
     return success;
 }
 
+static Boolean mapSerializedCFBurstTrie(CFBurstTrieRef trie, int fd, off_t start_offset) {
+#if TARGET_OS_WIN32
+    HANDLE mappedFileHandle = (HANDLE)_get_osfhandle(fd);
+    // We need to make sure we have our own handle to keep this file open as long as the mmap lasts
+    DuplicateHandle(GetCurrentProcess(), mappedFileHandle, GetCurrentProcess(), &mappedFileHandle, 0, 0, DUPLICATE_SAME_ACCESS);
+    HANDLE mapHandle = CreateFileMapping(mappedFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapHandle) return false;
+    char *map = (char *)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, start_offset, trie->mapSize);
+    if (!map) return false;
+    trie->mapBase = map;
+    trie->mapHandle = mapHandle;
+    trie->mappedFileHandle = mappedFileHandle;
+#else
+    char *map = mmap(0, trie->mapSize, PROT_READ, MAP_FILE|MAP_SHARED, fd, start_offset);
+    if (map == MAP_FAILED) return false;
+    trie->mapBase = map;
+#endif
+    trie->isMmapped = true;
+    return true;
+}
+
 Boolean CFBurstTrieSerializeWithFileDescriptor(CFBurstTrieRef trie, int fd, CFBurstTrieOpts opts) {
     Boolean success = false;
     if (!trie->mapBase && fd >= 0) {
@@ -639,22 +662,7 @@ Boolean CFBurstTrieSerializeWithFileDescriptor(CFBurstTrieRef trie, int fd, CFBu
 
         trie->cflags = opts;
         trie->mapSize = serializeCFBurstTrie(trie, start_offset, fd);
-        
-#if TARGET_OS_WIN32
-        HANDLE mappedFileHandle = (HANDLE)_get_osfhandle(fd);
-        // We need to make sure we have our own handle to keep this file open as long as the mmap lasts
-        DuplicateHandle(GetCurrentProcess(), mappedFileHandle, GetCurrentProcess(), &mappedFileHandle, 0, 0, DUPLICATE_SAME_ACCESS);
-        HANDLE mapHandle = CreateFileMapping(mappedFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
-        if (!mapHandle) return NULL;
-        char *map = (char *)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, start_offset, trie->mapSize);
-        if (!map) return NULL;
-        trie->mapBase = map;
-        trie->mapHandle = mapHandle;
-        trie->mappedFileHandle = mappedFileHandle;
-#else
-        trie->mapBase = mmap(0, trie->mapSize, PROT_READ, MAP_FILE|MAP_SHARED, fd, start_offset);
-#endif
-        success = true;
+        if (trie->mapSize) success = mapSerializedCFBurstTrie(trie, fd, start_offset);
     }
     
     return success;
@@ -1682,6 +1690,185 @@ Boolean getMapCursorPayload(CFBurstTrieRef trie, const CompactMapCursor *cursor,
     return FALSE;
 }
 
+#if 0
+#pragma mark -
+#pragma mark Batch Lookup
+#endif
+
+// Keys in flight at once. Enough to cover a miss to memory while the others make progress.
+#define BATCH_LOOKUP_GROUP_SIZE     16
+
+typedef struct _BatchLookup {
+    const UInt8 *key;
+    uint32_t length;
+    uint32_t depth;
+    uint32_t next;
+    CFIndex index;
+} BatchLookup;
+
+static uint32_t findMappedPageEntry(CFBurstTrieRef trie, Page *page, const UInt8 *key, uint32_t length)
+{
+    uint32_t end = page->length;
+    uint32_t cur = 0;
+    if (trie->cflags & kCFBurstTriePrefixCompression) {
+        uint8_t pfx[CHARACTER_SET_SIZE];
+        PageEntryPacked *lastEntry = 0;
+        while (cur < end) {
+            PageEntryPacked *entry = (PageEntryPacked *)&page->data[cur];
+            if (lastEntry && entry->pfxLen>lastEntry->pfxLen) memcpy(pfx+lastEntry->pfxLen, lastEntry->string, entry->pfxLen-lastEntry->pfxLen);
+            if (entry->pfxLen+entry->strlen == length &&
+                __builtin_memcmp(pfx, key, entry->pfxLen) == 0 &&
+                __builtin_memcmp(entry->string, key+entry->pfxLen, entry->strlen) == 0) {
+                return entry->payload;
+            }
+            lastEntry = entry;
+            cur += getPackedPageEntrySize(entry);
+        }
+    } else {
+        while (cur < end) {
+            PageEntry *entry = (PageEntry *)&page->data[cur];
+            if (entry->strlen == length && __builtin_memcmp(entry->string, key, length) == 0) return entry->payload;
+            cur += getPageEntrySize(entry);
+        }
+    }
+    return 0;
+}
+
+// Touches the line the next step of this lookup is going to read: the one slot it needs from a dense
+// level, or the head of a compact level or page.
+CF_INLINE void prefetchMappedLookup(CFBurstTrieRef trie, const BatchLookup *lookup)
+{
+    const char *ptr = (const char *)DiskNextTrie_GetPtr(trie->mapBase, lookup->next);
+    if (DiskNextTrie_GetKind(lookup->next) == TrieKind) {
+        MapTrieLevelRef level = (MapTrieLevelRef)ptr;
+        ptr = (lookup->depth < lookup->length) ? (const char *)&level->slots[lookup->key[lookup->depth]] : (const char *)&level->payload;
+    }
+    __builtin_prefetch(ptr);
+}
+
+// Moves a lookup down one level. Returns true once the outcome is known, with the payload (0 when the
+// key is absent) in *payload.
+static bool stepMappedLookup(CFBurstTrieRef trie, BatchLookup *lookup, uint32_t *payload)
+{
+    char *ptr = (char *)DiskNextTrie_GetPtr(trie->mapBase, lookup->next);
+    uint32_t next = Nothing;
+
+    switch (DiskNextTrie_GetKind(lookup->next)) {
+        case TrieKind: {
+            MapTrieLevelRef level = (MapTrieLevelRef)ptr;
+            if (lookup->depth == lookup->length) {
+                *payload = level->payload;
+                return true;
+            }
+            next = level->slots[lookup->key[lookup->depth++]];
+            break;
+        }
+        case CompactTrieKind: {
+            CompactMapTrieLevelRef level = (CompactMapTrieLevelRef)ptr;
+            if (lookup->depth == lookup->length) {
+                *payload = level->payload;
+                return true;
+            }
+            uint8_t mykey = lookup->key[lookup->depth++];
+            uint8_t slot = mykey / 64;
+            uint8_t bit = mykey % 64;
+            uint64_t bword = level->bitmap[slot];
+            if (bword & (1ull << bit)) {
+                uint32_t item = 0;
+                for (int i=0; i < slot; i++) item += __builtin_popcountll(level->bitmap[i]);
+                item += __builtin_popcountll(bword & ((1ull << bit)-1));
+                next = level->slots[item];
+            }
+            break;
+        }
+        case ListKind:
+            *payload = findMappedPageEntry(trie, (Page *)ptr, lookup->key+lookup->depth, lookup->length-lookup->depth);
+            return true;
+    }
+
+    if (next == Nothing) {
+        *payload = 0;
+        return true;
+    }
+    lookup->next = next;
+    return false;
+}
+
+// Starts the next key that can be looked up at all, recording a miss for every one that cannot.
+static bool startMappedLookup(CFBurstTrieRef trie, BatchLookup *lookup, const UInt8 *const *keys, const CFIndex *lengths, CFIndex count, CFIndex *issued, uint32_t *payloads)
+{
+    while (*issued < count) {
+        CFIndex index = (*issued)++;
+        if (lengths[index] >= 0 && lengths[index] < MAX_STRING_SIZE) {
+            lookup->key = keys[index];
+            lookup->length = (uint32_t)lengths[index];
+            lookup->depth = 0;
+            lookup->next = ((TrieHeader *)trie->mapBase)->rootOffset|TrieKind;
+            lookup->index = index;
+            prefetchMappedLookup(trie, lookup);
+            return true;
+        }
+        payloads[index] = 0;
+    }
+    return false;
+}
+
+CFIndex CFBurstTrieContainsUTF8Strings(CFBurstTrieRef trie, const UInt8 *const *keys, const CFIndex *lengths, CFIndex count, uint32_t *payloads)
+{
+    CFIndex found = 0;
+
+    if (!trie->mapBase || ((fileHeader *)trie->mapBase)->signature == 0xbabeface) {
+        for (CFIndex idx = 0; idx < count; idx++) {
+            payloads[idx] = 0;
+            if (CFBurstTrieContainsUTF8String(trie, (UInt8 *)keys[idx], lengths[idx], &payloads[idx])) found++;
+            else payloads[idx] = 0;
+        }
+        return found;
+    }
+
+    // Each lookup advances one level per visit and prefetches what it needs next, so by the time the
+    // round robin comes back to it the line is usually in cache. Finished lookups are replaced with new keys.
+    BatchLookup group[BATCH_LOOKUP_GROUP_SIZE];
+    CFIndex issued = 0, active = 0;
+    while (active < BATCH_LOOKUP_GROUP_SIZE && startMappedLookup(trie, &group[active], keys, lengths, count, &issued, payloads)) active++;
+
+    while (active > 0) {
+        for (CFIndex idx = 0; idx < active; ) {
+            BatchLookup *lookup = &group[idx];
+            uint32_t payload;
+            if (stepMappedLookup(trie, lookup, &payload)) {
+                payloads[lookup->index] = payload;
+                if (payload) found++;
+                if (!startMappedLookup(trie, lookup, keys, lengths, count, &issued, payloads)) {
+                    group[idx] = group[--active];
+                    continue;
+                }
+            } else {
+                prefetchMappedLookup(trie, lookup);
+            }
+            idx++;
+        }
+    }
+    return found;
+}
+
+Boolean CFBurstTrieAdviseAccessPattern(CFBurstTrieRef trie, CFBurstTrieAccessPattern pattern)
+{
+#if TARGET_OS_WIN32
+    return false;
+#else
+    if (!trie->mapBase || !trie->isMmapped) return false;
+    int advice;
+    switch (pattern) {
+        case kCFBurstTrieAccessPatternNormal: advice = MADV_NORMAL; break;
+        case kCFBurstTrieAccessPatternRandom: advice = MADV_RANDOM; break;
+        case kCFBurstTrieAccessPatternWillNeed: advice = MADV_WILLNEED; break;
+        default: return false;
+    }
+    return madvise(trie->mapBase, trie->mapSize, advice) == 0;
+#endif
+}
+
 // Legacy
 
 static Boolean burstTrieMappedFind(DiskTrieLevelRef trie, char *map, const UInt8 *key, uint32_t length, uint32_t *payload, bool prefix) {
@@ -1786,82 +1973,160 @@ static Boolean burstTrieMappedPageFind(StringPage *page, const UInt8 *key, uint3
 #pragma mark Serialization
 #endif
 
-static bool serializeCFBurstTrieLevels(CFBurstTrieRef trie, TrieLevelRef root, uint32_t *offset, off_t start_offset, bool dispose, bool isroot, int fd)
+// Serialized pages and levels are collected here and handed to write() in large sequential chunks.
+// Without a file descriptor everything stays in memory and offsets are relative to the buffer; every
+// slot that refers to another page or level is then recorded so the caller can relocate the buffer.
+typedef struct _SerializeBuffer {
+    int fd;
+    bool failed;
+    uint32_t offset;
+    char *bytes;
+    size_t length;
+    size_t capacity;
+    uint32_t *fixups;
+    size_t fixupCount;
+    size_t fixupCapacity;
+} SerializeBuffer;
+
+static bool writeSerializeBytes(int fd, const char *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+static void initSerializeBuffer(SerializeBuffer *buffer, int fd) {
+    bzero(buffer, sizeof(*buffer));
+    buffer->fd = fd;
+    if (fd >= 0) {
+        buffer->capacity = MAX_SERIALIZE_BUFFER_SIZE;
+        buffer->bytes = (char *) malloc(buffer->capacity);
+    }
+}
+
+static void destroySerializeBuffer(SerializeBuffer *buffer) {
+    free(buffer->bytes);
+    free(buffer->fixups);
+    bzero(buffer, sizeof(*buffer));
+}
+
+static void flushSerializeBuffer(SerializeBuffer *buffer) {
+    if (buffer->fd >= 0 && buffer->length) {
+        if (!buffer->failed && !writeSerializeBytes(buffer->fd, buffer->bytes, buffer->length)) buffer->failed = true;
+        buffer->length = 0;
+    }
+}
+
+static void appendSerializeBuffer(SerializeBuffer *buffer, const void *bytes, size_t length) {
+    if (buffer->failed) return;
+    if (length > UINT32_MAX - buffer->offset) {
+        // Offsets in the mapped format are 32 bits; a trie this large can't be written
+        buffer->failed = true;
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        if (buffer->fd >= 0) {
+            flushSerializeBuffer(buffer);
+            if (length > buffer->capacity) {
+                if (!buffer->failed && !writeSerializeBytes(buffer->fd, (const char *)bytes, length)) buffer->failed = true;
+                buffer->offset += length;
+                return;
+            }
+        } else {
+            size_t capacity = buffer->capacity ? buffer->capacity : MAX_BUFFER_SIZE;
+            while (capacity < buffer->length + length) capacity *= 2;
+            buffer->bytes = (char *) __CFSafelyReallocate(buffer->bytes, capacity, NULL);
+            buffer->capacity = capacity;
+        }
+    }
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+    buffer->offset += length;
+}
+
+static void addSerializeBufferFixup(SerializeBuffer *buffer, uint32_t position) {
+    if (buffer->fd >= 0) return;
+    if (buffer->fixupCount == buffer->fixupCapacity) {
+        buffer->fixupCapacity = buffer->fixupCapacity ? buffer->fixupCapacity * 2 : CHARACTER_SET_SIZE;
+        buffer->fixups = (uint32_t *) __CFSafelyReallocate(buffer->fixups, sizeof(uint32_t) * buffer->fixupCapacity, NULL);
+    }
+    buffer->fixups[buffer->fixupCount++] = position;
+}
+
+// Writes the final header over the placeholder at the start of the trie. The header is patched in the
+// buffer when none of the output has been flushed yet, so small tries go out in a single write.
+static bool finishSerializeBuffer(SerializeBuffer *buffer, TrieHeader *header, off_t start_offset) {
+    if (buffer->length == buffer->offset) {
+        memcpy(buffer->bytes, header, sizeof(*header));
+        flushSerializeBuffer(buffer);
+    } else {
+        flushSerializeBuffer(buffer);
+        if (!buffer->failed && pwrite(buffer->fd, header, sizeof(*header), start_offset) != sizeof(*header)) buffer->failed = true;
+    }
+    return !buffer->failed;
+}
+
+static uint32_t serializeCFBurstTrieSlot(CFBurstTrieRef trie, NextTrie next, SerializeBuffer *buffer);
+
+// Levels are written after the pages and levels they refer to, so every slot is final by the time the
+// level itself is appended. Returns the offset of the level tagged with the kind it was written as.
+static uint32_t serializeCFBurstTrieLevels(CFBurstTrieRef trie, TrieLevelRef root, SerializeBuffer *buffer, bool dispose, bool isroot)
 {
-    bool dense = true;
+    MapTrieLevel maptrie;
     int count = 0;
-    
-    for (int i=0; i < CHARACTER_SET_SIZE; i++) if (root->slots[i]) count++;
-    
-    uint32_t this_offset = *offset;
-    
+
+    for (int i=0; i < CHARACTER_SET_SIZE; i++) {
+        maptrie.slots[i] = serializeCFBurstTrieSlot(trie, root->slots[i], buffer);
+        if (maptrie.slots[i]) count++;
+        root->slots[i] = 0;
+    }
+    maptrie.payload = root->payload;
+    if (dispose) free(root);
+
+    uint32_t this_offset = buffer->offset;
+
     if ((trie->cflags & kCFBurstTrieBitmapCompression) && count < MAX_BITMAP_SIZE && !isroot) {
         size_t size = sizeof(CompactMapTrieLevel) + sizeof(uint32_t) * count;
         int offsetSlot = 0;
-        
-        CompactMapTrieLevel *maptrie = (CompactMapTrieLevel *)alloca(size);
-        bzero(maptrie, size);
-        *offset += size;
-        
+
+        CompactMapTrieLevel *compacttrie = (CompactMapTrieLevel *)alloca(size);
+        bzero(compacttrie, size);
+
         for (int i=0; i < CHARACTER_SET_SIZE; i++) {
-            NextTrie next = root->slots[i];
-            if (next) {
+            if (maptrie.slots[i]) {
                 uint32_t slot = i / 64;
                 uint32_t bit = i % 64;
-                maptrie->bitmap[slot] |= 1ull<<bit;
-                if (NextTrie_GetKind(next) == TrieKind) {
-                    TrieLevelRef nextLevel = (TrieLevelRef)NextTrie_GetPtr(next);
-                    uint32_t childOffset = *offset;
-                    if (serializeCFBurstTrieLevels(trie, nextLevel, offset, start_offset, true, false, fd)) {
-                        maptrie->slots[offsetSlot] = (TrieKind|childOffset);
-                    } else {
-                        maptrie->slots[offsetSlot] = (CompactTrieKind|childOffset);
-                    }
-                } else {
-                    maptrie->slots[offsetSlot] = next;
-                }
+                compacttrie->bitmap[slot] |= 1ull<<bit;
+                compacttrie->slots[offsetSlot] = maptrie.slots[i];
+                addSerializeBufferFixup(buffer, this_offset + offsetof(CompactMapTrieLevel, slots) + sizeof(uint32_t) * offsetSlot);
                 offsetSlot++;
             }
         }
-        maptrie->payload = root->payload;
-        
-        int bitcount = 0;
-        for (int i=0; i < 4; i++) bitcount += __builtin_popcountll(maptrie->bitmap[i]);
-        assert(bitcount == count);
-        
-        pwrite(fd, maptrie, size, this_offset+start_offset);
-        dense = false;
+        compacttrie->payload = maptrie.payload;
+
+        appendSerializeBuffer(buffer, compacttrie, size);
+        return (this_offset|CompactTrieKind);
     } else {
-        MapTrieLevel maptrie;
-        *offset += sizeof(maptrie);
-        
         for (int i=0; i < CHARACTER_SET_SIZE; i++) {
-            NextTrie next = root->slots[i];
-            if (NextTrie_GetKind(next) == TrieKind) {
-                TrieLevelRef nextLevel = (TrieLevelRef)NextTrie_GetPtr(next);
-                uint32_t childOffset = *offset;
-                if (serializeCFBurstTrieLevels(trie, nextLevel, offset, start_offset, true, false, fd)) {
-                    maptrie.slots[i] = (TrieKind|childOffset);
-                } else {
-                    maptrie.slots[i] = (CompactTrieKind|childOffset);
-                }
-            } else {
-                maptrie.slots[i] = next;
-            }
+            if (maptrie.slots[i]) addSerializeBufferFixup(buffer, this_offset + offsetof(MapTrieLevel, slots) + sizeof(uint32_t) * i);
         }
-        maptrie.payload = root->payload;
-        pwrite(fd, &maptrie, sizeof(maptrie), this_offset+start_offset);
+        appendSerializeBuffer(buffer, &maptrie, sizeof(maptrie));
+        return (this_offset|TrieKind);
     }
-    
-    if (dispose) free(root);
-    return dense;
 }
 
-static void serializeCFBurstTrieList(CFBurstTrieRef trie, ListNodeRef listNode, int fd)
+static uint32_t serializeCFBurstTrieList(CFBurstTrieRef trie, ListNodeRef listNode, SerializeBuffer *buffer)
 {
     uint32_t listCount;
     size_t size = trie->containerSize;
-    
+    uint32_t offset = buffer->offset;
+
     // ** Temp list of nodes to sort
     ListNodeRef *nodes = (ListNodeRef *)malloc(sizeof(ListNodeRef) * size);
     for (listCount = 0; listNode; listCount++) {
@@ -1872,13 +2137,14 @@ static void serializeCFBurstTrieList(CFBurstTrieRef trie, ListNodeRef listNode,
         nodes[listCount] = listNode;
         listNode = listNode->next;
     }
-    
+
     char _buffer[MAX_BUFFER_SIZE];
     size_t bufferSize = (sizeof(Page) + size * (sizeof(PageEntryPacked) + MAX_STRING_SIZE));
-    char *buffer = bufferSize < MAX_BUFFER_SIZE ? _buffer : (char *) malloc(bufferSize);
+    char *pageBuffer = bufferSize < MAX_BUFFER_SIZE ? _buffer : (char *) malloc(bufferSize);
 
-    Page *page = (Page *)buffer;
+    Page *page = (Page *)pageBuffer;
     uint32_t current = 0;
+    size_t len;
 
     if (trie->cflags & kCFBurstTriePrefixCompression) {
         qsort(nodes, listCount, sizeof(ListNodeRef), nodeStringCompare);
@@ -1888,11 +2154,11 @@ static void serializeCFBurstTrieList(CFBurstTrieRef trie, ListNodeRef listNode,
             listNode = nodes[i];
             uint8_t pfxLen = 0;
             if (last) {
-                for ( ; 
-                     pfxLen < CHARACTER_SET_SIZE-1 && 
-                     pfxLen < listNode->length && 
-                     pfxLen < last->length && 
-                     listNode->string[pfxLen] == last->string[pfxLen]; 
+                for ( ;
+                     pfxLen < CHARACTER_SET_SIZE-1 &&
+                     pfxLen < listNode->length &&
+                     pfxLen < last->length &&
+                     listNode->string[pfxLen] == last->string[pfxLen];
                      pfxLen++);
             }
 
@@ -1905,9 +2171,7 @@ static void serializeCFBurstTrieList(CFBurstTrieRef trie, ListNodeRef listNode,
             last = listNode;
         }
 
-        size_t len = (sizeof(PageEntryPacked) + current + 3) & ~3;
-        page->length = current;
-        write(fd, page, len);
+        len = (sizeof(PageEntryPacked) + current + 3) & ~3;
     } else {
         if (trie->cflags & kCFBurstTrieSortByKey)
             qsort(nodes, listCount, sizeof(ListNodeRef), nodeStringCompare);
@@ -1923,67 +2187,396 @@ static void serializeCFBurstTrieList(CFBurstTrieRef trie, ListNodeRef listNode,
             current += listNode->length + sizeof(PageEntry);
         }
 
-        size_t len = (sizeof(Page) + current + 3) & ~3;
-        page->length = current;
-        write(fd, page, len);
+        len = (sizeof(Page) + current + 3) & ~3;
     }
+    page->length = current;
+    bzero(&page->data[current], len - sizeof(Page) - current);
+    appendSerializeBuffer(buffer, page, len);
 
     free(nodes);
-    if (buffer != _buffer) free(buffer);
+    if (pageBuffer != _buffer) free(pageBuffer);
+    return (offset|ListKind);
 }
 
-static void serializeCFBurstTrieLists(CFBurstTrieRef trie, TrieLevelRef root, off_t start_offset, int fd)
+// Writes whatever hangs off a slot, freeing it on the way, and returns the tagged offset it was written at.
+static uint32_t serializeCFBurstTrieSlot(CFBurstTrieRef trie, NextTrie next, SerializeBuffer *buffer)
 {
-    for (int i=0; i < CHARACTER_SET_SIZE; i++) {
-        NextTrie next = root->slots[i];
-        uint32_t offset;
-        if (NextTrie_GetKind(next) == TrieKind) {
-            TrieLevelRef nextLevel = (TrieLevelRef)NextTrie_GetPtr(next);
-            serializeCFBurstTrieLists(trie, nextLevel, start_offset, fd);
-        } else {
-            if (NextTrie_GetKind(next) == ListKind) {
-                ListNodeRef listNode = (ListNodeRef)NextTrie_GetPtr(next);
-                offset = lseek(fd, 0, SEEK_CUR) - start_offset;
-                serializeCFBurstTrieList(trie, listNode, fd);
-                finalizeCFBurstTrieList(listNode);
-                //assert((offset & 3)==0);
-                root->slots[i] = (offset|ListKind);
-            }
-        }
+    uint32_t slot = Nothing;
+    if (NextTrie_GetKind(next) == TrieKind) {
+        slot = serializeCFBurstTrieLevels(trie, (TrieLevelRef)NextTrie_GetPtr(next), buffer, true, false);
+    } else if (NextTrie_GetKind(next) == ListKind) {
+        ListNodeRef listNode = (ListNodeRef)NextTrie_GetPtr(next);
+        slot = serializeCFBurstTrieList(trie, listNode, buffer);
+        finalizeCFBurstTrieList(listNode);
     }
+    return slot;
 }
 
 static size_t serializeCFBurstTrie(CFBurstTrieRef trie, size_t start_offset, int fd)
 {
     TrieHeader header;
+    bzero(&header, sizeof(header));
     header.signature = 0x0ddba11;
-    header.rootOffset = 0;
     header.count = trie->count;
-    header.size = 0;
     header.flags = trie->cflags;
-    header.reserved[0] = 0;
-    
-    uint32_t offset;
+
     lseek(fd, start_offset, SEEK_SET);
-    
-    size_t header_size = sizeof(header);
-    write(fd, &header, header_size);
-    
-    serializeCFBurstTrieLists(trie, &trie->root, start_offset, fd);
-    
-    offset = lseek(fd, 0, SEEK_CUR) - start_offset;
-    size_t off = offsetof(TrieHeader, rootOffset);
-    size_t offsize = sizeof(offset);
-    pwrite(fd, &offset, offsize, off+start_offset);
-    
-    serializeCFBurstTrieLevels(trie, &trie->root, &offset, start_offset, false, true, fd);
-    
-    size_t off2 = offsetof(TrieHeader, size);
-    offsize = sizeof(offset);
-    pwrite(fd, &offset, offsize, off2+start_offset);
-    
-    offset = lseek(fd, 0, SEEK_END);
-    return (size_t)(offset-start_offset);
+
+    SerializeBuffer buffer;
+    initSerializeBuffer(&buffer, fd);
+    appendSerializeBuffer(&buffer, &header, sizeof(header));
+
+    header.rootOffset = serializeCFBurstTrieLevels(trie, &trie->root, &buffer, false, true) & ~3;
+    header.size = buffer.offset;
+
+    size_t size = finishSerializeBuffer(&buffer, &header, start_offset) ? header.size : 0;
+    destroySerializeBuffer(&buffer);
+    return size;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Bulk Building
+#endif
+
+// Terms are buffered per first byte as a record followed by the key bytes, key[0] included.
+typedef struct _BuilderRecord {
+    uint32_t weight;
+    uint32_t payload;
+    uint32_t length;
+} BuilderRecord;
+
+typedef struct _BuilderSpillChunk {
+    off_t offset;
+    size_t length;
+} BuilderSpillChunk;
+
+typedef struct _BuilderPartition {
+    char *bytes;
+    size_t length;
+    size_t capacity;
+    BuilderSpillChunk *chunks;
+    CFIndex chunkCount;
+    CFIndex chunkCapacity;
+    size_t spilledLength;
+} BuilderPartition;
+
+typedef struct _BuiltPartition {
+    SerializeBuffer buffer;
+    uint32_t slot;
+    uint32_t count;
+    bool failed;
+} BuiltPartition;
+
+struct _CFBurstTrieBuilder {
+    CFBurstTrieRef trie;
+    size_t memoryLimit;
+    size_t bufferedBytes;
+    char *temporaryDirectory;
+    int spillFd;
+    off_t spillLength;
+    bool failed;
+    BuilderPartition partitions[CHARACTER_SET_SIZE];
+};
+
+static int openCFBurstTrieBuilderSpillFile(CFBurstTrieBuilderRef builder) {
+#if TARGET_OS_WIN32
+    return -1;
+#else
+    char path[PATH_MAX];
+    const char *directory = builder->temporaryDirectory;
+    if (!directory) directory = __CFgetenv("TMPDIR");
+    if (!directory) directory = "/tmp";
+    if (snprintf(path, sizeof(path), "%s/CFBurstTrie.XXXXXX", directory) >= (int)sizeof(path)) return -1;
+
+    // The file is only ever reached through the descriptor, so it disappears with the builder.
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+    return fd;
+#endif
+}
+
+static void spillCFBurstTrieBuilder(CFBurstTrieBuilderRef builder) {
+    if (builder->spillFd < 0) {
+        builder->spillFd = openCFBurstTrieBuilderSpillFile(builder);
+        if (builder->spillFd < 0) {
+            // Nowhere to spill to; keep everything in memory rather than failing the build.
+            builder->memoryLimit = SIZE_MAX;
+            return;
+        }
+    }
+
+    for (int i=0; i < CHARACTER_SET_SIZE; i++) {
+        BuilderPartition *partition = &builder->partitions[i];
+        if (!partition->length) continue;
+
+        if (!writeSerializeBytes(builder->spillFd, partition->bytes, partition->length)) {
+            builder->failed = true;
+            return;
+        }
+        if (partition->chunkCount == partition->chunkCapacity) {
+            partition->chunkCapacity = partition->chunkCapacity ? partition->chunkCapacity * 2 : 16;
+            partition->chunks = (BuilderSpillChunk *) __CFSafelyReallocate(partition->chunks, sizeof(BuilderSpillChunk) * partition->chunkCapacity, NULL);
+        }
+        partition->chunks[partition->chunkCount].offset = builder->spillLength;
+        partition->chunks[partition->chunkCount].length = partition->length;
+        partition->chunkCount++;
+        partition->spilledLength += partition->length;
+        builder->spillLength += partition->length;
+
+        free(partition->bytes);
+        partition->bytes = NULL;
+        partition->length = partition->capacity = 0;
+    }
+    builder->bufferedBytes = 0;
+}
+
+// Takes every record of a partition out of the builder, spilled chunks first so that terms are replayed
+// in arrival order.
+static char *takeCFBurstTrieBuilderPartition(CFBurstTrieBuilderRef builder, BuilderPartition *partition, size_t *length) {
+    size_t total = partition->spilledLength + partition->length;
+    char *records = partition->bytes;
+
+    if (!partition->chunkCount) {
+        partition->bytes = NULL;
+        partition->length = partition->capacity = 0;
+        *length = total;
+        return records;
+    }
+
+    records = (char *) malloc(total);
+    if (!records) return NULL;
+
+    size_t cur = 0;
+#if !TARGET_OS_WIN32
+    for (CFIndex i=0; i < partition->chunkCount; i++) {
+        BuilderSpillChunk *chunk = &partition->chunks[i];
+        size_t done = 0;
+        while (done < chunk->length) {
+            ssize_t got = pread(builder->spillFd, records + cur + done, chunk->length - done, chunk->offset + done);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                free(records);
+                return NULL;
+            }
+            done += got;
+        }
+        cur += chunk->length;
+    }
+#endif
+    memcpy(records + cur, partition->bytes, partition->length);
+    free(partition->bytes);
+    partition->bytes = NULL;
+    partition->length = partition->capacity = 0;
+    *length = total;
+    return records;
+}
+
+// Builds the subtrie under one root slot and serializes it into memory. Runs on a worker thread;
+// the only shared state it reads is the trie configuration and the partition it was handed.
+static void buildCFBurstTriePartition(CFBurstTrieBuilderRef builder, uint8_t byte, BuiltPartition *result) {
+    CFBurstTrieRef trie = builder->trie;
+    BuilderPartition *partition = &builder->partitions[byte];
+    size_t length = 0;
+
+    bzero(result, sizeof(*result));
+    char *records = takeCFBurstTrieBuilderPartition(builder, partition, &length);
+    if (!records) {
+        result->failed = true;
+        return;
+    }
+
+    TrieLevelRef scratch = (TrieLevelRef) calloc(1, sizeof(struct _TrieLevel));
+    for (size_t cur = 0; cur < length; ) {
+        BuilderRecord record;
+        memcpy(&record, records + cur, sizeof(record));
+        cur += sizeof(record);
+        if (addCFBurstTrieLevel(trie, scratch, (const uint8_t *)records + cur, record.length, record.weight, record.payload) == NewTerm) result->count++;
+        cur += record.length;
+    }
+    free(records);
+
+    initSerializeBuffer(&result->buffer, -1);
+    result->slot = serializeCFBurstTrieSlot(trie, scratch->slots[byte], &result->buffer);
+    result->failed = result->buffer.failed;
+    free(scratch);
+}
+
+CFBurstTrieBuilderRef CFBurstTrieBuilderCreate(CFDictionaryRef options) {
+    CFBurstTrieBuilderRef builder = (CFBurstTrieBuilderRef) calloc(1, sizeof(struct _CFBurstTrieBuilder));
+    builder->trie = options ? CFBurstTrieCreateWithOptions(options) : CFBurstTrieCreate();
+    builder->memoryLimit = MAX_BUILDER_MEMORY_SIZE;
+    builder->spillFd = -1;
+
+    CFNumberRef limit;
+    if (options && CFDictionaryGetValueIfPresent(options, kCFBurstTrieBuilderOptionNameMemoryLimit, (const void **)&limit)) {
+        CFIndex value;
+        if (CFNumberGetValue(limit, kCFNumberCFIndexType, &value) && value > 0) builder->memoryLimit = value;
+    }
+
+    CFStringRef directory;
+    if (options && CFDictionaryGetValueIfPresent(options, kCFBurstTrieBuilderOptionNameTemporaryDirectory, (const void **)&directory)) {
+        char path[PATH_MAX];
+        if (CFStringGetFileSystemRepresentation(directory, path, PATH_MAX)) builder->temporaryDirectory = strdup(path);
+    }
+    return builder;
+}
+
+Boolean CFBurstTrieBuilderAddUTF8StringWithWeight(CFBurstTrieBuilderRef builder, const UInt8 *chars, CFIndex numChars, uint32_t weight, uint32_t payload) {
+    CFBurstTrieRef trie = builder->trie;
+    if (builder->failed || trie->mapBase || numChars >= MAX_STRING_SIZE*4 || payload == 0) return false;
+
+    if (!numChars) {
+        // The empty key lives on the root level, which is written by the builder itself.
+        if (addCFBurstTrieLevel(trie, &trie->root, chars, 0, weight, payload) == NewTerm) trie->count++;
+        return true;
+    }
+
+    BuilderPartition *partition = &builder->partitions[chars[0]];
+    BuilderRecord record = { weight, payload, (uint32_t)numChars };
+    size_t needed = sizeof(record) + numChars;
+    if (partition->length + needed > partition->capacity) {
+        size_t capacity = partition->capacity ? partition->capacity : MAX_BUFFER_SIZE;
+        while (capacity < partition->length + needed) capacity *= 2;
+        partition->bytes = (char *) __CFSafelyReallocate(partition->bytes, capacity, NULL);
+        partition->capacity = capacity;
+    }
+    memcpy(partition->bytes + partition->length, &record, sizeof(record));
+    memcpy(partition->bytes + partition->length + sizeof(record), chars, numChars);
+    partition->length += needed;
+
+    builder->bufferedBytes += needed;
+    if (builder->bufferedBytes > builder->memoryLimit) spillCFBurstTrieBuilder(builder);
+    return !builder->failed;
+}
+
+Boolean CFBurstTrieBuilderAddWithWeight(CFBurstTrieBuilderRef builder, CFStringRef term, CFRange termRange, uint32_t weight, uint32_t payload) {
+    Boolean success = false;
+    CFIndex size = MAX_STRING_ALLOCATION_SIZE;
+    CFIndex bytesize = termRange.length * 4; //** 4-byte max character size
+    if (termRange.length < MAX_STRING_SIZE && payload > 0) {
+        CFIndex length;
+        UInt8 buffer[MAX_STRING_ALLOCATION_SIZE + 1];
+        UInt8 *key = buffer;
+        if (bytesize >= size) {
+            size = bytesize;
+            key = (UInt8 *) malloc(sizeof(UInt8) * size + 1);
+        }
+        CFStringGetBytes(term, termRange, kCFStringEncodingUTF8, (UInt8)'-', (Boolean)0, key, size, &length);
+
+        success = CFBurstTrieBuilderAddUTF8StringWithWeight(builder, key, length, weight, payload);
+        if (buffer != key) free(key);
+    }
+    return success;
+}
+
+CFBurstTrieRef CFBurstTrieBuilderCreateTrieWithFileDescriptor(CFBurstTrieBuilderRef builder, int fd, CFBurstTrieOpts opts) {
+    CFBurstTrieRef trie = builder->trie;
+    if (builder->failed || trie->mapBase || fd < 0) return NULL;
+
+    uint8_t partitions[CHARACTER_SET_SIZE];
+    CFIndex partitionCount = 0;
+    for (int i=0; i < CHARACTER_SET_SIZE; i++) {
+        if (builder->partitions[i].length || builder->partitions[i].chunkCount) partitions[partitionCount++] = i;
+    }
+
+    off_t start_offset = lseek(fd, 0, SEEK_END);
+    if (start_offset < 0) return NULL;
+    trie->cflags = opts;
+
+    TrieHeader header;
+    bzero(&header, sizeof(header));
+    header.signature = 0x0ddba11;
+    header.flags = trie->cflags;
+
+    SerializeBuffer output;
+    initSerializeBuffer(&output, fd);
+    appendSerializeBuffer(&output, &header, sizeof(header));
+
+    MapTrieLevel root;
+    bzero(&root, sizeof(root));
+    root.payload = trie->root.payload;
+
+    // Partitions are built a batch at a time and each batch is then relocated and appended in slot order.
+    // A batch holds at most one partition per processor, and no more buffered terms than the memory limit
+    // unless a single partition exceeds it on its own, so that memory use doesn't grow with the processor count.
+    CFIndex batchSize = __CFMax(1, __CFActiveProcessorCount());
+    BuiltPartition *built = (BuiltPartition *) calloc(batchSize, sizeof(BuiltPartition));
+    const uint8_t *partitionsPtr = partitions;
+    bool failed = false;
+
+    for (CFIndex start = 0, batchCount = 0; start < partitionCount && !failed; start += batchCount) {
+        size_t batchBytes = 0;
+        for (batchCount = 0; batchCount < batchSize && start + batchCount < partitionCount; batchCount++) {
+            BuilderPartition *partition = &builder->partitions[partitions[start + batchCount]];
+            size_t partitionBytes = partition->spilledLength + partition->length;
+            if (batchCount > 0 && partitionBytes > builder->memoryLimit - batchBytes) break;
+            batchBytes += partitionBytes;
+        }
+#if __HAS_DISPATCH__
+        dispatch_apply(batchCount, DISPATCH_APPLY_AUTO, ^(size_t idx) {
+            buildCFBurstTriePartition(builder, partitionsPtr[start + idx], &built[idx]);
+        });
+#else
+        for (CFIndex idx = 0; idx < batchCount; idx++) buildCFBurstTriePartition(builder, partitionsPtr[start + idx], &built[idx]);
+#endif
+
+        for (CFIndex idx = 0; idx < batchCount; idx++) {
+            BuiltPartition *part = &built[idx];
+            if (!part->failed && !failed && part->buffer.length > UINT32_MAX - output.offset) failed = true;
+            if (!part->failed && !failed) {
+                uint32_t base = output.offset;
+                for (size_t fixup = 0; fixup < part->buffer.fixupCount; fixup++) {
+                    uint32_t slot;
+                    memcpy(&slot, part->buffer.bytes + part->buffer.fixups[fixup], sizeof(slot));
+                    slot += base;
+                    memcpy(part->buffer.bytes + part->buffer.fixups[fixup], &slot, sizeof(slot));
+                }
+                appendSerializeBuffer(&output, part->buffer.bytes, part->buffer.length);
+                root.slots[partitionsPtr[start + idx]] = part->slot + base;
+                trie->count += part->count;
+            } else {
+                failed = true;
+            }
+            destroySerializeBuffer(&part->buffer);
+        }
+    }
+    free(built);
+
+    // The partitions have been consumed; the builder cannot be reused whether or not the write succeeds.
+    builder->failed = true;
+
+    header.count = trie->count;
+    header.rootOffset = output.offset;
+    appendSerializeBuffer(&output, &root, sizeof(root));
+    header.size = output.offset;
+
+    if (!failed) failed = !finishSerializeBuffer(&output, &header, start_offset);
+    destroySerializeBuffer(&output);
+
+    if (!failed) {
+        trie->mapSize = header.size;
+        failed = !mapSerializedCFBurstTrie(trie, fd, start_offset);
+    }
+    if (failed) {
+#if !TARGET_OS_WIN32
+        // Take the incomplete trie back off the end of the file; if that fails too, say so, since the file is left with it
+        if (0 != ftruncate(fd, start_offset)) CFLog(kCFLogLevelError, CFSTR("%s(): could not remove the incomplete trie from the file: %s"), __PRETTY_FUNCTION__, strerror(errno));
+#endif
+        return NULL;
+    }
+    return CFBurstTrieRetain(trie);
+}
+
+void CFBurstTrieBuilderRelease(CFBurstTrieBuilderRef builder) {
+    for (int i=0; i < CHARACTER_SET_SIZE; i++) {
+        free(builder->partitions[i].bytes);
+        free(builder->partitions[i].chunks);
+    }
+    if (builder->spillFd >= 0) close(builder->spillFd);
+    free(builder->temporaryDirectory);
+    CFBurstTrieRelease(builder->trie);
+    free(builder);
 }
 
 #if 0
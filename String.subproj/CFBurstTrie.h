@@ -17,6 +17,7 @@ CF_EXTERN_C_BEGIN
 
 typedef struct CF_BRIDGED_MUTABLE_TYPE(id) _CFBurstTrie *CFBurstTrieRef;
 typedef struct CF_BRIDGED_MUTABLE_TYPE(id) _CFBurstTrieCursor *CFBurstTrieCursorRef;
+typedef struct _CFBurstTrieBuilder *CFBurstTrieBuilderRef;
 
 typedef CF_OPTIONS(CFOptionFlags, CFBurstTrieOpts) {
         /*!
@@ -57,6 +58,19 @@ typedef CF_OPTIONS(CFOptionFlags, CFBurstTrieOpts) {
 // Value for this option should be a CFNumber which contains an int.
 #define kCFBurstTrieCreationOptionNameContainerSize CFSTR("ContainerSize")
 
+typedef CF_ENUM(CFIndex, CFBurstTrieAccessPattern) {
+    kCFBurstTrieAccessPatternNormal = 0,
+    kCFBurstTrieAccessPatternRandom,        // Scattered lookups; don't read ahead around each fault
+    kCFBurstTrieAccessPatternWillNeed       // Start paging the whole trie in now
+};
+
+// Builder only. Value for this option should be a CFNumber which contains a CFIndex: the number of bytes of
+// buffered terms kept in memory before they are spilled to a temporary file.
+#define kCFBurstTrieBuilderOptionNameMemoryLimit CFSTR("MemoryLimit")
+
+// Builder only. Value for this option should be a CFString path of the directory that holds the spill file.
+#define kCFBurstTrieBuilderOptionNameTemporaryDirectory CFSTR("TemporaryDirectory")
+
 typedef void (*CFBurstTrieTraversalCallback)(void* context, const UInt8* key, uint32_t keyLength, uint32_t payload, Boolean *stop);
 
 CF_EXPORT 
@@ -134,6 +148,17 @@ CF_EXPORT
 Boolean CFBurstTrieContainsUTF8String(CFBurstTrieRef trie, UInt8 *key, CFIndex length, uint32_t *payload) API_AVAILABLE(macos(10.7), ios(5.0), watchos(2.0), tvos(9.0));
 
 
+// Looks up count keys at once, interleaving their descents through a mapped trie so that the cache misses
+// of one key overlap with the work on the others. payloads[i] is set to the payload of keys[i], or to 0 when
+// it is absent. Returns the number of keys found.
+CF_EXPORT
+CFIndex CFBurstTrieContainsUTF8Strings(CFBurstTrieRef trie, const UInt8 *const *keys, const CFIndex *lengths, CFIndex count, uint32_t *payloads) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+// Passes an access pattern hint for the mapping of a trie created from a file or serialized to one.
+// Returns false for tries that are not memory mapped.
+CF_EXPORT
+Boolean CFBurstTrieAdviseAccessPattern(CFBurstTrieRef trie, CFBurstTrieAccessPattern pattern) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
 CF_EXPORT 
 Boolean CFBurstTrieSerialize(CFBurstTrieRef trie, CFStringRef path, CFBurstTrieOpts opts) API_AVAILABLE(macos(10.7), ios(4.2), watchos(2.0), tvos(9.0));
 
@@ -176,6 +201,28 @@ void CFBurstTrieTraverseFromCursor(CFBurstTrieCursorRef cursor, void *ctx, CFBur
 CF_EXPORT
 void CFBurstTrieCursorRelease(CFBurstTrieCursorRef cursor) API_AVAILABLE(macos(10.8), ios(6.0), watchos(2.0), tvos(9.0));
 
+/*  CFBurstTrieBuilder
+    Builds a read-only trie from a large stream of terms, sorted or not. Terms are partitioned by their first
+    byte and spilled to an unlinked temporary file whenever the buffered terms exceed the memory limit.
+    CFBurstTrieBuilderCreateTrieWithFileDescriptor then builds the partitions on worker threads and appends
+    the result to fd in the format written by CFBurstTrieSerializeWithFileDescriptor. A builder produces
+    at most one trie.
+*/
+CF_EXPORT
+CFBurstTrieBuilderRef CFBurstTrieBuilderCreate(CFDictionaryRef options) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+CF_EXPORT
+Boolean CFBurstTrieBuilderAddWithWeight(CFBurstTrieBuilderRef builder, CFStringRef term, CFRange termRange, uint32_t weight, uint32_t payload) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+CF_EXPORT
+Boolean CFBurstTrieBuilderAddUTF8StringWithWeight(CFBurstTrieBuilderRef builder, const UInt8 *chars, CFIndex numChars, uint32_t weight, uint32_t payload) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+CF_EXPORT
+CFBurstTrieRef CFBurstTrieBuilderCreateTrieWithFileDescriptor(CFBurstTrieBuilderRef builder, int fd, CFBurstTrieOpts opts) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+CF_EXPORT
+void CFBurstTrieBuilderRelease(CFBurstTrieBuilderRef builder) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
 CF_EXTERN_C_END
 
 #endif /* __COREFOUNDATION_CFBURSTTRIE__ */
@@ -17,6 +17,7 @@
 #include "CFRuntime_Internal.h"
 #include <CoreFoundation/CFUniChar.h>
 #include "CFUniCharPriv.h"
+#include "CFVectorUtilities.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unicode/uchar.h>
@@ -3174,6 +3175,253 @@ void CFCharacterSetInitInlineBuffer(CFCharacterSetRef cset, CFCharacterSetInline
     }
 }
 
+/* Compiled matchers
+*/
+#define __kCFMatcherPageSize (__kCFBitmapSize / 256)
+
+struct __CFCharacterSetMatcher {
+    CFAllocatorRef _allocator;
+    uint8_t _asciiTable[16];	// Bit (c >> 4) of _asciiTable[c & 0xF] is set for each ASCII member c
+    uint16_t _pages[256];	// Index in _leaves of the bitmap for each 256-character page of the BMP
+    uint8_t (*_leaves)[__kCFMatcherPageSize];
+    UTF32Char (*_ranges)[2];	// Sorted and disjoint [first, last] ranges of supplementary members
+    CFIndex _rangeCount;
+};
+
+static void __CFCharacterSetMatcherAppendRange(CFCharacterSetMatcherRef matcher, CFIndex *capacity, UTF32Char first, UTF32Char last) {
+    if ((matcher->_rangeCount > 0) && (matcher->_ranges[matcher->_rangeCount - 1][1] + 1 == first)) {
+        matcher->_ranges[matcher->_rangeCount - 1][1] = last;
+        return;
+    }
+    if (matcher->_rangeCount == *capacity) {
+        *capacity = ((0 == *capacity) ? 16 : (*capacity * 2));
+        if (NULL == matcher->_ranges) {
+            matcher->_ranges = (UTF32Char (*)[2])CFAllocatorAllocate(matcher->_allocator, *capacity * sizeof(UTF32Char [2]), 0);
+        } else {
+            matcher->_ranges = (UTF32Char (*)[2])__CFSafelyReallocateWithAllocator(matcher->_allocator, matcher->_ranges, *capacity * sizeof(UTF32Char [2]), 0, NULL);
+        }
+    }
+    matcher->_ranges[matcher->_rangeCount][0] = first;
+    matcher->_ranges[matcher->_rangeCount][1] = last;
+    matcher->_rangeCount++;
+}
+
+/* The bitmap representation already resolves every kind of set, inversion and annex planes included, so the tables are built from it rather than from the set's own storage.
+*/
+CFCharacterSetMatcherRef _CFCharacterSetMatcherCreate(CFAllocatorRef alloc, CFCharacterSetRef cset) {
+    CFDataRef representation = CFCharacterSetCreateBitmapRepresentation(kCFAllocatorSystemDefault, cset);
+    if (NULL == representation) return NULL;
+
+    const uint8_t *bytes = CFDataGetBytePtr(representation);
+    CFIndex length = CFDataGetLength(representation);
+    CFIndex leafCount = 2, rangeCapacity = 0;
+
+    if (NULL == alloc) alloc = __CFGetDefaultAllocator();
+
+    CFCharacterSetMatcherRef matcher = (CFCharacterSetMatcherRef)CFAllocatorAllocate(alloc, sizeof(struct __CFCharacterSetMatcher), 0);
+    memset(matcher, 0, sizeof(struct __CFCharacterSetMatcher));
+    matcher->_allocator = (CFAllocatorRef)CFRetain(alloc);
+
+    for (UTF32Char character = 0; character < 0x80; character++) {
+        if (bytes[character >> LOG_BPB] & (1U << (character & 7))) matcher->_asciiTable[character & 0xF] |= (1U << (character >> 4));
+    }
+
+    // Leaf 0 is the empty page and leaf 1 the full one; other pages share a leaf only with an identical predecessor
+    matcher->_leaves = (uint8_t (*)[__kCFMatcherPageSize])CFAllocatorAllocate(alloc, (256 + 2) * __kCFMatcherPageSize, 0);
+    memset(matcher->_leaves[0], 0, __kCFMatcherPageSize);
+    memset(matcher->_leaves[1], 0xFF, __kCFMatcherPageSize);
+    for (CFIndex page = 0; page < 256; page++) {
+        const uint8_t *bits = bytes + (page * __kCFMatcherPageSize);
+
+        if (0 == memcmp(bits, matcher->_leaves[0], __kCFMatcherPageSize)) {
+            matcher->_pages[page] = 0;
+        } else if (0 == memcmp(bits, matcher->_leaves[1], __kCFMatcherPageSize)) {
+            matcher->_pages[page] = 1;
+        } else if ((leafCount > 2) && (0 == memcmp(bits, matcher->_leaves[leafCount - 1], __kCFMatcherPageSize))) {
+            matcher->_pages[page] = leafCount - 1;
+        } else {
+            memcpy(matcher->_leaves[leafCount], bits, __kCFMatcherPageSize);
+            matcher->_pages[page] = leafCount++;
+        }
+    }
+
+    // Each supplementary plane follows the BMP bitmap as its plane number and its own bitmap
+    for (CFIndex offset = __kCFBitmapSize; offset + __kCFBitmapSize + 1 <= length; offset += __kCFBitmapSize + 1) {
+        UTF32Char planeBase = (UTF32Char)bytes[offset] << 16;
+        const uint8_t *bits = bytes + offset + 1;
+        UTF32Char runStart = 0;
+        bool inRun = false;
+
+        for (UTF32Char character = 0; character < 0x10000;) {
+            uint8_t byte = bits[character >> LOG_BPB];
+
+            if ((0 == (character & 7)) && (byte == (inRun ? 0xFF : 0))) {
+                character += BITSPERBYTE;
+                continue;
+            }
+            if (((byte >> (character & 7)) & 1) != inRun) {
+                if (inRun) {
+                    __CFCharacterSetMatcherAppendRange(matcher, &rangeCapacity, runStart, planeBase + character - 1);
+                } else {
+                    runStart = planeBase + character;
+                }
+                inRun = !inRun;
+            }
+            character++;
+        }
+        if (inRun) __CFCharacterSetMatcherAppendRange(matcher, &rangeCapacity, runStart, planeBase + 0xFFFF);
+    }
+
+    CFRelease(representation);
+    return matcher;
+}
+
+void _CFCharacterSetMatcherDestroy(CFCharacterSetMatcherRef matcher) {
+    CFAllocatorRef allocator = matcher->_allocator;
+
+    if (matcher->_ranges) CFAllocatorDeallocate(allocator, matcher->_ranges);
+    CFAllocatorDeallocate(allocator, matcher->_leaves);
+    CFAllocatorDeallocate(allocator, matcher);
+    CFRelease(allocator);
+}
+
+CF_INLINE bool __CFCharacterSetMatcherIsBMPMember(CFCharacterSetMatcherRef matcher, UniChar character) {
+    return ((matcher->_leaves[matcher->_pages[character >> 8]][(character & 0xFF) >> LOG_BPB] >> (character & 7)) & 1) ? true : false;
+}
+
+static bool __CFCharacterSetMatcherIsSupplementaryMember(CFCharacterSetMatcherRef matcher, UTF32Char character) {
+    CFIndex low = 0, high = matcher->_rangeCount;
+
+    while (low < high) {
+        CFIndex middle = (low + high) / 2;
+
+        if (character < matcher->_ranges[middle][0]) {
+            high = middle;
+        } else if (character > matcher->_ranges[middle][1]) {
+            low = middle + 1;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+Boolean _CFCharacterSetMatcherIsLongCharacterMember(CFCharacterSetMatcherRef matcher, UTF32Char character) {
+    return ((character < 0x10000) ? __CFCharacterSetMatcherIsBMPMember(matcher, (UniChar)character) : __CFCharacterSetMatcherIsSupplementaryMember(matcher, character));
+}
+
+// Membership of the character starting at characters[index], which is *usedLength units long
+CF_INLINE bool __CFCharacterSetMatcherIsMemberAtIndex(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length, CFIndex index, CFIndex *usedLength) {
+    UniChar character = characters[index];
+
+    *usedLength = 1;
+    if ((character < 0xD800) || (character > 0xDFFF)) return __CFCharacterSetMatcherIsBMPMember(matcher, character);
+    if (CFUniCharIsSurrogateHighCharacter(character) && (index + 1 < length) && CFUniCharIsSurrogateLowCharacter(characters[index + 1])) {
+        *usedLength = 2;
+        return __CFCharacterSetMatcherIsSupplementaryMember(matcher, CFUniCharGetLongCharacterForSurrogatePair(character, characters[index + 1]));
+    }
+    return false;
+}
+
+/* The span functions classify whole blocks of ASCII with the vector table and stop at the first element that decides the answer or needs the full tables.
+*/
+CFIndex _CFCharacterSetMatcherFindMember(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length) {
+    CFIndex index = 0, usedLength;
+
+    while (index < length) {
+        if (index + __kCFVectorBlockLength16 <= length) {
+            uint32_t members = __CFVectorASCIISetMask16(characters + index, matcher->_asciiTable);
+            uint32_t stops = members | __CFVectorNonASCIIMask16(characters + index);
+
+            if (0 == stops) {
+                index += __kCFVectorBlockLength16;
+                continue;
+            }
+            index += __builtin_ctz(stops);
+            if (members & (1U << __builtin_ctz(stops))) return index;
+        }
+        if (__CFCharacterSetMatcherIsMemberAtIndex(matcher, characters, length, index, &usedLength)) return index;
+        index += usedLength;
+    }
+    return kCFNotFound;
+}
+
+CFIndex _CFCharacterSetMatcherFindNonMember(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length) {
+    CFIndex index = 0, usedLength;
+
+    while (index < length) {
+        if (index + __kCFVectorBlockLength16 <= length) {
+            uint32_t nonASCII = __CFVectorNonASCIIMask16(characters + index);
+            uint32_t stops = ~__CFVectorASCIISetMask16(characters + index, matcher->_asciiTable) & ((1U << __kCFVectorBlockLength16) - 1);
+
+            if (0 == stops) {
+                index += __kCFVectorBlockLength16;
+                continue;
+            }
+            index += __builtin_ctz(stops);
+            if (0 == (nonASCII & (1U << __builtin_ctz(stops)))) return index;
+        }
+        if (!__CFCharacterSetMatcherIsMemberAtIndex(matcher, characters, length, index, &usedLength)) return index;
+        index += usedLength;
+    }
+    return kCFNotFound;
+}
+
+CFIndex _CFCharacterSetMatcherCountMembers(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length) {
+    CFIndex index = 0, count = 0, usedLength;
+
+    while (index < length) {
+        if (index + __kCFVectorBlockLength16 <= length) {
+            uint32_t members = __CFVectorASCIISetMask16(characters + index, matcher->_asciiTable);
+            uint32_t nonASCII = __CFVectorNonASCIIMask16(characters + index);
+
+            if (0 == nonASCII) {
+                count += __builtin_popcount(members);
+                index += __kCFVectorBlockLength16;
+                continue;
+            }
+            count += __builtin_popcount(members & ((1U << __builtin_ctz(nonASCII)) - 1));
+            index += __builtin_ctz(nonASCII);
+        }
+        if (__CFCharacterSetMatcherIsMemberAtIndex(matcher, characters, length, index, &usedLength)) ++count;
+        index += usedLength;
+    }
+    return count;
+}
+
+/* Matchers of predefined sets, compiled on first use. Like __CFBuiltinSets, indexed by set ID - 1, and again by inversion.
+*/
+static CFCharacterSetMatcherRef __CFBuiltinSetMatchers[2][__kCFLastBuiltinSetID] = {{0}};
+
+CF_PRIVATE CFCharacterSetMatcherRef __CFCharacterSetGetBuiltinMatcher(CFCharacterSetRef cset) {
+    if (CF_IS_OBJC(_kCFRuntimeIDCFCharacterSet, cset) || CF_IS_SWIFT(_kCFRuntimeIDCFCharacterSet, cset)) return NULL;
+    if (!__CFCSetIsBuiltin(cset) || __CFCSetIsMutable(cset) || (NULL != cset->_annex)) return NULL;
+
+    CFIndex inverted = (__CFCSetIsInverted(cset) ? 1 : 0);
+    CFIndex index = __CFCSetBuiltinType(cset) - 1;
+    CFCharacterSetMatcherRef matcher;
+
+    _CFCharacterSetLockGlobal();
+    matcher = __CFBuiltinSetMatchers[inverted][index];
+    _CFCharacterSetUnlockGlobal();
+
+    if (NULL != matcher) return matcher;
+
+    if (NULL == (matcher = _CFCharacterSetMatcherCreate(kCFAllocatorSystemDefault, cset))) return NULL;
+
+    _CFCharacterSetLockGlobal();
+    if (NULL == __CFBuiltinSetMatchers[inverted][index]) {
+        __CFBuiltinSetMatchers[inverted][index] = matcher;
+        _CFCharacterSetUnlockGlobal();
+    } else {
+        CFCharacterSetMatcherRef tmp = matcher;
+        matcher = __CFBuiltinSetMatchers[inverted][index];
+        _CFCharacterSetUnlockGlobal();
+        _CFCharacterSetMatcherDestroy(tmp);
+    }
+    return matcher;
+}
+
 
 #if DEPLOYMENT_RUNTIME_SWIFT
 CFIndex __CFCharDigitValue(UniChar ch) {
@@ -72,6 +72,23 @@ CF_EXPORT void _CFCharacterSetSetIsInverted(CFCharacterSetRef cset, bool flag);
 CF_EXPORT void _CFCharacterSetCompact(CFMutableCharacterSetRef cset);
 CF_EXPORT void _CFCharacterSetFast(CFMutableCharacterSetRef cset);
 
+/* Compiled matchers
+ A matcher is a flat snapshot of a character set's membership, meant for scanning many characters: a 16-byte table for ASCII that is classified a vector at a time, a two-level page table for the rest of the Basic Multilingual Plane, and a sorted list of ranges for the supplementary planes. It does not retain the set, and doesn't see later changes to a mutable one.
+ The span functions take UTF-16 units and return indices into them. A valid surrogate pair is tested as one character; surrogates that aren't part of a valid pair are never members, as in CFStringFindCharacterFromSet().
+*/
+typedef struct __CFCharacterSetMatcher *CFCharacterSetMatcherRef;
+
+CF_EXPORT CFCharacterSetMatcherRef _CFCharacterSetMatcherCreate(CFAllocatorRef alloc, CFCharacterSetRef cset);
+CF_EXPORT void _CFCharacterSetMatcherDestroy(CFCharacterSetMatcherRef matcher);
+CF_EXPORT Boolean _CFCharacterSetMatcherIsLongCharacterMember(CFCharacterSetMatcherRef matcher, UTF32Char character);
+
+/* Index of the first member (or non-member) in characters, or kCFNotFound */
+CF_EXPORT CFIndex _CFCharacterSetMatcherFindMember(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length);
+CF_EXPORT CFIndex _CFCharacterSetMatcherFindNonMember(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length);
+
+/* Number of member characters in characters; a member surrogate pair counts once */
+CF_EXPORT CFIndex _CFCharacterSetMatcherCountMembers(CFCharacterSetMatcherRef matcher, const UniChar *characters, CFIndex length);
+
 CF_EXTERN_C_END
 
 #endif /* ! __COREFOUNDATION_CFCHARACTERSETPRIV__ */
@@ -16,6 +16,7 @@
 #define U_SHOW_DRAFT_API 1
 #define U_SHOW_INTERNAL_API 1
 #include <unicode/uregex.h>
+#include <stdatomic.h>
 
 #define STACK_BUFFER_SIZE 256
 
@@ -25,12 +26,239 @@ struct ___CFRegularExpression {
     _CFRegularExpressionOptions options;
     URegularExpression *regex;
     int32_t _checkout;
+    int64_t _identifier; // Never reused, unlike the address
+    _Atomic(bool) _threadClonesKept; // Set once any thread has kept a clone of regex
 };
 
+/* Compiled patterns, most recently used first, keyed by the pattern as passed in and the options. Each entry holds an idle regex that is only ever cloned; clones share the compiled pattern, so creating a regular expression for a pattern seen recently doesn't compile it again.
+*/
+#define REGEX_CACHE_SIZE (256)
+
+typedef struct __CFRegularExpressionCacheEntry {
+    struct __CFRegularExpressionCacheEntry *_previous;
+    struct __CFRegularExpressionCacheEntry *_next;
+    CFStringRef _key;
+    _CFRegularExpressionOptions _options;
+    CFStringRef _pattern; // With the metacharacters escaped, if the options asked for it
+    URegularExpression *_regex;
+} __CFRegularExpressionCacheEntry;
+
+static CFLock_t __CFRegularExpressionCacheLock = CFLockInit;
+static CFMutableSetRef __CFRegularExpressionCache = NULL;
+static __CFRegularExpressionCacheEntry *__CFRegularExpressionCacheHead = NULL;
+static __CFRegularExpressionCacheEntry *__CFRegularExpressionCacheTail = NULL;
+
+static Boolean __CFRegularExpressionCacheEntryEqual(const void *value1, const void *value2) {
+    const __CFRegularExpressionCacheEntry *entry1 = (const __CFRegularExpressionCacheEntry *)value1;
+    const __CFRegularExpressionCacheEntry *entry2 = (const __CFRegularExpressionCacheEntry *)value2;
+    return (entry1->_options == entry2->_options) && CFEqual(entry1->_key, entry2->_key);
+}
+
+static CFHashCode __CFRegularExpressionCacheEntryHash(const void *value) {
+    const __CFRegularExpressionCacheEntry *entry = (const __CFRegularExpressionCacheEntry *)value;
+    return CFHash(entry->_key) ^ (CFHashCode)entry->_options;
+}
+
+static void __CFRegularExpressionCacheEntryDestroy(__CFRegularExpressionCacheEntry *entry) {
+    uregex_close(entry->_regex);
+    CFRelease(entry->_key);
+    CFRelease(entry->_pattern);
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, entry);
+}
+
+// Must be called with the cache lock held
+static void __CFRegularExpressionCacheUnlink(__CFRegularExpressionCacheEntry *entry) {
+    if (entry->_previous) entry->_previous->_next = entry->_next; else __CFRegularExpressionCacheHead = entry->_next;
+    if (entry->_next) entry->_next->_previous = entry->_previous; else __CFRegularExpressionCacheTail = entry->_previous;
+    entry->_previous = entry->_next = NULL;
+}
+
+static void __CFRegularExpressionCacheLinkAtHead(__CFRegularExpressionCacheEntry *entry) {
+    entry->_next = __CFRegularExpressionCacheHead;
+    if (__CFRegularExpressionCacheHead) __CFRegularExpressionCacheHead->_previous = entry; else __CFRegularExpressionCacheTail = entry;
+    __CFRegularExpressionCacheHead = entry;
+}
+
+// Returns a clone of the cached regex for the pattern and options, along with the pattern to report for it (retained), or NULL
+static URegularExpression *__CFRegularExpressionCacheCopyRegex(CFStringRef key, _CFRegularExpressionOptions options, CFStringRef *pattern) {
+    __CFRegularExpressionCacheEntry probe = {NULL, NULL, key, options, NULL, NULL};
+    __CFRegularExpressionCacheEntry *entry;
+    URegularExpression *regex = NULL;
+    UErrorCode errorCode = U_ZERO_ERROR;
+
+    __CFLock(&__CFRegularExpressionCacheLock);
+    entry = (__CFRegularExpressionCache ? (__CFRegularExpressionCacheEntry *)CFSetGetValue(__CFRegularExpressionCache, &probe) : NULL);
+    if (entry) {
+        regex = uregex_clone(entry->_regex, &errorCode);
+        if (U_FAILURE(errorCode)) {
+            if (regex) uregex_close(regex);
+            regex = NULL;
+        } else {
+            *pattern = (CFStringRef)CFRetain(entry->_pattern);
+            if (entry != __CFRegularExpressionCacheHead) {
+                __CFRegularExpressionCacheUnlink(entry);
+                __CFRegularExpressionCacheLinkAtHead(entry);
+            }
+        }
+    }
+    __CFUnlock(&__CFRegularExpressionCacheLock);
+
+    return regex;
+}
+
+static void __CFRegularExpressionCacheAddRegex(CFStringRef key, _CFRegularExpressionOptions options, CFStringRef pattern, const URegularExpression *regex) {
+    __CFRegularExpressionCacheEntry *entry, *evicted = NULL;
+    UErrorCode errorCode = U_ZERO_ERROR;
+    URegularExpression *idleRegex = uregex_clone(regex, &errorCode);
+
+    if (U_FAILURE(errorCode) || !idleRegex) {
+        if (idleRegex) uregex_close(idleRegex);
+        return;
+    }
+
+    entry = (__CFRegularExpressionCacheEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFRegularExpressionCacheEntry), 0);
+    entry->_previous = entry->_next = NULL;
+    entry->_key = CFStringCreateCopy(kCFAllocatorSystemDefault, key);
+    entry->_options = options;
+    entry->_pattern = (CFStringRef)CFRetain(pattern);
+    entry->_regex = idleRegex;
+
+    __CFLock(&__CFRegularExpressionCacheLock);
+    if (!__CFRegularExpressionCache) {
+        CFSetCallBacks callBacks = {0, NULL, NULL, NULL, __CFRegularExpressionCacheEntryEqual, __CFRegularExpressionCacheEntryHash};
+        __CFRegularExpressionCache = CFSetCreateMutable(kCFAllocatorSystemDefault, 0, &callBacks);
+    }
+    if (CFSetContainsValue(__CFRegularExpressionCache, entry)) { // Another thread compiled the same pattern first
+        evicted = entry;
+    } else {
+        CFSetAddValue(__CFRegularExpressionCache, entry);
+        __CFRegularExpressionCacheLinkAtHead(entry);
+        if (CFSetGetCount(__CFRegularExpressionCache) > REGEX_CACHE_SIZE) {
+            evicted = __CFRegularExpressionCacheTail;
+            __CFRegularExpressionCacheUnlink(evicted);
+            CFSetRemoveValue(__CFRegularExpressionCache, evicted);
+        }
+    }
+    __CFUnlock(&__CFRegularExpressionCacheLock);
+
+    if (evicted) __CFRegularExpressionCacheEntryDestroy(evicted);
+}
+
+/* Clones made on this thread because another match was using a regular expression's own regex. They stay with the thread afterwards, so concurrent matching with one regular expression clones it once per thread rather than once per match. Clones are found by the identifier of their regular expression, most recently used first.
+   A regular expression can only free the clones of the thread deallocating it. Its identifier is also added to a ring of recently deallocated identifiers, numbered by a generation count, and every other thread frees its clones of those the next time it takes or keeps a clone. A thread that has fallen more than a ring behind frees all of its clones. A thread that never matches again keeps at most REGEX_THREAD_CLONE_CACHE_SIZE clones until it exits.
+*/
+#define REGEX_THREAD_CLONE_CACHE_SIZE (16)
+#define REGEX_DEAD_IDENTIFIER_COUNT (64)
+
+static CFLock_t __CFRegularExpressionDeadLock = CFLockInit;
+static _Atomic(uint64_t) __CFRegularExpressionDeadGeneration = 0;
+static int64_t __CFRegularExpressionDeadIdentifiers[REGEX_DEAD_IDENTIFIER_COUNT]; // The identifier for generation g is at g % REGEX_DEAD_IDENTIFIER_COUNT
+
+typedef struct {
+    CFIndex _numClones;
+    uint64_t _deadGeneration; // Clones of regular expressions deallocated before this generation have been freed
+    struct {
+        int64_t _identifier;
+        URegularExpression *_regex;
+    } _clones[REGEX_THREAD_CLONE_CACHE_SIZE];
+} __CFRegularExpressionThreadData;
+
+static void __CFRegularExpressionThreadDataDestructor(void *context) {
+    __CFRegularExpressionThreadData *data = (__CFRegularExpressionThreadData *)context;
+
+    for (CFIndex index = 0; index < data->_numClones; index++) uregex_close(data->_clones[index]._regex);
+
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, data);
+}
+
+static __CFRegularExpressionThreadData *__CFRegularExpressionGetThreadData(Boolean create) {
+    __CFRegularExpressionThreadData *data = (__CFRegularExpressionThreadData *)_CFGetTSD(__CFTSDKeyRegularExpression);
+
+    if (!data && create) {
+        data = (__CFRegularExpressionThreadData *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFRegularExpressionThreadData), 0);
+        data->_numClones = 0;
+        data->_deadGeneration = atomic_load_explicit(&__CFRegularExpressionDeadGeneration, memory_order_acquire);
+        _CFSetTSD(__CFTSDKeyRegularExpression, (void *)data, __CFRegularExpressionThreadDataDestructor);
+    }
+
+    return data;
+}
+
+// Frees this thread's clones of regular expressions deallocated since it last looked
+static void __CFRegularExpressionDropDeadThreadClones(__CFRegularExpressionThreadData *data) {
+    uint64_t generation = atomic_load_explicit(&__CFRegularExpressionDeadGeneration, memory_order_acquire);
+    if (generation == data->_deadGeneration) return;
+    if (0 == data->_numClones) {
+        data->_deadGeneration = generation;
+        return;
+    }
+
+    URegularExpression *dead[REGEX_THREAD_CLONE_CACHE_SIZE];
+    CFIndex numDead = 0, numLive = 0;
+    __CFLock(&__CFRegularExpressionDeadLock);
+    generation = atomic_load_explicit(&__CFRegularExpressionDeadGeneration, memory_order_relaxed);
+    Boolean dropAll = (generation - data->_deadGeneration > REGEX_DEAD_IDENTIFIER_COUNT);
+    for (CFIndex index = 0; index < data->_numClones; index++) {
+        Boolean isDead = dropAll;
+        for (uint64_t g = data->_deadGeneration; !isDead && g < generation; g++) {
+            isDead = (__CFRegularExpressionDeadIdentifiers[g % REGEX_DEAD_IDENTIFIER_COUNT] == data->_clones[index]._identifier);
+        }
+        if (isDead) dead[numDead++] = data->_clones[index]._regex; else data->_clones[numLive++] = data->_clones[index];
+    }
+    __CFUnlock(&__CFRegularExpressionDeadLock);
+    data->_numClones = numLive;
+    data->_deadGeneration = generation;
+
+    for (CFIndex index = 0; index < numDead; index++) uregex_close(dead[index]);
+}
+
+// Removes this thread's clone for the regular expression from the cache and returns it, or NULL
+static URegularExpression *__CFRegularExpressionTakeThreadClone(int64_t identifier) {
+    __CFRegularExpressionThreadData *data = __CFRegularExpressionGetThreadData(false);
+
+    if (data) {
+        __CFRegularExpressionDropDeadThreadClones(data);
+        for (CFIndex index = 0; index < data->_numClones; index++) {
+            if (data->_clones[index]._identifier == identifier) {
+                URegularExpression *regex = data->_clones[index]._regex;
+                --data->_numClones;
+                memmove(data->_clones + index, data->_clones + index + 1, sizeof(data->_clones[0]) * (data->_numClones - index));
+                return regex;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void __CFRegularExpressionKeepThreadClone(struct ___CFRegularExpression *regexObj, URegularExpression *regex) {
+    __CFRegularExpressionThreadData *data = __CFRegularExpressionGetThreadData(true);
+    int64_t identifier = regexObj->_identifier;
+
+    __CFRegularExpressionDropDeadThreadClones(data);
+    if (!atomic_load_explicit(&regexObj->_threadClonesKept, memory_order_relaxed)) atomic_store_explicit(&regexObj->_threadClonesKept, true, memory_order_relaxed);
+    if (REGEX_THREAD_CLONE_CACHE_SIZE == data->_numClones) uregex_close(data->_clones[--data->_numClones]._regex);
+
+    memmove(data->_clones + 1, data->_clones, sizeof(data->_clones[0]) * data->_numClones);
+    data->_clones[0]._identifier = identifier;
+    data->_clones[0]._regex = regex;
+    ++data->_numClones;
+}
+
 static void ___CFRegularExpressionDeallocate(CFTypeRef cf) {
     struct ___CFRegularExpression *item = (struct ___CFRegularExpression *)cf;
+    URegularExpression *clone;
     if (item->regex) uregex_close(item->regex);
     if (item->pattern) CFRelease(item->pattern);
+    if (atomic_load_explicit(&item->_threadClonesKept, memory_order_relaxed)) {
+        while ((clone = __CFRegularExpressionTakeThreadClone(item->_identifier))) uregex_close(clone);
+        // Other threads free their clones when they next take or keep one
+        __CFLock(&__CFRegularExpressionDeadLock);
+        uint64_t generation = atomic_load_explicit(&__CFRegularExpressionDeadGeneration, memory_order_relaxed);
+        __CFRegularExpressionDeadIdentifiers[generation % REGEX_DEAD_IDENTIFIER_COUNT] = item->_identifier;
+        atomic_store_explicit(&__CFRegularExpressionDeadGeneration, generation + 1, memory_order_release);
+        __CFUnlock(&__CFRegularExpressionDeadLock);
+    }
 }
 
 static CFTypeID __k_CFRegularExpressionTypeID = _kCFRuntimeNotATypeID;
@@ -59,8 +287,12 @@ CFTypeID _CFRegularExpressionGetTypeID(void) {
 }
 
 static struct ___CFRegularExpression *__CFRegularExpressionCreate(CFAllocatorRef allocator) {
+    static _Atomic(int64_t) nextIdentifier = 0;
     CFIndex size = sizeof(struct ___CFRegularExpression) - sizeof(CFRuntimeBase);
-    return (struct ___CFRegularExpression *)_CFRuntimeCreateInstance(allocator, _CFRegularExpressionGetTypeID(), size, NULL);
+    struct ___CFRegularExpression *regexObj = (struct ___CFRegularExpression *)_CFRuntimeCreateInstance(allocator, _CFRegularExpressionGetTypeID(), size, NULL);
+    regexObj->_identifier = atomic_fetch_add_explicit(&nextIdentifier, 1, memory_order_relaxed) + 1;
+    atomic_init(&regexObj->_threadClonesKept, false);
+    return regexObj;
 }
 
 CFStringRef _CFRegularExpressionCreateEscapedPattern(CFStringRef pattern) {
@@ -98,6 +330,15 @@ _CFRegularExpressionRef _CFRegularExpressionCreate(CFAllocatorRef allocator, CFS
     UParseError parseError;
     CFStringRef originalPattern = pattern;
     CFIndex patternLength;
+
+    URegularExpression *cachedRegex = __CFRegularExpressionCacheCopyRegex(originalPattern, options, &pattern);
+    if (cachedRegex) {
+        struct ___CFRegularExpression *regexObj = __CFRegularExpressionCreate(allocator);
+        regexObj->regex = cachedRegex;
+        regexObj->options = options;
+        regexObj->pattern = pattern;
+        return regexObj;
+    }
     
     if ((options & _kCFRegularExpressionIgnoreMetacharacters) != 0) {
         pattern = _CFRegularExpressionCreateEscapedPattern(pattern);
@@ -162,6 +403,8 @@ _CFRegularExpressionRef _CFRegularExpressionCreate(CFAllocatorRef allocator, CFS
     } else {
         regexObj->pattern = NULL; // should this be a fatal error?
     }
+    if (freePatternBuffer) free(patternBuffer);
+    if (regexObj->pattern) __CFRegularExpressionCacheAddRegex(originalPattern, options, regexObj->pattern, regex);
     
     return regexObj;
 }
@@ -229,15 +472,15 @@ static UBool regexFindProgressCallback(const void *context, int64_t matchIndex)
     return stop ? 0 : 1;
 }
 
-CF_INLINE URegularExpression *checkOutRegularExpression(void *internal, int32_t *checkout, Boolean *checkedOutRegex) {
+CF_INLINE URegularExpression *checkOutRegularExpression(struct ___CFRegularExpression *regexObj, Boolean *checkedOutRegex) {
     URegularExpression *regex = NULL;
     UErrorCode errorCode = U_ZERO_ERROR;
     Boolean checkedOut = false;
-    checkedOut = OSAtomicCompareAndSwap32Barrier(0, 1, (volatile int32_t *)checkout);
+    checkedOut = OSAtomicCompareAndSwap32Barrier(0, 1, (volatile int32_t *)&regexObj->_checkout);
     if (checkedOut) {
-        regex = (URegularExpression *)internal;
-    } else {
-        regex = uregex_clone((const URegularExpression *)internal, &errorCode);
+        regex = regexObj->regex;
+    } else if (!(regex = __CFRegularExpressionTakeThreadClone(regexObj->_identifier))) {
+        regex = uregex_clone((const URegularExpression *)regexObj->regex, &errorCode);
     }
     *checkedOutRegex = checkedOut;
     return regex;
@@ -254,7 +497,7 @@ static UBool regexMatchCallback(const void *context, int32_t steps) {
 }
 
 
-CF_INLINE URegularExpression *prepareRegularExpression(void *internal, int32_t *checkout, CFStringRef string, CFRange range, UniChar *stackBuffer, const void *context, Boolean reportProgress, Boolean anchored, Boolean transparentBounds, Boolean nonAnchoringBounds, CFIndex *offset, void **bufferToFree, void **utextToFree, Boolean *checkedOutRegex) {
+CF_INLINE URegularExpression *prepareRegularExpression(struct ___CFRegularExpression *regexObj, CFStringRef string, CFRange range, UniChar *stackBuffer, const void *context, Boolean reportProgress, Boolean anchored, Boolean transparentBounds, Boolean nonAnchoringBounds, CFIndex *offset, void **bufferToFree, void **utextToFree, Boolean *checkedOutRegex) {
     // ??? consider reusing utext
     URegularExpression *regex = NULL;
     CFIndex length = CFStringGetLength(string);
@@ -308,7 +551,7 @@ CF_INLINE URegularExpression *prepareRegularExpression(void *internal, int32_t *
     }
     
     if (stringBuffer) {
-        regex = checkOutRegularExpression(internal, checkout, checkedOutRegex);
+        regex = checkOutRegularExpression(regexObj, checkedOutRegex);
         uregex_setText(regex, (const UChar *)stringBuffer, textLength, &errorCode);
     }
     
@@ -344,17 +587,19 @@ CF_INLINE _CFRegularExpressionMatchingFlags flagsForRegularExpression(URegularEx
 }
 
 
-CF_INLINE void returnRegularExpression(URegularExpression *regex, int32_t *checkout, Boolean checkedOutRegex, Boolean reportProgress, Boolean anchored, Boolean transparentBounds, Boolean nonAnchoringBounds, UniChar *stackBuffer, void *bufferToFree, void *utextToFree) {
+CF_INLINE void returnRegularExpression(struct ___CFRegularExpression *regexObj, URegularExpression *regex, Boolean checkedOutRegex, Boolean reportProgress, Boolean anchored, Boolean transparentBounds, Boolean nonAnchoringBounds, UniChar *stackBuffer, void *bufferToFree, void *utextToFree) {
     UErrorCode errorCode = U_ZERO_ERROR;
     if (regex) {
+        uregex_setText(regex, (const UChar *)stackBuffer, 0, &errorCode);
+        if (reportProgress) uregex_setMatchCallback(regex, NULL, NULL, &errorCode);
+        if (reportProgress || anchored) uregex_setFindProgressCallback(regex, NULL, NULL, &errorCode);
+        if (transparentBounds) uregex_useTransparentBounds(regex, 0, &errorCode);
+        if (nonAnchoringBounds) uregex_useAnchoringBounds(regex, 1, &errorCode);
         if (checkedOutRegex) {
-            uregex_setText(regex, (const UChar *)stackBuffer, 0, &errorCode);
-            if (reportProgress) uregex_setMatchCallback(regex, NULL, NULL, &errorCode);
-            if (reportProgress || anchored) uregex_setFindProgressCallback(regex, NULL, NULL, &errorCode);
-            if (transparentBounds) uregex_useTransparentBounds(regex, 0, &errorCode);
-            if (nonAnchoringBounds) uregex_useAnchoringBounds(regex, 1, &errorCode);
             OSMemoryBarrier();
-            *checkout = 0;
+            regexObj->_checkout = 0;
+        } else if (U_SUCCESS(errorCode)) {
+            __CFRegularExpressionKeepThreadClone(regexObj, regex);
         } else {
             uregex_close(regex);
         }
@@ -386,7 +631,7 @@ void _CFRegularExpressionEnumerateMatchesInString(_CFRegularExpressionRef regexO
     context.stoppedByClient = NO;
     context.hitAnchorLimit = NO;
     
-    regex = prepareRegularExpression(regexObj->regex, (int32_t *)&regexObj->_checkout, string, range, stackBuffer, (const void *)&context, reportProgress, anchored, transparentBounds, nonAnchoringBounds, &offset, &bufferToFree, &utextToFree, &checkedOutRegex);
+    regex = prepareRegularExpression((struct ___CFRegularExpression *)regexObj, string, range, stackBuffer, (const void *)&context, reportProgress, anchored, transparentBounds, nonAnchoringBounds, &offset, &bufferToFree, &utextToFree, &checkedOutRegex);
     CFIndex numberOfCaptureGroups = _CFRegularExpressionGetNumberOfCaptureGroups(regexObj);
     if (regex) {
         while (uregex_findNext(regex, &errorCode) && U_SUCCESS(errorCode) && !stop && !context.stoppedByClient && !context.hitAnchorLimit) {
@@ -441,7 +686,7 @@ void _CFRegularExpressionEnumerateMatchesInString(_CFRegularExpressionRef regexO
         match(matchContext, NULL, 0, flags, &stop);
     }
 
-    returnRegularExpression(regex, (int32_t *)&regexObj->_checkout, checkedOutRegex, reportProgress, anchored, transparentBounds, nonAnchoringBounds, stackBuffer, bufferToFree, utextToFree);
+    returnRegularExpression((struct ___CFRegularExpression *)regexObj, regex, checkedOutRegex, reportProgress, anchored, transparentBounds, nonAnchoringBounds, stackBuffer, bufferToFree, utextToFree);
 }
 
 CFStringRef _CFRegularExpressionGetPattern(_CFRegularExpressionRef regex) {
@@ -17,19 +17,25 @@
 #include "CFInternal.h"
 #include "CFRuntime_Internal.h"
 
-/* CFRunArrayGuts (which holds an array of CFRunArrayItems) is the actual data keeper; the objects just point at these... CFRunArrayGuts has copy-on-write behavior.
+/* CFRunArrayGuts (which holds a tree of CFRunArrayNodes) is the actual data keeper; the objects just point at these... CFRunArrayGuts has copy-on-write behavior.
+
+   Runs are kept in a treap ordered by position, where every node also records the total length and number of runs in its subtree. Finding the run for a location or a block index, inserting or removing a run, and changing the length of a run are all O(log n) in the number of runs; nothing after the edit point has to be moved or renumbered. A finger to the last run found makes walking through runs in order O(1) per step.
 */
-typedef struct {
-    CFIndex length;
+typedef struct _CFRunArrayNode {
+    struct _CFRunArrayNode *left, *right, *parent;
+    CFIndex length;                         /* Length of this run */
     CFTypeRef obj;
-} CFRunArrayItem;
+    CFIndex subtreeLength;                  /* Total length of the runs in this subtree */
+    CFIndex subtreeBlocks;                  /* Number of runs in this subtree */
+    uint32_t priority;                      /* Heap order of the treap; the root has the highest */
+} CFRunArrayNode;
 
-typedef struct _CFRunArrayGuts {	/* Variable sized block. */
+typedef struct _CFRunArrayGuts {
     CFIndex numRefs;                        /* For "copy on write" behavior */
-    CFIndex length;                         /* Total count of values stored by the CFRunArrayItems in list */
-    CFIndex numBlocks, maxBlocks;           /* These describe the number of CFRunArrayItems in list */
-    CFIndex cachedBlock, cachedLocation;    /* Cache from last lookup */
-    CFRunArrayItem list[0]; /* GCC */
+    CFRunArrayNode *root;
+    uint32_t seed;                          /* Source of node priorities */
+    CFRunArrayNode *cachedNode;             /* Finger from last lookup; NULL if the tree changed since */
+    CFIndex cachedBlock, cachedLocation;
 } CFRunArrayGuts;
 
 /* Definition of the CF struct for CFRunArray
@@ -56,67 +62,263 @@ static CFLock_t runArrayLock = CFLockInit;
 
 /*** Internal utility ***/
 
-/* Return the block number in the run array. Use cache if possible.
+CF_INLINE CFIndex __CFRunArrayGutsLength(CFRunArrayGuts *guts) {
+    return guts->root ? guts->root->subtreeLength : 0;
+}
+
+CF_INLINE CFIndex __CFRunArrayGutsBlocks(CFRunArrayGuts *guts) {
+    return guts->root ? guts->root->subtreeBlocks : 0;
+}
+
+/* Recomputes the subtree totals of node from its children, and points the children back at it.
 */
-static CFIndex blockForLocation(CFRunArrayGuts *guts, CFIndex location, CFRange *effectiveRange) {
-    CFIndex loc, block;
-    if (location > (guts->cachedLocation / 2)) {	/* Yes, we can use the cached values as our starting point */
-        loc = guts->cachedLocation;
-        block = guts->cachedBlock;
+CF_INLINE void __CFRunArrayNodeUpdate(CFRunArrayNode *node) {
+    node->subtreeLength = node->length;
+    node->subtreeBlocks = 1;
+    if (node->left) {
+        node->subtreeLength += node->left->subtreeLength;
+        node->subtreeBlocks += node->left->subtreeBlocks;
+        node->left->parent = node;
+    }
+    if (node->right) {
+        node->subtreeLength += node->right->subtreeLength;
+        node->subtreeBlocks += node->right->subtreeBlocks;
+        node->right->parent = node;
+    }
+}
+
+static CFRunArrayNode *__CFRunArrayNodeCreate(CFAllocatorRef allocator, CFRunArrayGuts *guts, CFTypeRef obj, CFIndex length) {
+    CFRunArrayNode *node = (CFRunArrayNode *)CFAllocatorAllocate(allocator, sizeof(CFRunArrayNode), 0);
+    /* xorshift32; priorities only need to be well spread, not unpredictable */
+    uint32_t seed = guts->seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    guts->seed = seed;
+    node->left = node->right = node->parent = NULL;
+    node->obj = obj;
+    node->length = node->subtreeLength = length;
+    node->subtreeBlocks = 1;
+    node->priority = seed;
+    return node;
+}
+
+/* Frees the nodes of a subtree; with releaseObjects, also releases the values they hold.
+*/
+static void __CFRunArrayNodeDeallocate(CFAllocatorRef allocator, CFRunArrayNode *node, Boolean releaseObjects) {
+    while (node) {
+        CFRunArrayNode *right = node->right;
+        __CFRunArrayNodeDeallocate(allocator, node->left, releaseObjects);
+        if (releaseObjects) FREE(node->obj);
+        CFAllocatorDeallocate(allocator, node);
+        node = right;
+    }
+}
+
+static CFRunArrayNode *__CFRunArrayNodeCopy(CFAllocatorRef allocator, CFRunArrayNode *node) {
+    if (!node) return NULL;
+    CFRunArrayNode *newNode = (CFRunArrayNode *)CFAllocatorAllocate(allocator, sizeof(CFRunArrayNode), 0);
+    *newNode = *node;
+    newNode->obj = COPY(node->obj);
+    newNode->parent = NULL;
+    newNode->left = __CFRunArrayNodeCopy(allocator, node->left);
+    newNode->right = __CFRunArrayNodeCopy(allocator, node->right);
+    __CFRunArrayNodeUpdate(newNode);
+    return newNode;
+}
+
+/* Joins two treaps, every run of left coming before every run of right.
+*/
+static CFRunArrayNode *__CFRunArrayNodeJoin(CFRunArrayNode *left, CFRunArrayNode *right) {
+    if (!left) return right;
+    if (!right) return left;
+    if (left->priority > right->priority) {
+        left->right = __CFRunArrayNodeJoin(left->right, right);
+        __CFRunArrayNodeUpdate(left);
+        return left;
     } else {
-        loc = block = 0;
+        right->left = __CFRunArrayNodeJoin(left, right->left);
+        __CFRunArrayNodeUpdate(right);
+        return right;
     }
-    if (loc <= location) {	/* Going forwards */
-        while (loc + guts->list[block].length <= location) loc += guts->list[block++].length;
-    } else {	/* Going backwards */
-        do loc -= guts->list[--block].length; while ((block > 0) && (loc > location));
+}
+
+/* Splits a treap so that the first numBlocks runs end up in *left and the rest in *right.
+*/
+static void __CFRunArrayNodeSplit(CFRunArrayNode *node, CFIndex numBlocks, CFRunArrayNode **left, CFRunArrayNode **right) {
+    if (!node) {
+        *left = *right = NULL;
+        return;
     }
-    guts->cachedLocation = loc;
+    CFIndex leftBlocks = node->left ? node->left->subtreeBlocks : 0;
+    if (numBlocks <= leftBlocks) {
+        __CFRunArrayNodeSplit(node->left, numBlocks, left, &node->left);
+        __CFRunArrayNodeUpdate(node);
+        *right = node;
+    } else {
+        __CFRunArrayNodeSplit(node->right, numBlocks - leftBlocks - 1, &node->right, right);
+        __CFRunArrayNodeUpdate(node);
+        *left = node;
+    }
+}
+
+static CFRunArrayNode *__CFRunArrayNodeNext(CFRunArrayNode *node) {
+    if (node->right) {
+        for (node = node->right; node->left; node = node->left);
+        return node;
+    }
+    while (node->parent && node->parent->right == node) node = node->parent;
+    return node->parent;
+}
+
+static CFRunArrayNode *__CFRunArrayNodePrevious(CFRunArrayNode *node) {
+    if (node->left) {
+        for (node = node->left; node->right; node = node->right);
+        return node;
+    }
+    while (node->parent && node->parent->left == node) node = node->parent;
+    return node->parent;
+}
+
+/* Changes the length of one run, keeping the totals of its ancestors in step.
+*/
+static void __CFRunArrayNodeAdjustLength(CFRunArrayNode *node, CFIndex delta) {
+    node->length += delta;
+    for (; node; node = node->parent) node->subtreeLength += delta;
+}
+
+/* Return the node for the run holding location, along with its block number and starting location. Use the finger if possible.
+*/
+static CFRunArrayNode *__CFRunArrayNodeForLocation(CFRunArrayGuts *guts, CFIndex location, CFIndex *blockPtr, CFIndex *blockLocationPtr) {
+    CFRunArrayNode *node = guts->cachedNode;
+    CFIndex block = guts->cachedBlock, loc = guts->cachedLocation;
+    if (node && location >= loc) {	/* The finger run, or the one right after it (sequential access) */
+        if (location >= loc + node->length) {
+            CFRunArrayNode *next = __CFRunArrayNodeNext(node);
+            if (next && location < loc + node->length + next->length) {
+                loc += node->length;
+                block++;
+                node = next;
+            } else {
+                node = NULL;
+            }
+        }
+    } else if (node) {	/* Or the one right before it */
+        CFRunArrayNode *previous = __CFRunArrayNodePrevious(node);
+        if (previous && location >= loc - previous->length) {
+            loc -= previous->length;
+            block--;
+            node = previous;
+        } else {
+            node = NULL;
+        }
+    }
+    if (!node) {
+        CFIndex remaining = location;
+        node = guts->root;
+        block = loc = 0;
+        for (;;) {
+            CFIndex leftLength = node->left ? node->left->subtreeLength : 0;
+            if (remaining < leftLength) {
+                node = node->left;
+            } else if (remaining < leftLength + node->length || !node->right) {
+                block += node->left ? node->left->subtreeBlocks : 0;
+                loc += leftLength;
+                break;
+            } else {
+                block += (node->left ? node->left->subtreeBlocks : 0) + 1;
+                loc += leftLength + node->length;
+                remaining -= leftLength + node->length;
+                node = node->right;
+            }
+        }
+    }
+    guts->cachedNode = node;
     guts->cachedBlock = block;
-    if (effectiveRange) {
-        effectiveRange->location = loc;
-        effectiveRange->length = guts->list[block].length;
+    guts->cachedLocation = loc;
+    if (blockPtr) *blockPtr = block;
+    if (blockLocationPtr) *blockLocationPtr = loc;
+    return node;
+}
+
+/* Return the node for block number blockIndex, which must be in range. Use the finger if possible.
+*/
+static CFRunArrayNode *__CFRunArrayNodeForBlock(CFRunArrayGuts *guts, CFIndex blockIndex) {
+    CFRunArrayNode *node = guts->cachedNode;
+    CFIndex loc = guts->cachedLocation;
+    if (node && blockIndex == guts->cachedBlock + 1) {
+        loc += node->length;
+        node = __CFRunArrayNodeNext(node);
+    } else if (node && blockIndex == guts->cachedBlock - 1) {
+        node = __CFRunArrayNodePrevious(node);
+        loc -= node->length;
+    } else if (!node || blockIndex != guts->cachedBlock) {
+        CFIndex remaining = blockIndex;
+        node = guts->root;
+        loc = 0;
+        for (;;) {
+            CFIndex leftBlocks = node->left ? node->left->subtreeBlocks : 0;
+            if (remaining < leftBlocks) {
+                node = node->left;
+            } else if (remaining == leftBlocks) {
+                loc += node->left ? node->left->subtreeLength : 0;
+                break;
+            } else {
+                loc += (node->left ? node->left->subtreeLength : 0) + node->length;
+                remaining -= leftBlocks + 1;
+                node = node->right;
+            }
+        }
     }
-    return block;
+    guts->cachedNode = node;
+    guts->cachedBlock = blockIndex;
+    guts->cachedLocation = loc;
+    return node;
+}
+
+/* Inserts a new run so that it becomes block number blockIndex. Invalidates the finger.
+*/
+static void __CFRunArrayInsertBlock(CFRunArrayRef array, CFIndex blockIndex, CFTypeRef obj, CFIndex length) {
+    CFRunArrayGuts *guts = array->guts;
+    CFRunArrayNode *left, *right;
+    CFRunArrayNode *node = __CFRunArrayNodeCreate(CFGetAllocator(array), guts, obj, length);
+    __CFRunArrayNodeSplit(guts->root, blockIndex, &left, &right);
+    guts->root = __CFRunArrayNodeJoin(__CFRunArrayNodeJoin(left, node), right);
+    guts->root->parent = NULL;
+    guts->cachedNode = NULL;
+}
+
+/* Removes blocks firstBlock through lastBlock, whose values must already have been released. Invalidates the finger.
+*/
+static void __CFRunArrayRemoveBlocks(CFRunArrayRef array, CFIndex firstBlock, CFIndex lastBlock) {
+    CFRunArrayGuts *guts = array->guts;
+    CFRunArrayNode *left, *middle, *right;
+    __CFRunArrayNodeSplit(guts->root, firstBlock, &left, &middle);
+    __CFRunArrayNodeSplit(middle, lastBlock - firstBlock + 1, &middle, &right);
+    __CFRunArrayNodeDeallocate(CFGetAllocator(array), middle, false);
+    guts->root = __CFRunArrayNodeJoin(left, right);
+    if (guts->root) guts->root->parent = NULL;
+    guts->cachedNode = NULL;
 }
 
 /* Gives the receiver its own copy of the argument list, reduces the ref count of the original. The original list is assumed to have a ref count > 1 (it's not freed). If oldGuts is not NULL, should be called when protected by a lock. Note that this may change array->guts, so any caches of this should be refreshed!
 */
 static void __CFRunArrayMakeNewList(CFRunArrayRef array, CFRunArrayGuts *oldGuts) {
-    CFIndex maxBlocks = (oldGuts ? oldGuts->numBlocks : 2);
-    CFRunArrayGuts *newGuts = (CFRunArrayGuts *)CFAllocatorAllocate(CFGetAllocator(array), sizeof(CFRunArrayGuts) + maxBlocks * sizeof(CFRunArrayItem), 0);
-    newGuts->maxBlocks = maxBlocks;
+    CFRunArrayGuts *newGuts = (CFRunArrayGuts *)CFAllocatorAllocate(CFGetAllocator(array), sizeof(CFRunArrayGuts), 0);
     if (oldGuts) {
-	CFIndex cnt;
-	for (cnt = 0; cnt < oldGuts->numBlocks; cnt++) {
-	    newGuts->list[cnt].length = oldGuts->list[cnt].length;
-	    newGuts->list[cnt].obj = COPY(oldGuts->list[cnt].obj);
-	}
-	newGuts->numBlocks = oldGuts->numBlocks;
-	newGuts->cachedBlock = oldGuts->cachedBlock;
-	newGuts->cachedLocation = oldGuts->cachedLocation;
-	newGuts->length = oldGuts->length;
+	newGuts->root = __CFRunArrayNodeCopy(CFGetAllocator(array), oldGuts->root);
+	newGuts->seed = oldGuts->seed;
 	oldGuts->numRefs--;	// !!! We assume the caller has locked; if we have separate locks per RLEArray, need one here
     } else {
-	newGuts->length = newGuts->numBlocks = newGuts->cachedBlock = newGuts->cachedLocation = 0;
+	newGuts->root = NULL;
+	newGuts->seed = 0x9e3779b9;
     }
+    newGuts->cachedNode = NULL;
+    newGuts->cachedBlock = newGuts->cachedLocation = 0;
     newGuts->numRefs = 1;
     ((struct __CFRunArray *)array)->guts = newGuts;
 }
 
-/* When you call this, don't forget to recache guts afterwards, if it was cached in a local
-*/
-static void __CFRunArraySetBlockCapacity(CFRunArrayRef array, CFIndex desiredCount) {
-    #define MINSIZE 1
-    if (desiredCount < MINSIZE) desiredCount = MINSIZE;
-    /* We realloc either when there isn't enough room, or when the needed size is less than half of what's there. In both cases we allocate 33% extra. */
-    if ((array->guts->maxBlocks < desiredCount) || (array->guts->maxBlocks / 2) > desiredCount) {
-	CFIndex newCapacity = ((desiredCount + 3) / 3) * 4;
-	((struct __CFRunArray *)array)->guts = __CFSafelyReallocateWithAllocator(CFGetAllocator(array), array->guts, sizeof(CFRunArrayGuts) + newCapacity * sizeof(CFRunArrayItem), 0, NULL);
-	array->guts->maxBlocks = newCapacity;
-    }
-}
-
 
 
 /*** "Polymorphic" functions ***/
@@ -133,10 +335,11 @@ static CFHashCode __CFRunArrayHash(CFTypeRef cf) {
 static CFStringRef __CFRunArrayCopyDescription(CFTypeRef cf) {
     CFRunArrayRef array = (CFRunArrayRef)cf;
     CFRunArrayGuts *guts = array->guts;
-    CFIndex cnt;
+    CFRunArrayNode *node;
     CFMutableStringRef string = CFStringCreateMutable(kCFAllocatorSystemDefault, 0);
-    CFStringAppendFormat(string, NULL, CFSTR("%ld blocks used, total length %ld (%ld blocks, block %ld is at %ld)\n"), (long)guts->numBlocks, (long)guts->length, (long)guts->maxBlocks, (long)guts->cachedBlock, (long)guts->cachedLocation);
-    for (cnt = 0; cnt < guts->numBlocks; cnt++) CFStringAppendFormat(string, NULL, CFSTR(" %ld %p %@\n"), (long)guts->list[cnt].length, guts->list[cnt].obj, guts->list[cnt].obj);
+    CFStringAppendFormat(string, NULL, CFSTR("%ld blocks used, total length %ld (block %ld is at %ld)\n"), (long)__CFRunArrayGutsBlocks(guts), (long)__CFRunArrayGutsLength(guts), (long)guts->cachedBlock, (long)guts->cachedLocation);
+    for (node = guts->root; node && node->left; node = node->left);
+    for (; node; node = __CFRunArrayNodeNext(node)) CFStringAppendFormat(string, NULL, CFSTR(" %ld %p %@\n"), (long)node->length, node->obj, node->obj);
     return string;
 }
 
@@ -147,10 +350,7 @@ static void __CFRunArrayDeallocate(CFTypeRef cf) {
     RLEARRAYLOCK;
     if (guts->numRefs <= 1) {
         RLEARRAYUNLOCK;
-        CFIndex cnt;
-        for (cnt = 0; cnt < guts->numBlocks; cnt++) {
-            FREE(guts->list[cnt].obj);
-        }
+        __CFRunArrayNodeDeallocate(CFGetAllocator(array), guts->root, true);
         CFAllocatorDeallocate(CFGetAllocator(array), guts);
     } else {
         guts->numRefs--;
@@ -201,20 +401,27 @@ CFRunArrayRef CFRunArrayCreate(CFAllocatorRef allocator) {
 }
 
 CFIndex CFRunArrayGetCount(CFRunArrayRef array) {
-    return array->guts->length;
+    return __CFRunArrayGutsLength(array->guts);
 }
 
 CFTypeRef CFRunArrayGetValueAtIndex(CFRunArrayRef array, CFIndex loc, CFRange *effectiveRange, CFIndex *blockIndexPtr) {
     // ??? if (loc >= array->guts->length) BoundsError;
-    CFIndex blockIndex = blockForLocation(array->guts, loc, effectiveRange);
+    if (!array->guts->root) return NULL;
+    CFIndex blockIndex, blockLocation;
+    CFRunArrayNode *node = __CFRunArrayNodeForLocation(array->guts, loc, &blockIndex, &blockLocation);
+    if (effectiveRange) {
+        effectiveRange->location = blockLocation;
+        effectiveRange->length = node->length;
+    }
     if (blockIndexPtr) *blockIndexPtr = blockIndex;
-    return array->guts->list[blockIndex].obj;
+    return node->obj;
 }
 
 CFTypeRef CFRunArrayGetValueAtRunArrayIndex(CFRunArrayRef array, CFIndex blockIndex, CFIndex *lengthPtr) {
-    if (blockIndex >= array->guts->numBlocks) return NULL;
-    if (lengthPtr) *lengthPtr = array->guts->list[blockIndex].length;
-    return array->guts->list[blockIndex].obj;
+    if (blockIndex < 0 || blockIndex >= __CFRunArrayGutsBlocks(array->guts)) return NULL;
+    CFRunArrayNode *node = __CFRunArrayNodeForBlock(array->guts, blockIndex);
+    if (lengthPtr) *lengthPtr = node->length;
+    return node->obj;
 }
 
 void CFRunArrayInsert(CFRunArrayRef array, CFRange range, CFTypeRef obj) {
@@ -231,55 +438,34 @@ void CFRunArrayInsert(CFRunArrayRef array, CFRange range, CFTypeRef obj) {
     RLEARRAYUNLOCK;
     
     
-    if (range.location == guts->length) {	// Append
-	if (guts->length > 0) {	// The list isn't empty
-	    if (ISSAME(obj, guts->list[guts->numBlocks - 1].obj)) {
-		guts->list[guts->numBlocks - 1].length += range.length;
-		// We might have invalidated the cached info, fix it up!
-		if (guts->cachedBlock >= guts->numBlocks) guts->cachedLocation += range.length;
-	    } else {
-                __CFRunArraySetBlockCapacity(array, guts->numBlocks + 1);
-		guts = array->guts; // Recache
-		guts->list[guts->numBlocks].obj = EXTERNCOPY(obj);
-		guts->list[guts->numBlocks].length = range.length;
-		guts->numBlocks++;
-	    }
-	} else {	// The list is empty...
-            __CFRunArraySetBlockCapacity(array, 1);
-	    guts = array->guts; // Recache
-	    guts->list[0].obj = EXTERNCOPY(obj);
-	    guts->list[0].length = range.length;
-	    guts->numBlocks++;
+    if (range.location == __CFRunArrayGutsLength(guts)) {	// Append
+	CFIndex numBlocks = __CFRunArrayGutsBlocks(guts);
+	CFRunArrayNode *last = guts->root;
+	while (last && last->right) last = last->right;
+	if (last && ISSAME(obj, last->obj)) {	// The list isn't empty
+	    __CFRunArrayNodeAdjustLength(last, range.length);
+	} else {
+	    __CFRunArrayInsertBlock(array, numBlocks, EXTERNCOPY(obj), range.length);
 	}
     } else {	// At this stage we are inserting, and the length of the list is > 0.
-	CFRange blockRange;
-	CFIndex cnt, block = blockForLocation(guts, range.location, &blockRange);
-	if (ISSAME(obj, guts->list[block].obj)) {
-	    guts->list[block].length += range.length;
-	} else if ((block > 0) && (blockRange.location == range.location) && (ISSAME(obj, guts->list[block - 1].obj))) {
-	    guts->list[block - 1].length += range.length;
-	    // We might have invalidated the cached info, fix it up!
-	    if (guts->cachedBlock >= block) guts->cachedLocation += range.length;
-	} else if (blockRange.location == range.location) {
-            __CFRunArraySetBlockCapacity(array, guts->numBlocks + 1);
-	    guts = array->guts; // Recache
-	    for (cnt = guts->numBlocks; cnt > block; cnt--) guts->list[cnt] = guts->list[cnt - 1];
-	    guts->list[block].obj = EXTERNCOPY(obj);
-	    guts->list[block].length = range.length;
-	    guts->numBlocks++;
-	} else {
-            __CFRunArraySetBlockCapacity(array, guts->numBlocks + 2);
-	    guts = array->guts; // Recache
-	    for (cnt = guts->numBlocks + 1; cnt >= block + 2; cnt--) guts->list[cnt] = guts->list[cnt - 2];
-	    guts->list[block + 1].obj = EXTERNCOPY(obj);
-	    guts->list[block + 1].length = range.length;
-	    guts->list[block].length = (range.location - blockRange.location);
-	    guts->list[block + 2].obj = COPY(guts->list[block].obj);
-	    guts->list[block + 2].length = blockRange.length - (range.location - blockRange.location);
-	    guts->numBlocks += 2;
+	CFIndex block, blockLocation;
+	CFRunArrayNode *node = __CFRunArrayNodeForLocation(guts, range.location, &block, &blockLocation);
+	CFRunArrayNode *previous;
+	if (ISSAME(obj, node->obj)) {
+	    __CFRunArrayNodeAdjustLength(node, range.length);
+	} else if ((block > 0) && (blockLocation == range.location) && (previous = __CFRunArrayNodePrevious(node)) && (ISSAME(obj, previous->obj))) {
+	    __CFRunArrayNodeAdjustLength(previous, range.length);
+	    // The finger is at the following run, which just moved
+	    guts->cachedLocation += range.length;
+	} else if (blockLocation == range.location) {
+	    __CFRunArrayInsertBlock(array, block, EXTERNCOPY(obj), range.length);
+	} else {	// Split the run in two around the new one
+	    CFIndex tailLength = node->length - (range.location - blockLocation);
+	    __CFRunArrayNodeAdjustLength(node, -tailLength);
+	    __CFRunArrayInsertBlock(array, block + 1, EXTERNCOPY(obj), range.length);
+	    __CFRunArrayInsertBlock(array, block + 2, COPY(node->obj), tailLength);
 	}
     }
-    guts->length += range.length;
 }
 
 void CFRunArrayDelete(CFRunArrayRef array, CFRange range) {
@@ -288,8 +474,8 @@ void CFRunArrayDelete(CFRunArrayRef array, CFRange range) {
 
 void CFRunArrayReplace(CFRunArrayRef array, CFRange range, CFTypeRef newObject, CFIndex newLength) {
     CFRunArrayGuts *guts = array->guts;
-    CFRange blockRange;
-    CFIndex block, toBeDeleted, firstEmptyBlock, lastEmptyBlock;
+    CFRunArrayNode *node, *before, *after;
+    CFIndex block, blockLocation, numBlocks, toBeDeleted, firstEmptyBlock, lastEmptyBlock;
 
     // ??? if (range.location + range.length > guts->length) BoundsError;
     if (range.length == 0) return;
@@ -303,73 +489,63 @@ void CFRunArrayReplace(CFRunArrayRef array, CFRange range, CFTypeRef newObject,
     }
     RLEARRAYUNLOCK;
     
-    /* This call also sets the cache to point to this block */
-    block = blockForLocation(guts, range.location, &blockRange);
-    guts->length -= range.length;
+    node = __CFRunArrayNodeForLocation(guts, range.location, &block, &blockLocation);
+    numBlocks = __CFRunArrayGutsBlocks(guts);
 
     /* Figure out how much to delete from this block */
-    toBeDeleted = blockRange.length - (range.location - blockRange.location);
+    toBeDeleted = node->length - (range.location - blockLocation);
     if (toBeDeleted > range.length) toBeDeleted = range.length;
 
-    /* Delete that count */
-    if ((guts->list[block].length -= toBeDeleted) == 0) FREE(guts->list[block].obj);
+    /* Delete that count; emptied runs stay in the tree (with their values released) until the end */
+    __CFRunArrayNodeAdjustLength(node, -toBeDeleted);
+    if (node->length == 0) FREE(node->obj);
     range.length -= toBeDeleted;
-    firstEmptyBlock = (guts->list[block].length == 0) ? block : block + 1;
+    firstEmptyBlock = (node->length == 0) ? block : block + 1;
 
     while (range.length) {
 	block++;
+	node = __CFRunArrayNodeNext(node);
 	toBeDeleted = range.length;
-	if (toBeDeleted >= guts->list[block].length) toBeDeleted = guts->list[block].length;
-	if ((guts->list[block].length -= toBeDeleted) == 0) FREE(guts->list[block].obj);
+	if (toBeDeleted >= node->length) toBeDeleted = node->length;
+	__CFRunArrayNodeAdjustLength(node, -toBeDeleted);
+	if (node->length == 0) FREE(node->obj);
 	range.length -= toBeDeleted;
     }
 
-    lastEmptyBlock = (block == 0 || guts->list[block].length == 0) ? block : block - 1;
+    lastEmptyBlock = (block == 0 || node->length == 0) ? block : block - 1;
+    guts->cachedNode = NULL;	// Locations past the deletion have moved
 
     if (firstEmptyBlock <= lastEmptyBlock) {	/* Do we have any blocks that need to be removed? */
-        /* One assumption at this point is that the cache isn't beyond firstEmptyBlock */
-        if ((firstEmptyBlock > 0) && (firstEmptyBlock == guts->cachedBlock)) {	/* Update the cachedBlock it's pointing at the hole */
-            guts->cachedLocation -= guts->list[firstEmptyBlock - 1].length;
-            guts->cachedBlock--;	/* Simply make the cached block be the previous one */
-        }
+        before = (firstEmptyBlock > 0) ? __CFRunArrayNodeForBlock(guts, firstEmptyBlock - 1) : NULL;
+        after = (lastEmptyBlock + 1 < numBlocks) ? __CFRunArrayNodeForBlock(guts, lastEmptyBlock + 1) : NULL;
         if (newObject) {	/* See if the new object can be merged with one of the end blocks */
-            if ((firstEmptyBlock > 0) && ISSAME(guts->list[firstEmptyBlock - 1].obj, newObject)) {
-                guts->list[firstEmptyBlock - 1].length += newLength;
-                guts->length += newLength;
+            if (before && ISSAME(before->obj, newObject)) {
+                __CFRunArrayNodeAdjustLength(before, newLength);
 		newObject = NULL;
-            } else if ((lastEmptyBlock + 1 < guts->numBlocks) && ISSAME(guts->list[lastEmptyBlock + 1].obj, newObject)) {
-                guts->list[lastEmptyBlock + 1].length += newLength;
-                guts->length += newLength;
+            } else if (after && ISSAME(after->obj, newObject)) {
+                __CFRunArrayNodeAdjustLength(after, newLength);
                 newObject = NULL;
             }
         }
-        if (!newObject && (firstEmptyBlock > 0) && (lastEmptyBlock + 1 < guts->numBlocks) && ISSAME(guts->list[firstEmptyBlock - 1].obj, guts->list[lastEmptyBlock + 1].obj)) {	/* Can we merge the blocks around the empty space? */
-	    /* Often the cachedBlock will point before the firstEmptyBlock; however, if it happens to be pointing at the firstEmptyBlock, we need to move it back. */
+        if (!newObject && before && after && ISSAME(before->obj, after->obj)) {	/* Can we merge the blocks around the empty space? */
 	    lastEmptyBlock++;
-	    guts->list[firstEmptyBlock - 1].length += guts->list[lastEmptyBlock].length;
-	    FREE(guts->list[lastEmptyBlock].obj);
+	    __CFRunArrayNodeAdjustLength(before, after->length);
+	    __CFRunArrayNodeAdjustLength(after, -after->length);
+	    FREE(after->obj);
 	}
-        if (newObject && (firstEmptyBlock < guts->numBlocks) /* Sanity check */) {	/* Slip this into the first empty block */
-            guts->list[firstEmptyBlock].obj = EXTERNCOPY(newObject);
-            guts->list[firstEmptyBlock].length = newLength;
-            guts->length += newLength;
+        if (newObject && (firstEmptyBlock < numBlocks) /* Sanity check */) {	/* Slip this into the first empty block */
+            node = __CFRunArrayNodeForBlock(guts, firstEmptyBlock);
+            node->obj = EXTERNCOPY(newObject);
+            __CFRunArrayNodeAdjustLength(node, newLength);
             firstEmptyBlock++;
             newObject = NULL;
         }
-        if (firstEmptyBlock <= lastEmptyBlock) {	/* Do we still need to shift anything over? */
-            CFIndex toBeMoved = guts->numBlocks - lastEmptyBlock - 1;
-            CFIndex firstFullBlock = lastEmptyBlock + 1;
-            for (block = 0; block < toBeMoved; block++) {
-                guts->list[firstEmptyBlock + block] = guts->list[firstFullBlock + block];
-            }
-            guts->numBlocks -= (firstFullBlock - firstEmptyBlock);
-            __CFRunArraySetBlockCapacity(array, guts->numBlocks);
+        if (firstEmptyBlock <= lastEmptyBlock) {	/* Do we still need to take anything out? */
+            __CFRunArrayRemoveBlocks(array, firstEmptyBlock, lastEmptyBlock);
         }
+        guts->cachedNode = NULL;
     }
     if (newObject) {	/* If this is still set, that means we didn't get to insert it... Do it now. */
         CFRunArrayInsert(array, CFRangeMake(range.location, newLength), newObject);
     }
 }
-
-
-
@@ -26,6 +26,8 @@
 #include "CFUniCharPriv.h"
 #include "CFString_Internal.h"
 #include "CFRuntime_Internal.h"
+#include "CFVectorUtilities.h"
+#include "CFString_Private.h"
 #include <assert.h>
 #include <unicode/uchar.h>
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX || TARGET_OS_BSD
@@ -187,6 +189,7 @@ struct __attribute__((__aligned__(8))) __CFString {
 
 /* 
 I = is immutable
+O = contents belong to another string, held in place of the contents deallocator (immutable, not inline, not freed)
 E = not inline contents
 U = is Unicode
 N = has NULL byte
@@ -201,7 +204,7 @@ G = has gap
 Cap, DesCap = capacity
 
 B7 B6 B5 B4 B3 B2 B1 B0
-         U  N  L  C  I
+         U  N  L  O  I
 
 B6 B5
  0  0   inline contents
@@ -219,7 +222,7 @@ Note that some of the bit patterns in the enum below overlap and are duplicated.
 enum {
     // These are bit numbers - do not use them as masks
     __kCFIsMutable = 0,
-    // !!! Bit 1 has been freed up
+    __kCFHasContentsOwner = 1,
     __kCFHasLengthByte = 2,
     __kCFHasNullByte = 3,
     __kCFIsUnicode = 4,
@@ -311,6 +314,14 @@ CF_INLINE void __CFStrSetContentsDeallocator(CFStringRef str, CFAllocatorRef all
     *__CFStrContentsDeallocatorPtr(str) = allocator;
 }
 
+CF_INLINE Boolean __CFStrHasContentsOwner(CFStringRef str)          {return __CFRuntimeGetFlag(str, __kCFHasContentsOwner);}
+
+// The owner is kept where the contents deallocator would be; strings with an owner don't free their contents, so have no deallocator
+// Assumption: Called with immutable strings only, and on strings that are known to have a contents owner
+CF_INLINE CFStringRef __CFStrContentsOwner(CFStringRef str) {
+    return *(CFStringRef *)__CFStrContentsDeallocatorPtr(str);
+}
+
 static CFAllocatorRef *__CFStrContentsAllocatorPtr(CFStringRef str) {
     CFAssert(!__CFStrIsInline(str), __kCFLogAssertion, "Asking for contents allocator of inline string");
     CFAssert(__CFStrIsMutable(str), __kCFLogAssertion, "Asking for contents allocator of an immutable string");
@@ -1001,6 +1012,10 @@ static void __CFStringDeallocate(CFTypeRef cf) {
 		}
 	    }
 	}
+#if !DEPLOYMENT_RUNTIME_SWIFT
+	// The contents belong to the owner, which the string was keeping alive
+	if (!isMutable && __CFStrHasContentsOwner(str)) CFRelease(__CFStrContentsOwner(str));
+#endif
 	if (isMutable && __CFStrHasContentsAllocator(str)) {
             CFAllocatorRef allocator = __CFStrContentsAllocator((CFMutableStringRef)str);
             CFRelease(allocator);
@@ -1718,6 +1733,63 @@ CFStringRef  CFStringCreateWithFormat(CFAllocatorRef alloc, CFDictionaryRef form
     return result;
 }
 
+#if !DEPLOYMENT_RUNTIME_SWIFT
+/* Long enough substrings of immutable strings share the characters of their string instead of copying them, provided that string owns its characters; characters supplied with a NoCopy creation function belong to the caller, who may free them once the string is released, so those are copied as before. Such a substring doesn't free its contents; instead it is marked as having a contents owner, and holds a retain on the string the characters belong to.
+   A substring that is small compared to the buffer it would keep alive is still copied.
+*/
+#define __kCFStringSharedSubstringMinimumBytes (256)
+#define __kCFStringSharedSubstringMaximumPinnedBytes (64 * 1024)
+
+static void __CFStringSharedSubstringDeallocate(void *ptr, void *info) {
+}
+
+// Passed to the funnel as the contents deallocator, so that it reserves the slot the owner is then kept in; freeing through it does nothing, since the characters belong to the owner
+static CFAllocatorRef __CFStringSharedSubstringPlaceholder(void) {
+    static CFAllocatorRef placeholder = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        CFAllocatorContext context = {0, NULL, NULL, NULL, NULL, NULL, NULL, __CFStringSharedSubstringDeallocate, NULL};
+        placeholder = CFAllocatorCreate(kCFAllocatorSystemDefault, &context);
+    });
+    return placeholder;
+}
+
+static CFStringRef __CFStringCreateSharedSubstring(CFAllocatorRef alloc, CFStringRef str, CFRange range) {
+    if (__CFStrIsMutable(str)) return NULL;
+
+    // Only characters that live and die with str, or with the string str depends on, can be shared
+    Boolean ownsContents = __CFStrIsInline(str) || __CFStrFreeContentsWhenDone(str) || __CFStrHasContentsOwner(str);
+    if (ownsContents && __CFStrHasContentsDeallocator(str)) ownsContents = (__CFStrContentsDeallocator(str) != kCFAllocatorNull);
+    if (!ownsContents) return NULL;
+
+    // If str already shares the characters of another string, depend on that string directly rather than on str
+    CFStringRef owner = __CFStrHasContentsOwner(str) ? __CFStrContentsOwner(str) : str;
+
+    Boolean isUnicode = __CFStrIsUnicode(str);
+    CFIndex charSize = isUnicode ? sizeof(UniChar) : sizeof(uint8_t);
+    CFIndex numBytes = range.length * charSize;
+    CFIndex pinnedBytes = __CFStrLength(owner) * charSize;
+
+    if (numBytes < __kCFStringSharedSubstringMinimumBytes) return NULL;
+    if ((pinnedBytes > __kCFStringSharedSubstringMaximumPinnedBytes) && (numBytes < pinnedBytes / 16)) return NULL;
+
+    CFAllocatorRef placeholder = __CFStringSharedSubstringPlaceholder();
+    if (NULL == placeholder) return NULL;
+
+    const uint8_t *contents = (const uint8_t *)__CFStrContents(str) + (isUnicode ? 0 : __CFStrSkipAnyLengthByte(str)) + range.location * charSize;
+
+    // Unicode substrings which turn out to be ASCII are still reduced to an 8-bit copy
+    CFStringRef result = __CFStringCreateImmutableFunnel3(alloc, contents, numBytes, isUnicode ? kCFStringEncodingUnicode : __CFStringGetEightBitStringEncoding(), false, isUnicode, false, false, true, placeholder, 0);
+    if (result && !__CFStrIsInline(result) && __CFStrHasContentsDeallocator(result) && (__CFStrContentsDeallocator(result) == placeholder)) {
+        *(CFStringRef *)__CFStrContentsDeallocatorPtr(result) = (CFStringRef)CFRetain(owner);
+        __CFStrSetInlineContents(result, __kCFNotInlineContentsNoFree);
+        __CFRuntimeSetFlag(result, __kCFHasContentsOwner, true);
+        CFRelease(placeholder);
+    }
+    return result;
+}
+#endif
+
 CFStringRef CFStringCreateWithSubstring(CFAllocatorRef alloc, CFStringRef str, CFRange range) {
     CF_SWIFT_FUNCDISPATCHV(_kCFRuntimeIDCFString, CFStringRef, (CFSwiftRef)str, NSString._createSubstringWithRange, range);
 //      CF_OBJC_FUNCDISPATCHV(_kCFRuntimeIDCFString, CFStringRef , (NSString *)str, _createSubstringWithRange:NSMakeRange(range.location, range.length));
@@ -1727,7 +1799,12 @@ CFStringRef CFStringCreateWithSubstring(CFAllocatorRef alloc, CFStringRef str, C
 
     if ((range.location == 0) && (range.length == __CFStrLength(str))) {	/* The substring is the whole string... */
 	return (CFStringRef)_CFNonObjCStringCreateCopy(alloc, str);
-    } else if (__CFStrIsEightBit(str)) {
+    }
+#if !DEPLOYMENT_RUNTIME_SWIFT
+    CFStringRef shared = __CFStringCreateSharedSubstring(alloc, str, range);
+    if (NULL != shared) return shared;
+#endif
+    if (__CFStrIsEightBit(str)) {
 	const uint8_t *contents = (const uint8_t *)__CFStrContents(str);
         return __CFStringCreateImmutableFunnel3(alloc, contents + range.location + __CFStrSkipAnyLengthByte(str), range.length, __CFStringGetEightBitStringEncoding(), false, false, false, false, false, ALLOCATORSFREEFUNC, 0);
     } else {
@@ -2695,6 +2772,17 @@ static const u_char __ASCII_LOWERCASE_TABLE[] = {
 // This function is an implementation of strncasecmp_l that does not stop comparing at embedded null bytes
 // We are not calling to LibC APIs such as tolower_l here because calling to those APIs (as compared to using a lookup table) introduced significant performance regressions
 CF_INLINE int __CFStringCompareASCIICaseInsensitive(const u_char *str1, const u_char *str2, size_t n) {
+    // Skip the blocks that are equal ignoring case, the table lookups below only see the block with the first difference
+    while (n >= __kCFVectorBlockLength8) {
+        uint32_t mismatches = __CFVectorASCIICaseInsensitiveEqualMask8(str1, str2) ^ ((1U << __kCFVectorBlockLength8) - 1);
+        if (mismatches) {
+            CFIndex offset = __builtin_ctz(mismatches);
+            return __ASCII_LOWERCASE_TABLE[str1[offset]] - __ASCII_LOWERCASE_TABLE[str2[offset]];
+        }
+        str1 += __kCFVectorBlockLength8;
+        str2 += __kCFVectorBlockLength8;
+        n -= __kCFVectorBlockLength8;
+    }
     if (n != 0) {
         do {
             u_char a = __ASCII_LOWERCASE_TABLE[*str1++];
@@ -2767,6 +2855,14 @@ CFComparisonResult CFStringCompareWithOptionsAndLocale(CFStringRef string, CFStr
                 str1Bytes += rangeToCompare.location;
 
                 while (str1Index < limitLength) {
+                    // Whole blocks that match exactly, or ignoring ASCII case once forced ordering no longer depends on it, need no further checks
+                    if (str1Index + __kCFVectorBlockLength8 <= limitLength) {
+                        Boolean matches = ((caseInsensitive && (!forceOrdering || (kCFCompareEqualTo != compareResult))) ? (__CFVectorASCIICaseInsensitiveEqualMask8(str1Bytes + str1Index, str2Bytes + str1Index) == ((1U << __kCFVectorBlockLength8) - 1)) : (0 == memcmp(str1Bytes + str1Index, str2Bytes + str1Index, __kCFVectorBlockLength8)));
+                        if (matches) {
+                            str1Index += __kCFVectorBlockLength8;
+                            continue;
+                        }
+                    }
                     str1Char = str1Bytes[str1Index];
                     str2Char = str2Bytes[str1Index];
 
@@ -2823,6 +2919,29 @@ CFComparisonResult CFStringCompareWithOptionsAndLocale(CFStringRef string, CFStr
         }
     }
     
+    /* Case insensitive comparison of UTF-16 contents: skip the common prefix made of ASCII characters that are equal ignoring case, except for its last character, which may start a cluster with what follows. Numeric comparison and forced ordering depend on earlier characters, so they are left to the loop below.
+    */
+    if ((NULL == locale) && (NULL == ignoredChars) && !numerically && !forceOrdering && caseInsensitive && (0 == str1Index)) {
+        const UniChar *str1Chars = CFStringGetCharactersPtr(string);
+        const UniChar *str2Chars = CFStringGetCharactersPtr(string2);
+
+        if ((NULL != str1Chars) && (NULL != str2Chars)) {
+            CFIndex limitLength = __CFMin(rangeToCompare.length, str2Len);
+            CFIndex prefixLength = 0;
+
+            str1Chars += rangeToCompare.location;
+            while (prefixLength + __kCFVectorBlockLength16 <= limitLength) {
+                uint32_t mismatches = (__CFVectorASCIICaseInsensitiveEqualMask16(str1Chars + prefixLength, str2Chars + prefixLength) & ~__CFVectorNonASCIIMask16(str1Chars + prefixLength)) ^ ((1U << __kCFVectorBlockLength16) - 1);
+                if (mismatches) {
+                    prefixLength += __builtin_ctz(mismatches);
+                    break;
+                }
+                prefixLength += __kCFVectorBlockLength16;
+            }
+            if (prefixLength > 0) str1Index = str2Index = prefixLength - 1;
+        }
+    }
+
     const uint8_t *graphemeBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharGraphemeExtendCharacterSet, 0);
     
     _CFStringInitInlineBufferInternal(string, &inlineBuf1, rangeToCompare, true);
@@ -3081,6 +3200,99 @@ CFComparisonResult CFStringCompare(CFStringRef string, CFStringRef str2, CFStrin
     return CFStringCompareWithOptions(string, str2, CFRangeMake(0, CFStringGetLength(string)), options);
 }
 
+#define __kCFStringFindLiteralShortNeedleLength (32)
+#define __kCFStringFindLiteralASCIIWindowLength (4096)
+
+#define FIND_LITERAL_NAME		__CFStringFindLiteral8
+#define FIND_LITERAL_CHAR_TYPE		uint8_t
+#define FIND_LITERAL_BLOCK_LENGTH	__kCFVectorBlockLength8
+#define FIND_LITERAL_EQUAL_MASK		__CFVectorEqualMask8
+#include "CFStringFindLiteral.m"
+
+#define FIND_LITERAL_NAME		__CFStringFindLiteral16
+#define FIND_LITERAL_CHAR_TYPE		UniChar
+#define FIND_LITERAL_BLOCK_LENGTH	__kCFVectorBlockLength16
+#define FIND_LITERAL_EQUAL_MASK		__CFVectorEqualMask16
+#include "CFStringFindLiteral.m"
+
+/* Forward search for stringToFind directly in the backing stores, for literal and ASCII case-insensitive comparisons.
+   Returns true when the search is complete, with *location set to the match location or kCFNotFound. Returns false when the fast path does not apply; *location is then the first location the general search still has to examine.
+   Case-insensitive matching is only exact for ASCII, so the haystack is searched in windows that stop at the first non-ASCII character; a match that would involve one is left to the general search.
+*/
+static Boolean __CFStringFindLiteral(CFStringRef string, const uint8_t *str1Bytes, CFStringRef stringToFind, const uint8_t *str2Bytes, CFIndex findStrLen, CFRange rangeToSearch, Boolean caseInsensitive, CFIndex *location) {
+    const UniChar *str1Chars = NULL;
+    const void *needle = NULL;
+    UniChar needleBuffer[kCFStringStackBufferLength];
+    void *allocatedNeedle = NULL;
+    CFIndex searchLocation = rangeToSearch.location;
+    CFIndex limit = rangeToSearch.location + rangeToSearch.length;
+    Boolean isEightBit = ((NULL != str1Bytes) && (NULL != str2Bytes));
+    Boolean done = true;
+
+    *location = searchLocation;
+
+    if (limit > CFStringGetLength(string)) return false;
+
+    if (isEightBit) {
+        needle = str2Bytes;
+        if (caseInsensitive) {
+            if (__CFVectorASCIIPrefixLength8(str2Bytes, findStrLen) < findStrLen) return false;
+            uint8_t *lowered = (findStrLen <= (CFIndex)sizeof(needleBuffer)) ? (uint8_t *)needleBuffer : (uint8_t *)(allocatedNeedle = CFAllocatorAllocate(kCFAllocatorSystemDefault, findStrLen, 0));
+            for (CFIndex idx = 0; idx < findStrLen; idx++) lowered[idx] = (((str2Bytes[idx] >= 'A') && (str2Bytes[idx] <= 'Z')) ? (str2Bytes[idx] + ('a' - 'A')) : str2Bytes[idx]);
+            needle = lowered;
+        }
+    } else if ((NULL == str1Bytes) && (NULL != (str1Chars = CFStringGetCharactersPtr(string)))) {
+        const UniChar *str2Chars = CFStringGetCharactersPtr(stringToFind);
+        if ((NULL == str2Chars) || caseInsensitive) {
+            UniChar *copy = (findStrLen <= kCFStringStackBufferLength) ? needleBuffer : (UniChar *)(allocatedNeedle = CFAllocatorAllocate(kCFAllocatorSystemDefault, findStrLen * sizeof(UniChar), 0));
+            CFStringGetCharacters(stringToFind, CFRangeMake(0, findStrLen), copy);
+            if (caseInsensitive) {
+                if (__CFVectorASCIIPrefixLength16(copy, findStrLen) < findStrLen) {
+                    if (allocatedNeedle) CFAllocatorDeallocate(kCFAllocatorSystemDefault, allocatedNeedle);
+                    return false;
+                }
+                for (CFIndex idx = 0; idx < findStrLen; idx++) if ((copy[idx] >= 'A') && (copy[idx] <= 'Z')) copy[idx] += ('a' - 'A');
+            }
+            str2Chars = copy;
+        }
+        needle = str2Chars;
+    } else {
+        return false;
+    }
+
+    *location = kCFNotFound;
+    while (1) {
+        CFIndex windowEnd = limit;
+        CFIndex found;
+
+        if (caseInsensitive) {
+            if (limit - searchLocation > __kCFStringFindLiteralASCIIWindowLength + findStrLen) windowEnd = searchLocation + __kCFStringFindLiteralASCIIWindowLength + findStrLen;
+            windowEnd = searchLocation + (isEightBit ? __CFVectorASCIIPrefixLength8(str1Bytes + searchLocation, windowEnd - searchLocation) : __CFVectorASCIIPrefixLength16(str1Chars + searchLocation, windowEnd - searchLocation));
+        }
+
+        if (isEightBit) {
+            found = __CFStringFindLiteral8(str1Bytes + searchLocation, windowEnd - searchLocation, (const uint8_t *)needle, findStrLen, caseInsensitive);
+        } else {
+            found = __CFStringFindLiteral16(str1Chars + searchLocation, windowEnd - searchLocation, (const UniChar *)needle, findStrLen, caseInsensitive);
+        }
+
+        if (kCFNotFound != found) {
+            *location = searchLocation + found;
+            break;
+        }
+        if (windowEnd == limit) break;
+        if ((isEightBit ? str1Bytes[windowEnd] : str1Chars[windowEnd]) >= 0x80) { // Stopped at a non-ASCII character
+            *location = __CFMax(searchLocation, windowEnd - findStrLen + 1);
+            done = false;
+            break;
+        }
+        searchLocation = windowEnd - findStrLen + 1;
+    }
+
+    if (allocatedNeedle) CFAllocatorDeallocate(kCFAllocatorSystemDefault, allocatedNeedle);
+    return done;
+}
+
 Boolean CFStringFindWithOptionsAndLocale(CFStringRef string, CFStringRef stringToFind, CFRange rangeToSearch, CFStringCompareFlags compareOptions, CFLocaleRef locale, CFRange *result)  {
     /* No objc dispatch needed here since CFStringInlineBuffer works with both CFString and NSString */
     CFIndex findStrLen = CFStringGetLength(stringToFind);
@@ -3139,6 +3351,20 @@ Boolean CFStringFindWithOptionsAndLocale(CFStringRef string, CFStringRef stringT
         
         delta = ((fromLoc <= toLoc) ? 1 : -1);
 
+        if ((1 == delta) && !(compareOptions & kCFCompareAnchored) && (!equalityOptions || (caseInsensitive && (NULL == langCode) && (NULL == ignoredChars) && !(compareOptions & (kCFCompareNonliteral|kCFCompareDiacriticInsensitive|kCFCompareWidthInsensitive))))) {
+            CFIndex foundLocation;
+
+            if (__CFStringFindLiteral(string, str1Bytes, stringToFind, str2Bytes, findStrLen, rangeToSearch, caseInsensitive, &foundLocation)) {
+                if (kCFNotFound != foundLocation) {
+                    didFind = true;
+                    if (NULL != result) *result = CFRangeMake(foundLocation, findStrLen);
+                }
+                return didFind;
+            }
+            if (foundLocation > toLoc) return false;
+            fromLoc = foundLocation; // Continue with the general search from where the fast path stopped
+        }
+
         if ((NULL != str1Bytes) && (NULL != str2Bytes)) {
             uint8_t str1Byte, str2Byte;
 
@@ -4341,41 +4567,27 @@ CF_INLINE bool _CFStringIsVirama(UTF32Char character, const uint8_t *combClassBM
     return ((character == COMBINING_GRAPHEME_JOINER) || (CFUniCharGetCombiningPropertyForCharacter(character, (const uint8_t *)((character < 0x10000) ? combClassBMP : CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, (character >> 16)))) == 9) ? true : false);
 }
 
-CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex charIndex, CFStringCharacterClusterType type) {
+// The cluster containing charIndex, which must be less than length. The inline buffer has to span the whole string.
+static CFRange __CFStringInlineBufferGetCharacterClusterRange(CFStringInlineBuffer *buffer, CFIndex length, CFIndex charIndex, CFStringCharacterClusterType type, const uint8_t *bmpBitmap, const uint8_t *letterBMP, CFIndex csetType) {
     CFRange range;
     CFIndex currentIndex;
-    CFIndex length = CFStringGetLength(string);
-    CFIndex csetType = ((kCFStringGraphemeCluster == type) ? kCFUniCharGraphemeExtendCharacterSet : kCFUniCharNonBaseCharacterSet);
-    CFStringInlineBuffer stringBuffer;
-    const uint8_t *bmpBitmap;
-    const uint8_t *letterBMP;
     static const uint8_t *combClassBMP = NULL;
     UTF32Char character;
     UTF16Char otherSurrogate;
 
-    if (charIndex >= length) return CFRangeMake(kCFNotFound, 0);
-
-    /* Fast case.  If we're eight-bit, it's either the default encoding is cheap or the content is all ASCII.  Watch out when (or if) adding more 8bit Mac-scripts in CFStringEncodingConverters
-    */
-    if (!CF_IS_OBJC(_kCFRuntimeIDCFString, string) && !CF_IS_SWIFT(_kCFRuntimeIDCFString, string) && __CFStrIsEightBit(string)) return CFRangeMake(charIndex, 1);
-
-    bmpBitmap = CFUniCharGetBitmapPtrForPlane(csetType, 0);
-    letterBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharLetterCharacterSet, 0);
     if (NULL == combClassBMP) combClassBMP = (const uint8_t *)CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, 0);
 
-    CFStringInitInlineBuffer(string, &stringBuffer, CFRangeMake(0, length));
-
     // Get composed character sequence first
-    range = _CFStringInlineBufferGetComposedRange(&stringBuffer, charIndex, type, bmpBitmap, csetType);
+    range = _CFStringInlineBufferGetComposedRange(buffer, charIndex, type, bmpBitmap, csetType);
 
     // Do grapheme joiners
     if (type < kCFStringCursorMovementCluster) {
         const uint8_t *letter = letterBMP;
 
         // Check to see if we have a letter at the beginning of initial cluster
-        character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, range.location);
+        character = CFStringGetCharacterFromInlineBuffer(buffer, range.location);
 
-        if ((range.length > 1) && CFUniCharIsSurrogateHighCharacter(character) && CFUniCharIsSurrogateLowCharacter((otherSurrogate = CFStringGetCharacterFromInlineBuffer(&stringBuffer, range.location + 1)))) {
+        if ((range.length > 1) && CFUniCharIsSurrogateHighCharacter(character) && CFUniCharIsSurrogateLowCharacter((otherSurrogate = CFStringGetCharacterFromInlineBuffer(buffer, range.location + 1)))) {
             character = CFUniCharGetLongCharacterForSurrogatePair(character, otherSurrogate);
             letter = CFUniCharGetBitmapPtrForPlane(kCFUniCharLetterCharacterSet, (character >> 16));
         }
@@ -4387,20 +4599,20 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
             otherRange.location = currentIndex = range.location;
 
             while (currentIndex > 1) {
-                character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, --currentIndex);
+                character = CFStringGetCharacterFromInlineBuffer(buffer, --currentIndex);
     
                 // ??? We're assuming viramas only in BMP
-                if ((_CFStringIsVirama(character, combClassBMP) || ((character == ZERO_WIDTH_JOINER) && _CFStringIsVirama(CFStringGetCharacterFromInlineBuffer(&stringBuffer, --currentIndex), combClassBMP))) && (currentIndex > 0)) {
+                if ((_CFStringIsVirama(character, combClassBMP) || ((character == ZERO_WIDTH_JOINER) && _CFStringIsVirama(CFStringGetCharacterFromInlineBuffer(buffer, --currentIndex), combClassBMP))) && (currentIndex > 0)) {
                     --currentIndex;                
                 } else {
                     break;
                 }
 
-                currentIndex = _CFStringInlineBufferGetComposedRange(&stringBuffer, currentIndex, type, bmpBitmap, csetType).location;
+                currentIndex = _CFStringInlineBufferGetComposedRange(buffer, currentIndex, type, bmpBitmap, csetType).location;
     
-                character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, currentIndex);
+                character = CFStringGetCharacterFromInlineBuffer(buffer, currentIndex);
     
-                if (CFUniCharIsSurrogateLowCharacter(character) && CFUniCharIsSurrogateHighCharacter((otherSurrogate = CFStringGetCharacterFromInlineBuffer(&stringBuffer, currentIndex - 1)))) {
+                if (CFUniCharIsSurrogateLowCharacter(character) && CFUniCharIsSurrogateHighCharacter((otherSurrogate = CFStringGetCharacterFromInlineBuffer(buffer, currentIndex - 1)))) {
                     character = CFUniCharGetLongCharacterForSurrogatePair(character, otherSurrogate);
                     letter = CFUniCharGetBitmapPtrForPlane(kCFUniCharLetterCharacterSet, (character >> 16));
                     --currentIndex;
@@ -4420,16 +4632,16 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
                 currentIndex = otherRange.location + otherRange.length;
 
                 do {
-                    character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, currentIndex - 1);
+                    character = CFStringGetCharacterFromInlineBuffer(buffer, currentIndex - 1);
 
                     // ??? We're assuming viramas only in BMP
                     if ((character != ZERO_WIDTH_JOINER) && !_CFStringIsVirama(character, combClassBMP)) break;
 
-                    character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, currentIndex);
+                    character = CFStringGetCharacterFromInlineBuffer(buffer, currentIndex);
 
-                    if (character == ZERO_WIDTH_JOINER) character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, ++currentIndex);
+                    if (character == ZERO_WIDTH_JOINER) character = CFStringGetCharacterFromInlineBuffer(buffer, ++currentIndex);
 
-                    if (CFUniCharIsSurrogateHighCharacter(character) && CFUniCharIsSurrogateLowCharacter((otherSurrogate = CFStringGetCharacterFromInlineBuffer(&stringBuffer, currentIndex + 1)))) {
+                    if (CFUniCharIsSurrogateHighCharacter(character) && CFUniCharIsSurrogateLowCharacter((otherSurrogate = CFStringGetCharacterFromInlineBuffer(buffer, currentIndex + 1)))) {
                         character = CFUniCharGetLongCharacterForSurrogatePair(character, otherSurrogate);
                         letter = CFUniCharGetBitmapPtrForPlane(kCFUniCharLetterCharacterSet, (character >> 16));
                     } else {
@@ -4438,7 +4650,7 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
         
                     // We only conjoin letters
                     if (!CFUniCharIsMemberOfBitmap(character, letter)) break;
-                    otherRange = _CFStringInlineBufferGetComposedRange(&stringBuffer, currentIndex, type, bmpBitmap, csetType);
+                    otherRange = _CFStringInlineBufferGetComposedRange(buffer, currentIndex, type, bmpBitmap, csetType);
                     currentIndex = otherRange.location + otherRange.length;
                 } while ((otherRange.location + otherRange.length) < length);
                 range.length = currentIndex - range.location;
@@ -4453,14 +4665,14 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
     if (currentIndex < 0) currentIndex = 0;
     
     while (currentIndex <= range.location) {
-        character = CFStringGetCharacterFromInlineBuffer(&stringBuffer, currentIndex);
+        character = CFStringGetCharacterFromInlineBuffer(buffer, currentIndex);
         
         if ((character & 0x1FFFF0) == 0xF860) { // transcoding hint
             otherIndex = currentIndex + __CFTranscodingHintLength[(character - 0xF860)] + 1;
             if (otherIndex >= (range.location + range.length)) {
                 if (otherIndex <= length) {
                     for (CFIndex checkIndex = currentIndex + 1; checkIndex < otherIndex;) {
-                        CFRange checkRange = _CFStringInlineBufferGetComposedRange(&stringBuffer, checkIndex, type, bmpBitmap, csetType);
+                        CFRange checkRange = _CFStringInlineBufferGetComposedRange(buffer, checkIndex, type, bmpBitmap, csetType);
                         checkIndex = checkRange.location + checkRange.length;
 
                         // Don't include any part of a composed range that extends beyond the hint range
@@ -4480,26 +4692,26 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
     }
 
     // Regional flag
-    if ((range.length == 2) && __CFStringIsRegionalIndicatorAtIndex(&stringBuffer, range.location)) { // RI
+    if ((range.length == 2) && __CFStringIsRegionalIndicatorAtIndex(buffer, range.location)) { // RI
 
         // Extend backward
         currentIndex = range.location;
         
-        while ((currentIndex > 1) && __CFStringIsRegionalIndicatorAtIndex(&stringBuffer, currentIndex - 2)) currentIndex -= 2;
+        while ((currentIndex > 1) && __CFStringIsRegionalIndicatorAtIndex(buffer, currentIndex - 2)) currentIndex -= 2;
         
         if ((range.location > currentIndex) && (0 != ((range.location - currentIndex) % 4))) { // currentIndex is the 2nd RI
             range.location -= 2;
             range.length += 2;
         }
 
-        if ((range.length == 2) && ((range.location + range.length + 2) <= length) && __CFStringIsRegionalIndicatorAtIndex(&stringBuffer, range.location + range.length)) {
+        if ((range.length == 2) && ((range.location + range.length + 2) <= length) && __CFStringIsRegionalIndicatorAtIndex(buffer, range.location + range.length)) {
             range.length += 2;
         }
     }
 
     // Attempt to expand to match pictographic sequences (Emoji and otherwise).
     CFRange cluster;
-    if (__CFStringGetExtendedPictographicSequence(&stringBuffer, length, range.location, &cluster)) {
+    if (__CFStringGetExtendedPictographicSequence(buffer, length, range.location, &cluster)) {
         // We've found a pictographic cluster by the definition given in https://www.unicode.org/reports/tr29/#Regex_Definitions
         // However, we have to be careful -- if we are trying to match a composed character sequence, we might end up with `cluster` not aligning with `range`.
         //
@@ -4537,8 +4749,8 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
     CFRange finalCluster;
     
     // Backwards
-    if ((range.location > 0) && (range.length == 1) && (ZERO_WIDTH_JOINER == CFStringGetCharacterFromInlineBuffer(&stringBuffer, range.location))) {
-        finalCluster = _CFStringInlineBufferGetComposedRange(&stringBuffer, range.location - 1, type, bmpBitmap, csetType);
+    if ((range.location > 0) && (range.length == 1) && (ZERO_WIDTH_JOINER == CFStringGetCharacterFromInlineBuffer(buffer, range.location))) {
+        finalCluster = _CFStringInlineBufferGetComposedRange(buffer, range.location - 1, type, bmpBitmap, csetType);
         if (range.location == (finalCluster.location + finalCluster.length)) {
             range = finalCluster;
             ++range.length;
@@ -4546,7 +4758,7 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
     }
     // Forwards
     if ((range.location + range.length) < length) {
-        if (ZERO_WIDTH_JOINER == CFStringGetCharacterFromInlineBuffer(&stringBuffer, range.location + range.length)) {
+        if (ZERO_WIDTH_JOINER == CFStringGetCharacterFromInlineBuffer(buffer, range.location + range.length)) {
             ++range.length;
         }
     }
@@ -4554,6 +4766,131 @@ CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex ch
     return range;
 }
 
+CFRange CFStringGetRangeOfCharacterClusterAtIndex(CFStringRef string, CFIndex charIndex, CFStringCharacterClusterType type) {
+    CFIndex length = CFStringGetLength(string);
+    CFIndex csetType = ((kCFStringGraphemeCluster == type) ? kCFUniCharGraphemeExtendCharacterSet : kCFUniCharNonBaseCharacterSet);
+    CFStringInlineBuffer stringBuffer;
+
+    if (charIndex >= length) return CFRangeMake(kCFNotFound, 0);
+
+    /* Fast case.  If we're eight-bit, it's either the default encoding is cheap or the content is all ASCII.  Watch out when (or if) adding more 8bit Mac-scripts in CFStringEncodingConverters
+    */
+    if (!CF_IS_OBJC(_kCFRuntimeIDCFString, string) && !CF_IS_SWIFT(_kCFRuntimeIDCFString, string) && __CFStrIsEightBit(string)) return CFRangeMake(charIndex, 1);
+
+    CFStringInitInlineBuffer(string, &stringBuffer, CFRangeMake(0, length));
+
+    return __CFStringInlineBufferGetCharacterClusterRange(&stringBuffer, length, charIndex, type, CFUniCharGetBitmapPtrForPlane(csetType, 0), CFUniCharGetBitmapPtrForPlane(kCFUniCharLetterCharacterSet, 0), csetType);
+}
+
+// Code units below U+0300 never take part in a cluster with a neighbor, except for the Extended_Pictographic (C) and (R) signs. In particular, none of them extends, joins, or is a transcoding hint.
+#define __kCFStringClusterSimpleLimit 0x0300
+
+CF_INLINE bool __CFStringIsSimpleClusterCharacter(UniChar character) {
+    return (character < __kCFStringClusterSimpleLimit) && (character != 0x00A9) && (character != 0x00AE);
+}
+
+// State carried from one cluster to the next while walking a string forward
+typedef struct {
+    CFStringInlineBuffer buffer;
+    CFIndex length;
+    CFIndex index; // Start of the next cluster
+    CFIndex lastComplexIndex; // Last index at or before index + 1 holding a code unit at or above __kCFStringClusterSimpleLimit, or -1
+    CFStringCharacterClusterType type;
+    CFIndex csetType;
+    const uint8_t *bmpBitmap;
+    const uint8_t *letterBMP;
+    bool isEightBit;
+} __CFStringClusterEnumerator;
+
+static void __CFStringClusterEnumeratorInit(__CFStringClusterEnumerator *enumerator, CFStringRef string, CFIndex location, CFStringCharacterClusterType type) {
+    enumerator->length = CFStringGetLength(string);
+    enumerator->index = location;
+    enumerator->lastComplexIndex = -1;
+    enumerator->type = type;
+    enumerator->csetType = ((kCFStringGraphemeCluster == type) ? kCFUniCharGraphemeExtendCharacterSet : kCFUniCharNonBaseCharacterSet);
+    enumerator->bmpBitmap = CFUniCharGetBitmapPtrForPlane(enumerator->csetType, 0);
+    enumerator->letterBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharLetterCharacterSet, 0);
+    enumerator->isEightBit = (!CF_IS_OBJC(_kCFRuntimeIDCFString, string) && !CF_IS_SWIFT(_kCFRuntimeIDCFString, string) && __CFStrIsEightBit(string));
+
+    CFStringInitInlineBuffer(string, &enumerator->buffer, CFRangeMake(0, enumerator->length));
+
+    // Transcoding hints reach back MAX_TRANSCODING_LENGTH characters, and joiners one
+    for (CFIndex idx = __CFMax(location - (MAX_TRANSCODING_LENGTH + 1), 0);idx < location;idx++) {
+        if (CFStringGetCharacterFromInlineBuffer(&enumerator->buffer, idx) >= __kCFStringClusterSimpleLimit) enumerator->lastComplexIndex = idx;
+    }
+}
+
+/* Returns the cluster starting at enumerator->index and advances past it, or {kCFNotFound, 0} at the end of the string. A cluster that would reach back before enumerator->index (possible only for the first one, or for malformed sequences) is returned whole the first time and clipped at the previous cluster's end afterwards. The result matches CFStringGetRangeOfCharacterClusterAtIndex(), but code units below U+0300 surrounded by more of the same are recognized as single-unit clusters without consulting the tables.
+*/
+static CFRange __CFStringClusterEnumeratorNext(__CFStringClusterEnumerator *enumerator, bool isFirst) {
+    const CFIndex index = enumerator->index;
+    CFRange range;
+
+    if (index >= enumerator->length) return CFRangeMake(kCFNotFound, 0);
+
+    if (enumerator->isEightBit) {
+        enumerator->index = index + 1;
+        return CFRangeMake(index, 1);
+    }
+
+    UniChar character = CFStringGetCharacterFromInlineBuffer(&enumerator->buffer, index);
+    if (character >= __kCFStringClusterSimpleLimit) enumerator->lastComplexIndex = index;
+    if ((index + 1 < enumerator->length) && (CFStringGetCharacterFromInlineBuffer(&enumerator->buffer, index + 1) >= __kCFStringClusterSimpleLimit)) enumerator->lastComplexIndex = index + 1;
+
+    if (__CFStringIsSimpleClusterCharacter(character) && (enumerator->lastComplexIndex < __CFMax(index - MAX_TRANSCODING_LENGTH, 0))) {
+        enumerator->index = index + 1;
+        return CFRangeMake(index, 1);
+    }
+
+    range = __CFStringInlineBufferGetCharacterClusterRange(&enumerator->buffer, enumerator->length, index, enumerator->type, enumerator->bmpBitmap, enumerator->letterBMP, enumerator->csetType);
+    if (!isFirst && (range.location < index)) {
+        range.length -= index - range.location;
+        range.location = index;
+    }
+    if (range.length < 1) range.length = 1;
+
+    // Pick up whatever in the tail of the cluster still affects the following clusters
+    for (CFIndex idx = __CFMax(range.location + range.length - (MAX_TRANSCODING_LENGTH + 1), index + 2);idx < range.location + range.length;idx++) {
+        if (CFStringGetCharacterFromInlineBuffer(&enumerator->buffer, idx) >= __kCFStringClusterSimpleLimit) enumerator->lastComplexIndex = idx;
+    }
+
+    enumerator->index = range.location + range.length;
+    return range;
+}
+
+CFIndex CFStringGetRangesOfCharacterClusters(CFStringRef string, CFRange range, CFStringCharacterClusterType type, CFRange *clusters, CFIndex maxCount) {
+    __CFStringClusterEnumerator enumerator;
+    CFIndex count = 0;
+
+    if ((range.length <= 0) || (maxCount <= 0)) return 0;
+
+    __CFStringClusterEnumeratorInit(&enumerator, string, range.location, type);
+    while ((count < maxCount) && (enumerator.index < range.location + range.length)) {
+        CFRange cluster = __CFStringClusterEnumeratorNext(&enumerator, (0 == count));
+        if (kCFNotFound == cluster.location) break;
+        clusters[count++] = cluster;
+    }
+    return count;
+}
+
+#if __BLOCKS__
+void CFStringEnumerateCharacterClusters(CFStringRef string, CFRange range, CFStringCharacterClusterType type, void (^block)(CFRange cluster, Boolean *stop)) {
+    __CFStringClusterEnumerator enumerator;
+    Boolean stop = false;
+    bool isFirst = true;
+
+    if (range.length <= 0) return;
+
+    __CFStringClusterEnumeratorInit(&enumerator, string, range.location, type);
+    while (!stop && (enumerator.index < range.location + range.length)) {
+        CFRange cluster = __CFStringClusterEnumeratorNext(&enumerator, isFirst);
+        if (kCFNotFound == cluster.location) break;
+        isFirst = false;
+        block(cluster, &stop);
+    }
+}
+#endif
+
 CFRange CFStringGetRangeOfComposedCharactersAtIndex(CFStringRef theString, CFIndex theIndex) {
     return CFStringGetRangeOfCharacterClusterAtIndex(theString, theIndex, kCFStringComposedCharacterCluster);
 }
@@ -4614,7 +4951,21 @@ CF_EXPORT Boolean CFStringFindCharacterFromSet(CFStringRef theString, CFCharacte
 
     step = (fromLoc <= toLoc) ? 1 : -1;
     cnt = fromLoc;
-    
+
+    // Forward searches of UTF-16 contents for a predefined set scan with its compiled matcher
+    if ((step > 0) && (fromLoc < toLoc)) {
+        const UniChar *characters = CFStringGetCharactersPtr(theString);
+        CFCharacterSetMatcherRef matcher = ((NULL == characters) ? NULL : __CFCharacterSetGetBuiltinMatcher(theSet));
+
+        if (NULL != matcher) {
+            characters += rangeToSearch.location;
+            cnt = _CFCharacterSetMatcherFindMember(matcher, characters, rangeToSearch.length);
+            if (kCFNotFound == cnt) return false;
+            if (result) *result = CFRangeMake(rangeToSearch.location + cnt, (CFUniCharIsSurrogateHighCharacter(characters[cnt]) ? 2 : 1));
+            return true;
+        }
+    }
+
     _CFStringInitInlineBufferInternal(theString, &stringBuffer, rangeToSearch, true);
     CFCharacterSetInitInlineBuffer(theSet, &csetBuffer);
 
@@ -4671,6 +5022,41 @@ CF_INLINE Boolean isALineSeparatorTypeCharacter(UniChar ch, Boolean includeLineE
     return (ch == NewLine || ch == CarriageReturn || ch == ParaSeparator || (includeLineEndings && (ch == NextLine || ch == LineSeparator))) ? true : false;
 }
 
+/* Index of the first line (or, when includeLineEndings is false, paragraph) separator in [index, length) of a CF string's own contents, or length if there's none. Blocks without a candidate are skipped with vector compares; in eight-bit strings any non-ASCII byte is a candidate and is checked after mapping it through the eight-bit encoding, since that's where NEL lives when it is representable.
+*/
+static CFIndex __CFStringFindLineSeparator(CFStringRef string, CFIndex index, CFIndex length, Boolean includeLineEndings) {
+    if (__CFStrIsEightBit(string)) {
+        const uint8_t *bytes = (const uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+
+        while (index + __kCFVectorBlockLength8 <= length) {
+            uint32_t candidates = __CFVectorEqualMask8(bytes + index, NewLine, 0) | __CFVectorEqualMask8(bytes + index, CarriageReturn, 0) | __CFVectorNonASCIIMask8(bytes + index);
+            while (candidates) {
+                CFIndex candidate = index + __builtin_ctz(candidates);
+                if (isALineSeparatorTypeCharacter(__CFCharToUniCharTable[bytes[candidate]], includeLineEndings)) return candidate;
+                candidates &= (candidates - 1);
+            }
+            index += __kCFVectorBlockLength8;
+        }
+        for (; index < length; index++) if (isALineSeparatorTypeCharacter(__CFCharToUniCharTable[bytes[index]], includeLineEndings)) return index;
+    } else {
+        const UniChar *chars = (const UniChar *)__CFStrContents(string);
+
+        while (index + __kCFVectorBlockLength16 <= length) {
+            uint32_t candidates = __CFVectorEqualMask16(chars + index, NewLine, 0) | __CFVectorEqualMask16(chars + index, CarriageReturn, 0);
+            // LineSeparator and ParaSeparator differ only in the low bit
+            if (includeLineEndings) {
+                candidates |= __CFVectorEqualMask16(chars + index, NextLine, 0) | __CFVectorEqualMask16(chars + index, ParaSeparator, 1);
+            } else {
+                candidates |= __CFVectorEqualMask16(chars + index, ParaSeparator, 0);
+            }
+            if (candidates) return index + __builtin_ctz(candidates);
+            index += __kCFVectorBlockLength16;
+        }
+        for (; index < length; index++) if (isALineSeparatorTypeCharacter(chars[index], includeLineEndings)) return index;
+    }
+    return length;
+}
+
 static void __CFStringGetLineOrParagraphBounds(CFStringRef string, CFRange range, CFIndex *lineBeginIndex, CFIndex *lineEndIndex, CFIndex *contentsEndIndex, Boolean includeLineEndings) {
     CFIndex len;
     CFStringInlineBuffer buf;
@@ -4725,21 +5111,14 @@ static void __CFStringGetLineOrParagraphBounds(CFStringRef string, CFRange range
                 endOfContents--;
             }
         } else {
-            while (1) {
-                if (isALineSeparatorTypeCharacter(ch, includeLineEndings)) {
-                    endOfContents = buf_idx;	/* This is actually end of contentsRange */
-                    buf_idx++;	/* OK for this to go past the end */
-                    if ((ch == CarriageReturn) && (__CFStringGetCharacterFromInlineBufferAux(&buf, buf_idx) == NewLine)) {
-                        lineSeparatorLength = 2;
-                    }
-                    break;
-                } else if (buf_idx >= len) {
-                    endOfContents = len;
-                    lineSeparatorLength = 0;
-                    break;
-                } else {
-                    buf_idx++;
-                    ch = __CFStringGetCharacterFromInlineBufferAux(&buf, buf_idx);
+            buf_idx = __CFStringFindLineSeparator(string, buf_idx, len, includeLineEndings);
+            if (buf_idx >= len) {
+                endOfContents = len;
+                lineSeparatorLength = 0;
+            } else {
+                endOfContents = buf_idx;	/* This is actually end of contentsRange */
+                if ((__CFStringGetCharacterFromInlineBufferAux(&buf, buf_idx) == CarriageReturn) && (__CFStringGetCharacterFromInlineBufferAux(&buf, buf_idx + 1) == NewLine)) {
+                    lineSeparatorLength = 2;
                 }
             }
         }
@@ -4758,6 +5137,59 @@ void CFStringGetParagraphBounds(CFStringRef string, CFRange range, CFIndex *parB
     __CFStringGetLineOrParagraphBounds(string, range, parBeginIndex, parEndIndex, contentsEndIndex, false);
 }
 
+/* The first line is found with the general code, since range.location may fall in the middle of it (or of a CR LF); every following line starts where the previous one ended, so only the forward scan is needed.
+*/
+static CFIndex __CFStringGetLineOrParagraphRanges(CFStringRef string, CFRange range, CFRange *ranges, CFIndex *contentsEnds, CFIndex maxCount, Boolean includeLineEndings) {
+    Boolean isBridged = CF_IS_OBJC(_kCFRuntimeIDCFString, string) || CF_IS_SWIFT(_kCFRuntimeIDCFString, string);
+    CFIndex length = CFStringGetLength(string);
+    CFIndex rangeEnd = range.location + range.length;
+    CFIndex lineBegin, lineEnd, contentsEnd, count = 0;
+
+    if (maxCount <= 0) return 0;
+
+    if (isBridged) {
+        if (includeLineEndings) {
+            CFStringGetLineBounds(string, CFRangeMake(range.location, 0), &lineBegin, &lineEnd, &contentsEnd);
+        } else {
+            CFStringGetParagraphBounds(string, CFRangeMake(range.location, 0), &lineBegin, &lineEnd, &contentsEnd);
+        }
+    } else {
+        __CFStringGetLineOrParagraphBounds(string, CFRangeMake(range.location, 0), &lineBegin, &lineEnd, &contentsEnd, includeLineEndings);
+    }
+
+    while (1) {
+        ranges[count] = CFRangeMake(lineBegin, lineEnd - lineBegin);
+        if (contentsEnds) contentsEnds[count] = contentsEnd;
+        count++;
+        if ((count >= maxCount) || (lineEnd >= rangeEnd) || (lineEnd >= length)) break;
+
+        lineBegin = lineEnd;
+        if (isBridged) {
+            if (includeLineEndings) {
+                CFStringGetLineBounds(string, CFRangeMake(lineBegin, 0), NULL, &lineEnd, &contentsEnd);
+            } else {
+                CFStringGetParagraphBounds(string, CFRangeMake(lineBegin, 0), NULL, &lineEnd, &contentsEnd);
+            }
+        } else {
+            contentsEnd = __CFStringFindLineSeparator(string, lineBegin, length, includeLineEndings);
+            lineEnd = contentsEnd;
+            if (contentsEnd < length) {
+                lineEnd++;
+                if ((CFStringGetCharacterAtIndex(string, contentsEnd) == CarriageReturn) && (lineEnd < length) && (CFStringGetCharacterAtIndex(string, lineEnd) == NewLine)) lineEnd++;
+            }
+        }
+    }
+    return count;
+}
+
+CFIndex _CFStringGetLineRanges(CFStringRef string, CFRange range, CFRange *lineRanges, CFIndex *contentsEnds, CFIndex maxCount) {
+    return __CFStringGetLineOrParagraphRanges(string, range, lineRanges, contentsEnds, maxCount, true);
+}
+
+CFIndex _CFStringGetParagraphRanges(CFStringRef string, CFRange range, CFRange *paragraphRanges, CFIndex *contentsEnds, CFIndex maxCount) {
+    return __CFStringGetLineOrParagraphRanges(string, range, paragraphRanges, contentsEnds, maxCount, false);
+}
+
 
 CFStringRef CFStringCreateByCombiningStrings(CFAllocatorRef alloc, CFArrayRef array, CFStringRef separatorString) {
     CFIndex numChars;
@@ -5357,8 +5789,15 @@ void CFStringTrimWhitespace(CFMutableStringRef string) {
     _CFStringInitInlineBufferInternal(string, &buffer, CFRangeMake(0, length), false /* already did CF_OBJC_FUNCDISPATCHV above */);
     CFIndex buffer_idx = 0;
 
-    while (buffer_idx < length && CFUniCharIsMemberOf(__CFStringGetCharacterFromInlineBufferQuick(&buffer, buffer_idx), kCFUniCharWhitespaceAndNewlineCharacterSet))
-        buffer_idx++;
+    CFCharacterSetMatcherRef matcher = (__CFStrIsUnicode(string) ? __CFCharacterSetGetBuiltinMatcher(CFCharacterSetGetPredefined(kCFCharacterSetWhitespaceAndNewline)) : NULL);
+
+    if (NULL != matcher) {
+        buffer_idx = _CFCharacterSetMatcherFindNonMember(matcher, (const UniChar *)__CFStrContents(string), length);
+        if (kCFNotFound == buffer_idx) buffer_idx = length;
+    } else {
+        while (buffer_idx < length && CFUniCharIsMemberOf(__CFStringGetCharacterFromInlineBufferQuick(&buffer, buffer_idx), kCFUniCharWhitespaceAndNewlineCharacterSet))
+            buffer_idx++;
+    }
     newStartIndex = buffer_idx;
 
     if (newStartIndex < length) {
@@ -5393,13 +5832,7 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
 
     if (!langCode && isEightBit) {
         uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
-        for (;currentIndex < length;currentIndex++) {
-            if (contents[currentIndex] >= 'A' && contents[currentIndex] <= 'Z') {
-                contents[currentIndex] += 'a' - 'A';
-            } else if (contents[currentIndex] > 127) {
-                break;
-            }
-        }
+        currentIndex = __CFVectorASCIIMapCase8(contents, length, false);
     }
 
     if (currentIndex < length) {
@@ -5414,6 +5847,12 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
         contents = (UniChar *)__CFStrContents(string);
 
         for (;currentIndex < length;currentIndex++) {
+            // Runs of ASCII map without the tables; they also leave no conditional mapping context behind
+            if (!langCode && (contents[currentIndex] < 0x80)) {
+                currentIndex += __CFVectorASCIIMapCase16(contents + currentIndex, length - currentIndex, false);
+                flags = 0;
+                if (currentIndex >= length) break;
+            }
 
             if (CFUniCharIsSurrogateHighCharacter(contents[currentIndex]) && (currentIndex + 1 < length) && CFUniCharIsSurrogateLowCharacter(contents[currentIndex + 1])) {
                 currentChar = CFUniCharGetLongCharacterForSurrogatePair(contents[currentIndex], contents[currentIndex + 1]);
@@ -5484,13 +5923,7 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
 
     if (!langCode && isEightBit) {
         uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
-        for (;currentIndex < length;currentIndex++) {
-            if (contents[currentIndex] >= 'a' && contents[currentIndex] <= 'z') {
-                contents[currentIndex] -= 'a' - 'A';
-            } else if (contents[currentIndex] > 127) {
-                break;
-            }
-        }
+        currentIndex = __CFVectorASCIIMapCase8(contents, length, true);
     }
 
     if (currentIndex < length) {
@@ -5505,6 +5938,11 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
         contents = (UniChar *)__CFStrContents(string);
 
         for (;currentIndex < length;currentIndex++) {
+            if (!langCode && (contents[currentIndex] < 0x80)) {
+                currentIndex += __CFVectorASCIIMapCase16(contents + currentIndex, length - currentIndex, true);
+                if (currentIndex >= length) break;
+            }
+
             if (CFUniCharIsSurrogateHighCharacter(contents[currentIndex]) && (currentIndex + 1 < length) && CFUniCharIsSurrogateLowCharacter(contents[currentIndex + 1])) {
                 currentChar = CFUniCharGetLongCharacterForSurrogatePair(contents[currentIndex], contents[currentIndex + 1]);
             } else {
@@ -5702,6 +6140,111 @@ CF_INLINE void __CFFillInUTF16(const UTF32Char *characters, UTF16Char *dst, uint
     }
 }
 
+// Normalization quick-check properties of BMP code units. A code unit whose flags don't intersect the mask for the requested form is left untouched by CFStringNormalize, as long as the code unit following it passes as well.
+enum {
+    __kCFNormalizationQCCanonicalDecomposable = 1 << 0,
+    __kCFNormalizationQCCompatibilityDecomposable = 1 << 1,
+    __kCFNormalizationQCCombining = 1 << 2, // Non-zero combining class
+    __kCFNormalizationQCNonBase = 1 << 3, // May combine with the preceding character
+    __kCFNormalizationQCNotRecomposed = 1 << 4, // Decomposes to a sequence that doesn't precompose back to it
+    __kCFNormalizationQCNotCompatibilityRecomposed = 1 << 5,
+    __kCFNormalizationQCSpecial = 1 << 6, // Surrogates and conjoining Hangul Jamo
+};
+
+static const uint8_t __CFNormalizationQuickCheckMasks[] = {
+    /* kCFStringNormalizationFormD */ __kCFNormalizationQCCanonicalDecomposable | __kCFNormalizationQCCombining | __kCFNormalizationQCSpecial,
+    /* kCFStringNormalizationFormKD */ __kCFNormalizationQCCanonicalDecomposable | __kCFNormalizationQCCompatibilityDecomposable | __kCFNormalizationQCCombining | __kCFNormalizationQCSpecial,
+    /* kCFStringNormalizationFormC */ __kCFNormalizationQCCombining | __kCFNormalizationQCNonBase | __kCFNormalizationQCNotRecomposed | __kCFNormalizationQCSpecial,
+    /* kCFStringNormalizationFormKC */ __kCFNormalizationQCCompatibilityDecomposable | __kCFNormalizationQCCombining | __kCFNormalizationQCNonBase | __kCFNormalizationQCNotCompatibilityRecomposed | __kCFNormalizationQCSpecial,
+};
+
+static const uint8_t __CFNormalizationQuickCheckEmptyPage[256] = {0};
+
+// Whether the canonical decomposition of character precomposes back into it, the way the composition pass of CFStringNormalize sees it
+static bool __CFStringIsRecomposable(UTF32Char character, bool compatibility) {
+    UTF32Char decomposed[MAX_DECOMP_BUF];
+    CFIndex length = CFUniCharDecomposeCharacter(character, decomposed, MAX_DECOMP_BUF);
+    UTF32Char composed;
+
+    if (length < 1) return false;
+    if (compatibility && CFUniCharIsMemberOf(decomposed[0], kCFUniCharCompatibilityDecomposableCharacterSet)) return false;
+
+    composed = decomposed[0];
+    for (CFIndex idx = 1;idx < length;idx++) {
+        if (compatibility && (CFUniCharIsMemberOf(decomposed[idx], kCFUniCharCompatibilityDecomposableCharacterSet) || !CFUniCharIsMemberOf(decomposed[idx], kCFUniCharNonBaseCharacterSet))) return false;
+        composed = CFUniCharPrecomposeCharacter(composed, decomposed[idx]);
+        if (0xFFFD == composed) return false;
+    }
+
+    return (composed == character);
+}
+
+// Two-level table of quick-check flags indexed by the high and low bytes of a code unit. Blocks without any flagged code unit share an empty page, and runs of identical pages (Hangul Syllables, surrogates) share storage.
+static const uint8_t * const *__CFStringGetNormalizationQuickCheckPages(void) {
+    static const uint8_t *pages[256];
+    static dispatch_once_t onceToken;
+
+    dispatch_once(&onceToken, ^{
+        const uint8_t *decompBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharCanonicalDecomposableCharacterSet, 0);
+        const uint8_t *compatBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharCompatibilityDecomposableCharacterSet, 0);
+        const uint8_t *nonBaseBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharNonBaseCharacterSet, 0);
+        const uint8_t *combiningBMP = (const uint8_t *)CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, 0);
+        const uint8_t *lastPage = NULL;
+        uint8_t page[256];
+
+        for (uint32_t high = 0;high < 256;high++) {
+            bool isEmpty = true;
+
+            for (uint32_t low = 0;low < 256;low++) {
+                UTF32Char character = (high << 8) | low;
+                uint8_t flags = 0;
+
+                if (character >= 0x80) {
+                    if (CFUniCharIsSurrogateHighCharacter(character) || CFUniCharIsSurrogateLowCharacter(character) || ((character >= HANGUL_LBASE) && (character < HANGUL_LBASE + 0x100))) flags |= __kCFNormalizationQCSpecial;
+                    if (0 != CFUniCharGetCombiningPropertyForCharacter(character, combiningBMP)) flags |= __kCFNormalizationQCCombining;
+                    if (CFUniCharIsMemberOfBitmap(character, nonBaseBMP)) flags |= __kCFNormalizationQCNonBase;
+                    if (CFUniCharIsMemberOfBitmap(character, compatBMP)) flags |= __kCFNormalizationQCCompatibilityDecomposable;
+                    if (CFUniCharIsMemberOfBitmap(character, decompBMP)) {
+                        flags |= __kCFNormalizationQCCanonicalDecomposable;
+                        if ((character < HANGUL_SBASE) || (character >= HANGUL_SBASE + HANGUL_SCOUNT)) { // Hangul Syllables are never decomposed for the composed forms
+                            if (!__CFStringIsRecomposable(character, false)) flags |= __kCFNormalizationQCNotRecomposed;
+                            if (!__CFStringIsRecomposable(character, true)) flags |= __kCFNormalizationQCNotCompatibilityRecomposed;
+                        }
+                    }
+                }
+                page[low] = flags;
+                if (flags) isEmpty = false;
+            }
+
+            if (isEmpty) {
+                pages[high] = __CFNormalizationQuickCheckEmptyPage;
+            } else if ((NULL != lastPage) && (0 == memcmp(lastPage, page, sizeof(page)))) {
+                pages[high] = lastPage;
+            } else {
+                uint8_t *newPage = (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(page), 0);
+                memmove(newPage, page, sizeof(page));
+                pages[high] = lastPage = newPage;
+            }
+        }
+    });
+
+    return pages;
+}
+
+// Length of the leading run of code units passing the quick check for mask. ASCII always passes, so it's skipped a block at a time.
+static CFIndex __CFStringNormalizationQuickCheckSpan(const UTF16Char *characters, CFIndex length, const uint8_t * const *pages, uint8_t mask) {
+    CFIndex idx = 0;
+
+    while (idx < length) {
+        idx += __CFVectorASCIIPrefixLength16(characters + idx, length - idx);
+        while ((idx < length) && (characters[idx] >= 0x80)) {
+            if (pages[characters[idx] >> 8][characters[idx] & 0xFF] & mask) return idx;
+            ++idx;
+        }
+    }
+    return idx;
+}
+
 void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theForm) {
     CFIndex currentIndex = 0;
     CFIndex length;
@@ -5720,12 +6263,10 @@ void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theF
 
         contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
 
-        for (;currentIndex < length;currentIndex++) {
-            if (contents[currentIndex] > 127) {
-                __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true); // need to do harm way
-                needToReorder = false;
-                break;
-            }
+        currentIndex = __CFVectorASCIIPrefixLength8(contents, length);
+        if (currentIndex < length) {
+            __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true); // need to do harm way
+            needToReorder = false;
         }
     }
 
@@ -5741,8 +6282,18 @@ void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theF
         const uint8_t *decompBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharCanonicalDecomposableCharacterSet, 0);
         const uint8_t *nonBaseBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharNonBaseCharacterSet, 0);
         const uint8_t *combiningBMP = (const uint8_t *)CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, 0);
+        const uint8_t * const *quickCheckPages = __CFStringGetNormalizationQuickCheckPages();
+        uint8_t quickCheckMask = ((((CFIndex)theForm >= 0) && ((CFIndex)theForm < (CFIndex)(sizeof(__CFNormalizationQuickCheckMasks) / sizeof(*__CFNormalizationQuickCheckMasks)))) ? __CFNormalizationQuickCheckMasks[theForm] : 0xFF);
 
         while (contents < limit) {
+            // Characters passing the quick check are already normalized; only the runs around failing ones go through the tables below
+            CFIndex quickCheckLength = __CFStringNormalizationQuickCheckSpan(contents, limit - contents, quickCheckPages, quickCheckMask);
+
+            if ((quickCheckLength > 0) && (contents + quickCheckLength < limit)) --quickCheckLength; // The last passing character may still combine with the failing one
+            contents += quickCheckLength;
+            currentIndex += quickCheckLength;
+            if (contents >= limit) break;
+
             if (CFUniCharIsSurrogateHighCharacter(*contents) && (contents + 1 < limit) && CFUniCharIsSurrogateLowCharacter(*(contents + 1))) {
                 currentChar = CFUniCharGetLongCharacterForSurrogatePair(*contents, *(contents + 1));
                 currentLength = 2;
@@ -6006,6 +6557,31 @@ void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theF
     }
 }
 
+// Length of the leading run of ASCII characters left unchanged by folding without a special case handling language; uppercase letters end the run when folding case
+CF_INLINE CFIndex __CFStringFoldInvariantASCIIPrefixLength8(const uint8_t *bytes, CFIndex length, bool caseInsensitive) {
+    CFIndex idx = 0;
+
+    while (idx + __kCFVectorBlockLength8 <= length) {
+        uint32_t mask = __CFVectorNonASCIIMask8(bytes + idx) | (caseInsensitive ? __CFVectorRangeMask8(bytes + idx, 'A', 'Z') : 0);
+        if (mask) return idx + __builtin_ctz(mask);
+        idx += __kCFVectorBlockLength8;
+    }
+    while ((idx < length) && (bytes[idx] < 0x80) && !(caseInsensitive && (bytes[idx] >= 'A') && (bytes[idx] <= 'Z'))) ++idx;
+    return idx;
+}
+
+CF_INLINE CFIndex __CFStringFoldInvariantASCIIPrefixLength16(const UTF16Char *characters, CFIndex length, bool caseInsensitive) {
+    CFIndex idx = 0;
+
+    while (idx + __kCFVectorBlockLength16 <= length) {
+        uint32_t mask = __CFVectorNonASCIIMask16(characters + idx) | (caseInsensitive ? __CFVectorRangeMask16(characters + idx, 'A', 'Z') : 0);
+        if (mask) return idx + __builtin_ctz(mask);
+        idx += __kCFVectorBlockLength16;
+    }
+    while ((idx < length) && (characters[idx] < 0x80) && !(caseInsensitive && (characters[idx] >= 'A') && (characters[idx] <= 'Z'))) ++idx;
+    return idx;
+}
+
 void CFStringFold(CFMutableStringRef theString, CFStringCompareFlags theFlags, CFLocaleRef locale) {
     CF_RETURN_IF_NOT_MUTABLE(theString);
 
@@ -6044,6 +6620,14 @@ void CFStringFold(CFMutableStringRef theString, CFStringCompareFlags theFlags, C
         uint8_t *cStringContents = (isObjcOrSwift ? NULL : (uint8_t *)__CFStrContents(theString) + __CFStrSkipAnyLengthByte(theString));
         
         while (cStringPtr < cStringLimit) {
+            if (NULL == langCode) {
+                if (caseInsensitive && (NULL != cStringContents)) {
+                    cStringPtr += __CFVectorASCIIMapCase8(cStringContents + (cStringPtr - cString), cStringLimit - cStringPtr, false);
+                } else {
+                    cStringPtr += __CFStringFoldInvariantASCIIPrefixLength8(cStringPtr, cStringLimit - cStringPtr, caseInsensitive);
+                }
+                if (cStringPtr >= cStringLimit) break;
+            }
             if ((*cStringPtr < 0x80) && (NULL == langCode)) {
                 if (caseInsensitive && (*cStringPtr >= 'A') && (*cStringPtr <= 'Z')) {
                     if (NULL == cStringContents) {
@@ -6106,6 +6690,15 @@ void CFStringFold(CFMutableStringRef theString, CFStringCompareFlags theFlags, C
             }
 
             while (currentIndex < length) {
+                if ((NULL == langCode) && (0 == (theFlags & kCFCompareDiacriticInsensitive)) && __CFStrIsUnicode(theString)) {
+                    if (caseInsensitive) {
+                        currentIndex += __CFVectorASCIIMapCase16((UTF16Char *)__CFStrContents(theString) + currentIndex, length - currentIndex, false);
+                    } else {
+                        currentIndex += __CFStringFoldInvariantASCIIPrefixLength16((const UTF16Char *)__CFStrContents(theString) + currentIndex, length - currentIndex, false);
+                    }
+                    if (currentIndex >= length) break;
+                }
+
                 character = __CFStringGetCharacterFromInlineBufferQuick(&stringBuffer, currentIndex);
 
                 consumedLength = 0;
@@ -0,0 +1,129 @@
+/*	CFStringFindLiteral.m
+	Copyright (c) 2019, Apple Inc. and the Swift project authors
+
+	Portions Copyright (c) 2019, Apple Inc. and the Swift project authors
+	Licensed under Apache License v2.0 with Runtime Library Exception
+	See http://swift.org/LICENSE.txt for license information
+	See http://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+	Responsibility: Ali Ozer
+*/
+
+
+#if !defined(FIND_LITERAL_NAME) || !defined(FIND_LITERAL_CHAR_TYPE) || !defined(FIND_LITERAL_BLOCK_LENGTH) || !defined(FIND_LITERAL_EQUAL_MASK)
+#error All of FIND_LITERAL_NAME, FIND_LITERAL_CHAR_TYPE, FIND_LITERAL_BLOCK_LENGTH, and FIND_LITERAL_EQUAL_MASK must be defined before #including this file.
+#endif
+
+
+// Returns the offset of the first occurrence of needle in haystack, or kCFNotFound.
+// When caseInsensitive is true, both arrays must be pure ASCII and the needle must already be lowercased.
+// Short needles are located by matching their first and last characters against a whole block of the
+// haystack at once and verifying the candidates. Longer needles use the Two-Way algorithm (Crochemore & Perrin),
+// which stays linear in the haystack length no matter how repetitive the input is.
+static CFIndex FIND_LITERAL_NAME (const FIND_LITERAL_CHAR_TYPE *haystack, CFIndex haystackLength, const FIND_LITERAL_CHAR_TYPE *needle, CFIndex needleLength, Boolean caseInsensitive) {
+#define FOLD(C) ((caseInsensitive && ((C) >= 'A') && ((C) <= 'Z')) ? (FIND_LITERAL_CHAR_TYPE)((C) + ('a' - 'A')) : (C))
+    if ((needleLength <= 0) || (needleLength > haystackLength)) return kCFNotFound;
+
+    const CFIndex lastStart = haystackLength - needleLength;
+
+    if (needleLength <= __kCFStringFindLiteralShortNeedleLength) {
+        const FIND_LITERAL_CHAR_TYPE first = needle[0];
+        const FIND_LITERAL_CHAR_TYPE last = needle[needleLength - 1];
+        const FIND_LITERAL_CHAR_TYPE firstBits = ((caseInsensitive && (first >= 'a') && (first <= 'z')) ? 0x20 : 0);
+        const FIND_LITERAL_CHAR_TYPE lastBits = ((caseInsensitive && (last >= 'a') && (last <= 'z')) ? 0x20 : 0);
+        CFIndex idx = 0;
+
+        while (idx + FIND_LITERAL_BLOCK_LENGTH <= lastStart + 1) {
+            uint32_t candidates = FIND_LITERAL_EQUAL_MASK(haystack + idx, first, firstBits) & FIND_LITERAL_EQUAL_MASK(haystack + idx + needleLength - 1, last, lastBits);
+
+            while (candidates) {
+                const FIND_LITERAL_CHAR_TYPE *start = haystack + idx + __builtin_ctz(candidates);
+                CFIndex cnt = 1;
+
+                while ((cnt < needleLength - 1) && (FOLD(start[cnt]) == needle[cnt])) ++cnt;
+                if (cnt >= needleLength - 1) return start - haystack;
+                candidates &= (candidates - 1);
+            }
+            idx += FIND_LITERAL_BLOCK_LENGTH;
+        }
+
+        for (; idx <= lastStart; idx++) {
+            CFIndex cnt = 0;
+
+            while ((cnt < needleLength) && (FOLD(haystack[idx + cnt]) == needle[cnt])) ++cnt;
+            if (cnt == needleLength) return idx;
+        }
+        return kCFNotFound;
+    }
+
+    // Critical factorization: the later of the maximal suffixes under the two orderings of the alphabet
+    CFIndex suffix = -1, period = 1;
+
+    for (int ordering = 0; ordering < 2; ordering++) {
+        CFIndex ip = -1, jp = 0, k = 1, p = 1;
+
+        while (jp + k < needleLength) {
+            FIND_LITERAL_CHAR_TYPE a = needle[ip + k], b = needle[jp + k];
+
+            if (a == b) {
+                if (k == p) {
+                    jp += p;
+                    k = 1;
+                } else {
+                    ++k;
+                }
+            } else if ((0 == ordering) ? (a > b) : (a < b)) {
+                jp += k;
+                k = 1;
+                p = jp - ip;
+            } else {
+                ip = jp++;
+                k = p = 1;
+            }
+        }
+        if ((0 == ordering) || (ip > suffix)) {
+            suffix = ip;
+            period = p;
+        }
+    }
+
+    // If the left half repeats with the suffix period, we can remember how much of the needle already matched after a shift
+    Boolean periodic = (suffix + period < needleLength);
+    for (CFIndex cnt = 0; periodic && (cnt <= suffix); cnt++) if (needle[cnt] != needle[cnt + period]) periodic = false;
+
+    CFIndex memory = 0, memoryAfterShift;
+    if (periodic) {
+        memoryAfterShift = needleLength - period;
+    } else {
+        memoryAfterShift = 0;
+        period = __CFMax(suffix, needleLength - suffix - 1) + 1;
+    }
+
+    CFIndex pos = 0;
+    while (pos <= lastStart) {
+        const FIND_LITERAL_CHAR_TYPE *start = haystack + pos;
+        CFIndex k = __CFMax(suffix + 1, memory);
+
+        // Right half, left to right
+        while ((k < needleLength) && (needle[k] == FOLD(start[k]))) ++k;
+        if (k < needleLength) {
+            pos += k - suffix;
+            memory = 0;
+            continue;
+        }
+
+        // Left half, right to left
+        k = suffix + 1;
+        while ((k > memory) && (needle[k - 1] == FOLD(start[k - 1]))) --k;
+        if (k <= memory) return pos;
+
+        pos += period;
+        memory = memoryAfterShift;
+    }
+    return kCFNotFound;
+#undef FOLD
+}
+
+#undef FIND_LITERAL_NAME
+#undef FIND_LITERAL_CHAR_TYPE
+#undef FIND_LITERAL_BLOCK_LENGTH
+#undef FIND_LITERAL_EQUAL_MASK
@@ -18,6 +18,7 @@
 #include <CoreFoundation/CFUniChar.h>
 #include <CoreFoundation/CFPriv.h>
 #include "CFInternal.h"
+#include "CFString_Private.h"
 #include <unicode/utrans.h>
 
 static const char *__CFStringTransformGetICUIdentifier(CFStringRef identifier);
@@ -328,6 +329,100 @@ static void __CFStringTransformRelease(CFStringRef identifier, bool reverse,
 #endif
 }
 
+#if LITE_CACHE
+typedef UTransliterator *__CFStringTransformElement;
+#else
+typedef struct transform_element *__CFStringTransformElement;
+#endif
+
+CF_INLINE UTransliterator *__CFStringTransformElementGetTransliterator(__CFStringTransformElement element) {
+#if LITE_CACHE
+    return element;
+#else
+    return element->_transliterator;
+#endif
+}
+
+/* Per-thread cache in front of the one above, most recently used first. A thread gets back the transforms it used recently without taking the global lock, and without them having been taken by other threads in the meantime. Transforms pushed out by the limit, or left over when the thread exits, go back to the global cache.
+*/
+#define kCFStringTransformDefaultThreadCacheLimit 8
+#define kCFStringTransformMaxThreadCacheLimit 64
+
+static volatile CFIndex __CFStringTransformThreadCacheLimit = kCFStringTransformDefaultThreadCacheLimit;
+
+typedef struct {
+    CFIndex _count;
+    struct {
+        CFStringRef _identifier;
+        bool _reverse;
+        __CFStringTransformElement _element;
+    } _entries[kCFStringTransformMaxThreadCacheLimit];
+} __CFStringTransformThreadData;
+
+static void __CFStringTransformThreadDataDestructor(void *context) {
+    __CFStringTransformThreadData *data = (__CFStringTransformThreadData *)context;
+    CFIndex idx;
+
+    for (idx = 0; idx < data->_count; idx++) {
+        __CFStringTransformRelease(data->_entries[idx]._identifier, data->_entries[idx]._reverse, data->_entries[idx]._element);
+        CFRelease(data->_entries[idx]._identifier);
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, data);
+}
+
+static __CFStringTransformElement __CFStringTransformAcquireForThread(CFStringRef identifier, bool reverse) {
+    __CFStringTransformThreadData *data = (__CFStringTransformThreadData *)_CFGetTSD(__CFTSDKeyStringTransform);
+
+    if (data) {
+        CFIndex idx;
+        for (idx = 0; idx < data->_count; idx++) {
+            if ((data->_entries[idx]._reverse == reverse) && ((data->_entries[idx]._identifier == identifier) || CFEqual(data->_entries[idx]._identifier, identifier))) {
+                __CFStringTransformElement element = data->_entries[idx]._element;
+                CFRelease(data->_entries[idx]._identifier);
+                --data->_count;
+                memmove(data->_entries + idx, data->_entries + idx + 1, sizeof(data->_entries[0]) * (data->_count - idx));
+                return element;
+            }
+        }
+    }
+
+    return __CFStringTransformAcquire(identifier, reverse);
+}
+
+static void __CFStringTransformReleaseForThread(CFStringRef identifier, bool reverse, __CFStringTransformElement element) {
+    CFIndex limit = __CFStringTransformThreadCacheLimit;
+    __CFStringTransformThreadData *data = (__CFStringTransformThreadData *)_CFGetTSD(__CFTSDKeyStringTransform);
+
+    if (limit == 0) {
+        __CFStringTransformRelease(identifier, reverse, element);
+        return;
+    }
+
+    if (data == NULL) {
+        data = (__CFStringTransformThreadData *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFStringTransformThreadData), 0);
+        data->_count = 0;
+        _CFSetTSD(__CFTSDKeyStringTransform, (void *)data, __CFStringTransformThreadDataDestructor);
+    }
+
+    while (data->_count >= limit) {
+        --data->_count;
+        __CFStringTransformRelease(data->_entries[data->_count]._identifier, data->_entries[data->_count]._reverse, data->_entries[data->_count]._element);
+        CFRelease(data->_entries[data->_count]._identifier);
+    }
+
+    memmove(data->_entries + 1, data->_entries, sizeof(data->_entries[0]) * data->_count);
+    data->_entries[0]._identifier = CFStringCreateCopy(kCFAllocatorSystemDefault, identifier);
+    data->_entries[0]._reverse = reverse;
+    data->_entries[0]._element = element;
+    ++data->_count;
+}
+
+void _CFStringTransformSetThreadCacheLimit(CFIndex limit) {
+    if (limit < 0) limit = 0;
+    if (limit > kCFStringTransformMaxThreadCacheLimit) limit = kCFStringTransformMaxThreadCacheLimit;
+    __CFStringTransformThreadCacheLimit = limit;
+}
+
 /* Callback functions for UReplaceable and CFMutableStringRef
 */
 
@@ -483,36 +578,18 @@ static const char *__CFStringTransformGetICUIdentifier(CFStringRef identifier) {
     return NULL;
 }
 
-/* Main entry point
+/* Transform a range of a string with a transliterator that is checked out. The mutable string used to hand replacement text to CFStringReplace is returned in externalMutable, to be reused for the next string or released by the caller.
 */
 
-Boolean CFStringTransform(CFMutableStringRef string, CFRange *range, CFStringRef transform, Boolean reverse)
+static Boolean __CFStringTransformWithTransliterator(UTransliterator *tl, CFMutableStringRef string, CFRange *range, CFMutableStringRef *externalMutable)
 {
-    Boolean result = false;
-#if LITE_CACHE
-    UTransliterator *tl = __CFStringTransformAcquire(transform, (reverse != 0));
-    if (!tl) return false;
-#else
-    struct transform_element *element = __CFStringTransformAcquire(transform, (reverse != 0));
-    if (element == NULL)
-        return false;
-    UTransliterator *tl = element->_transliterator;
-#endif
-
-    CFRange everything;
-    if (range == NULL) {
-        everything.location = 0;
-        everything.length = CFStringGetLength(string);
-        range = &everything;
-    }
-    
     /* Set up the UReplaceable
     */
     _CFStringUReplaceable replaceable;
     replaceable._source = string;
     replaceable._sourceLength = CFStringGetLength(string);
     CFStringInitInlineBuffer(string, &replaceable._buffer, CFRangeMake(0, replaceable._sourceLength));
-    replaceable._externalMutable = NULL;
+    replaceable._externalMutable = *externalMutable;
     
     /* Actually do the transform
     */
@@ -520,24 +597,70 @@ Boolean CFStringTransform(CFMutableStringRef string, CFRange *range, CFStringRef
     int32_t limit = range->location + range->length;
     utrans_trans(tl, (UReplaceable *)&replaceable, &__CFStringReplaceableCallbacks, (int32_t) range->location, &limit, &icuStatus);
 
-    /* Get rid of the utility CFMutableString if we allocated it.
-    */
-    if (replaceable._externalMutable != NULL) {
-        CFRelease(replaceable._externalMutable);
-    }
+    *externalMutable = replaceable._externalMutable;
 
     if (U_SUCCESS(icuStatus)) {
         range->length = limit - range->location;
-        result = true;
+        return true;
     }
+    return false;
+}
 
-#if LITE_CACHE
-    __CFStringTransformRelease(transform, (reverse != 0), tl);
-#else
-    __CFStringTransformRelease(transform, (reverse != 0), element);
-#endif
+/* Main entry point
+*/
+
+Boolean CFStringTransform(CFMutableStringRef string, CFRange *range, CFStringRef transform, Boolean reverse)
+{
+    __CFStringTransformElement element = __CFStringTransformAcquireForThread(transform, (reverse != 0));
+    if (element == NULL)
+        return false;
+
+    CFRange everything;
+    if (range == NULL) {
+        everything.location = 0;
+        everything.length = CFStringGetLength(string);
+        range = &everything;
+    }
+    
+    CFMutableStringRef externalMutable = NULL;
+    Boolean result = __CFStringTransformWithTransliterator(__CFStringTransformElementGetTransliterator(element), string, range, &externalMutable);
+
+    /* Get rid of the utility CFMutableString if we allocated it.
+    */
+    if (externalMutable != NULL) {
+        CFRelease(externalMutable);
+    }
+
+    __CFStringTransformReleaseForThread(transform, (reverse != 0), element);
     
     return result;
 }
 
+/* Bulk entry point: one transliterator, and one utility CFMutableString, for all the strings
+*/
+
+Boolean _CFStringTransformStrings(CFArrayRef strings, CFStringRef transform, Boolean reverse)
+{
+    __CFStringTransformElement element = __CFStringTransformAcquireForThread(transform, (reverse != 0));
+    if (element == NULL)
+        return false;
+
+    UTransliterator *tl = __CFStringTransformElementGetTransliterator(element);
+    CFMutableStringRef externalMutable = NULL;
+    CFIndex count = CFArrayGetCount(strings);
+    Boolean result = true;
+
+    for (CFIndex idx = 0; idx < count; idx++) {
+        CFMutableStringRef string = (CFMutableStringRef)CFArrayGetValueAtIndex(strings, idx);
+        CFRange range = CFRangeMake(0, CFStringGetLength(string));
+        if (!__CFStringTransformWithTransliterator(tl, string, &range, &externalMutable)) result = false;
+    }
 
+    if (externalMutable != NULL) {
+        CFRelease(externalMutable);
+    }
+
+    __CFStringTransformReleaseForThread(transform, (reverse != 0), element);
+
+    return result;
+}
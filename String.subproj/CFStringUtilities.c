@@ -16,6 +16,7 @@
 #include "CFStringEncodingDatabase.h"
 #include "CFICUConverters.h"
 #include "CFString_Internal.h"
+#include "CFString_Private.h"
 #include <limits.h>
 #include <stdlib.h>
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
@@ -374,10 +375,9 @@ static SInt32 __CompareCodePoints(const UniChar *text1Ptr, UniCharCount text1Len
 }
 
 
-static UCollator *__CFStringCreateCollator(CFLocaleRef compareLocale) {
-    CFStringRef canonLocaleCFStr = (CFStringRef)CFLocaleGetValue(compareLocale, __kCFLocaleCollatorID);
+static UCollator *__CFStringCreateCollator(CFStringRef collatorID) {
     char icuLocaleStr[128] = {0};
-    CFStringGetCString(canonLocaleCFStr, icuLocaleStr, sizeof(icuLocaleStr), kCFStringEncodingASCII);
+    CFStringGetCString(collatorID, icuLocaleStr, sizeof(icuLocaleStr), kCFStringEncodingASCII);
     UErrorCode icuStatus = U_ZERO_ERROR;
     UCollator * collator = ucol_open(icuLocaleStr, &icuStatus);
     ucol_setAttribute(collator, UCOL_NORMALIZATION_MODE, UCOL_OFF, &icuStatus);
@@ -388,57 +388,75 @@ static UCollator *__CFStringCreateCollator(CFLocaleRef compareLocale) {
     return collator;
 }
 
-#define kCFMaxCachedDefaultCollators (8)
-static UCollator *__CFDefaultCollators[kCFMaxCachedDefaultCollators];
-static CFIndex __CFDefaultCollatorsCount = 0;
-static const void *__CFDefaultCollatorLocale = NULL;
-static os_unfair_lock __CFDefaultCollatorLock = OS_UNFAIR_LOCK_INIT;
-
-static UCollator *__CFStringCopyDefaultCollator(CFLocaleRef compareLocale) {
-    CFLocaleRef currentLocale = NULL;
-    UCollator * collator = NULL;
-
-    os_unfair_lock_lock_with_options(&__CFDefaultCollatorLock, OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION);
-    if (compareLocale != __CFDefaultCollatorLocale) {
-        currentLocale = CFLocaleCopyCurrent();
-        if (compareLocale != currentLocale) {
-	    CFRelease(currentLocale);
-            os_unfair_lock_unlock(&__CFDefaultCollatorLock);
-	    return NULL;
-	}
-    }
-
-    if ((NULL != currentLocale) && (__CFDefaultCollatorLocale != currentLocale)) {
-        while (__CFDefaultCollatorsCount > 0) ucol_close(__CFDefaultCollators[--__CFDefaultCollatorsCount]);
-        __CFDefaultCollatorLocale = CFRetain(currentLocale);
+// Idle collators, keyed by the ICU collator identifier of the locale they were opened for. All of them are in the default attribute state set up by __CFStringCreateCollator, since __CompareTextDefault restores it before returning; so the identifier alone determines which collator can be reused.
+// A thread checks a collator out of the pool for as long as it keeps comparing with that locale, and checks it back in when it moves on to another locale or exits. The pool is ordered by check-in time, and the least recently used collator is closed when it is full.
+#define kCFMaxPooledCollators (32)
+static struct {
+    CFStringRef collatorID;
+    UCollator *collator;
+} __CFCollatorPool[kCFMaxPooledCollators];
+static CFIndex __CFCollatorPoolCount = 0;
+static os_unfair_lock __CFCollatorPoolLock = OS_UNFAIR_LOCK_INIT;
+
+static UCollator *__CFStringCheckOutCollator(CFStringRef collatorID) {
+    UCollator *collator = NULL;
+    CFStringRef pooledID = NULL;
+
+    os_unfair_lock_lock_with_options(&__CFCollatorPoolLock, OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION);
+    for (CFIndex idx = __CFCollatorPoolCount - 1; idx >= 0; idx--) {
+        if (CFEqual(__CFCollatorPool[idx].collatorID, collatorID)) {
+            pooledID = __CFCollatorPool[idx].collatorID;
+            collator = __CFCollatorPool[idx].collator;
+            memmove(&__CFCollatorPool[idx], &__CFCollatorPool[idx + 1], (__CFCollatorPoolCount - idx - 1) * sizeof(__CFCollatorPool[0]));
+            --__CFCollatorPoolCount;
+            break;
+        }
     }
+    os_unfair_lock_unlock(&__CFCollatorPoolLock);
 
-    if (__CFDefaultCollatorsCount > 0) collator = __CFDefaultCollators[--__CFDefaultCollatorsCount];
-    os_unfair_lock_unlock(&__CFDefaultCollatorLock);
+    if (NULL != pooledID) CFRelease(pooledID);
+    if (NULL == collator) collator = __CFStringCreateCollator(collatorID);
+    return collator;
+}
 
-    if (NULL == collator) {
-	collator = __CFStringCreateCollator(compareLocale);
+static void __CFStringCheckInCollator(CFStringRef collatorID, UCollator *collator) {
+    CFStringRef evictedID = NULL;
+    UCollator *evicted = NULL;
+
+    CFRetain(collatorID);
+    os_unfair_lock_lock_with_options(&__CFCollatorPoolLock, OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION);
+    if (__CFCollatorPoolCount == kCFMaxPooledCollators) {
+        evictedID = __CFCollatorPool[0].collatorID;
+        evicted = __CFCollatorPool[0].collator;
+        memmove(&__CFCollatorPool[0], &__CFCollatorPool[1], (kCFMaxPooledCollators - 1) * sizeof(__CFCollatorPool[0]));
+        --__CFCollatorPoolCount;
+    }
+    __CFCollatorPool[__CFCollatorPoolCount].collatorID = collatorID;
+    __CFCollatorPool[__CFCollatorPoolCount].collator = collator;
+    ++__CFCollatorPoolCount;
+    os_unfair_lock_unlock(&__CFCollatorPoolLock);
+
+    if (NULL != evicted) {
+        ucol_close(evicted);
+        CFRelease(evictedID);
     }
-
-    if (NULL != currentLocale) CFRelease(currentLocale);
-
-    return collator;
 }
 
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
 static void __collatorFinalize(UCollator *collator) {
     CFLocaleRef locale = _CFGetTSD(__CFTSDKeyCollatorLocale);
+    CFStringRef collatorID = _CFGetTSD(__CFTSDKeyCollatorIdentifier);
     _CFSetTSD(__CFTSDKeyCollatorUCollator, NULL, NULL);
     _CFSetTSD(__CFTSDKeyCollatorLocale, NULL, NULL);
-    os_unfair_lock_lock_with_options(&__CFDefaultCollatorLock, OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION);
-    if ((__CFDefaultCollatorLocale == locale) && (__CFDefaultCollatorsCount < kCFMaxCachedDefaultCollators)) {
-        __CFDefaultCollators[__CFDefaultCollatorsCount++] = collator;
-        collator = NULL;
+    _CFSetTSD(__CFTSDKeyCollatorIdentifier, NULL, NULL);
+    if (NULL != collatorID) {
+        __CFStringCheckInCollator(collatorID, collator);
+    } else {
+        ucol_close(collator);
     }
-    os_unfair_lock_unlock(&__CFDefaultCollatorLock);
-    if (NULL != collator) ucol_close(collator);
 #ifndef __clang_analyzer__
-    // This release is unbalanced from perspective of analyzer, but it is retained when __CFTSDKeyCollatorLocale is set
+    // These releases are unbalanced from perspective of analyzer, but they are retained when __CFTSDKeyCollatorLocale and __CFTSDKeyCollatorIdentifier are set
+    if (collatorID) CFRelease(collatorID);
     if (locale) CFRelease(locale);
 #endif
 }
@@ -612,17 +630,23 @@ CF_PRIVATE CFComparisonResult _CFCompareStringsWithLocale(CFStringInlineBuffer *
     }
 
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
-    // First we try to use the last one used on this thread, if the locale is the same,
-    // otherwise we try to check out a default one, or then we create one.
+    // First we try to use the last one used on this thread, if the locale or its collator identifier is the same,
+    // otherwise we check one out of the pool, which creates it if needed.
     UCollator *threadCollator = _CFGetTSD(__CFTSDKeyCollatorUCollator);
     CFLocaleRef threadLocale = _CFGetTSD(__CFTSDKeyCollatorLocale);
+    CFStringRef collatorID = NULL;
     if (compareLocale == threadLocale) {
 	collator = threadCollator;
-    } else {
-	collator = __CFStringCopyDefaultCollator((CFLocaleRef)compareLocale);
-	if (NULL == collator) {
-	    collator = __CFStringCreateCollator((CFLocaleRef)compareLocale);
-	}
+    } else if (NULL != compareLocale) {
+        collatorID = (CFStringRef)CFLocaleGetValue((CFLocaleRef)compareLocale, __kCFLocaleCollatorID);
+        if (NULL != collatorID) {
+            CFStringRef threadCollatorID = _CFGetTSD(__CFTSDKeyCollatorIdentifier);
+            if ((NULL != threadCollator) && (NULL != threadCollatorID) && CFEqual(collatorID, threadCollatorID)) {
+                collator = threadCollator;
+            } else {
+                collator = __CFStringCheckOutCollator(collatorID);
+            }
+        }
     }
 #endif
 
@@ -754,19 +778,152 @@ CF_PRIVATE CFComparisonResult _CFCompareStringsWithLocale(CFStringInlineBuffer *
     }
 
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
-    if (collator == threadCollator) {
-	// do nothing, already cached
-    } else {
-	if (threadLocale) __collatorFinalize((UCollator *)_CFGetTSD(__CFTSDKeyCollatorUCollator)); // need to dealloc collators
+    if ((NULL != collator) && (compareLocale != threadLocale)) {
+        if (collator == threadCollator) {
+            // Same collator identifier through a different locale object; remember the new locale for the fast check above
+#ifndef __clang_analyzer__
+            _CFSetTSD(__CFTSDKeyCollatorLocale, (void *)CFRetain(compareLocale), NULL);
+            if (threadLocale) CFRelease(threadLocale);
+#endif
+        } else {
+            if (threadCollator) __collatorFinalize(threadCollator); // check the previous collator back in
 
-	_CFSetTSD(__CFTSDKeyCollatorUCollator, collator, (void *)__collatorFinalize);
+            _CFSetTSD(__CFTSDKeyCollatorUCollator, collator, (void *)__collatorFinalize);
 #ifndef __clang_analyzer__
-        // This retain is unbalanced from perspective of analyzer, but it is released in __collatorFinalize
-	_CFSetTSD(__CFTSDKeyCollatorLocale, (void *)CFRetain(compareLocale), NULL);
+            // These retains are unbalanced from perspective of analyzer, but they are released in __collatorFinalize
+            _CFSetTSD(__CFTSDKeyCollatorLocale, (void *)CFRetain(compareLocale), NULL);
+            _CFSetTSD(__CFTSDKeyCollatorIdentifier, (void *)CFRetain(collatorID), NULL);
 #endif
+        }
     }
 #endif
     
     return compResult;
 }
 
+
+#if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
+static void __CFStringSetCollationKeyAttributes(UCollator *collator, CFStringCompareFlags options) {
+    UErrorCode icuStatus = U_ZERO_ERROR;
+    ucol_setAttribute(collator, UCOL_NORMALIZATION_MODE, UCOL_ON, &icuStatus);
+    ucol_setAttribute(collator, UCOL_STRENGTH, (options & kCFCompareDiacriticInsensitive) ? UCOL_PRIMARY : ((options & kCFCompareCaseInsensitive) ? UCOL_SECONDARY : UCOL_TERTIARY), &icuStatus);
+    ucol_setAttribute(collator, UCOL_CASE_LEVEL, (options & kCFCompareCaseInsensitive) ? UCOL_OFF : UCOL_ON, &icuStatus);
+    ucol_setAttribute(collator, UCOL_NUMERIC_COLLATION, (options & kCFCompareNumerically) ? UCOL_ON : UCOL_OFF, &icuStatus);
+}
+
+// Pooled collators must be returned in the state __CFStringCreateCollator leaves them in
+static void __CFStringResetCollatorAttributes(UCollator *collator) {
+    UErrorCode icuStatus = U_ZERO_ERROR;
+    ucol_setAttribute(collator, UCOL_NORMALIZATION_MODE, UCOL_OFF, &icuStatus);
+    ucol_setAttribute(collator, UCOL_STRENGTH, UCOL_PRIMARY, &icuStatus);
+    ucol_setAttribute(collator, UCOL_CASE_LEVEL, UCOL_OFF, &icuStatus);
+    ucol_setAttribute(collator, UCOL_NUMERIC_COLLATION, UCOL_OFF, &icuStatus);
+}
+
+typedef struct {
+    UniChar *characters;
+    CFIndex charactersCapacity;
+    uint8_t *key;
+    int32_t keyCapacity;
+    UniChar sCharacters[kCFStringCompareAllocationIncrement];
+    uint8_t sKey[kCFStringCompareAllocationIncrement];
+} __CFCollationKeyBuffers;
+
+static CFDataRef __CFStringCreateCollationKeyWithCollator(CFAllocatorRef alloc, UCollator *collator, CFStringRef string, CFRange range, __CFCollationKeyBuffers *buffers) {
+    const UniChar *characters = CFStringGetCharactersPtr(string);
+
+    if (NULL != characters) {
+        characters += range.location;
+    } else {
+        if (range.length > buffers->charactersCapacity) {
+            if (buffers->characters != buffers->sCharacters) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers->characters);
+            buffers->characters = (UniChar *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(UniChar) * range.length, 0);
+            if (NULL == buffers->characters) __CFStringHandleOutOfMemory(NULL);
+            buffers->charactersCapacity = range.length;
+        }
+        CFStringGetCharacters(string, range, buffers->characters);
+        characters = buffers->characters;
+    }
+
+    // The returned length includes the terminating zero byte, which sorts before every other key byte
+    int32_t keyLength = ucol_getSortKey(collator, (const UChar *)characters, (int32_t)range.length, buffers->key, buffers->keyCapacity);
+    if (keyLength > buffers->keyCapacity) {
+        if (buffers->key != buffers->sKey) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers->key);
+        buffers->key = (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, keyLength, 0);
+        if (NULL == buffers->key) __CFStringHandleOutOfMemory(NULL);
+        buffers->keyCapacity = keyLength;
+        keyLength = ucol_getSortKey(collator, (const UChar *)characters, (int32_t)range.length, buffers->key, buffers->keyCapacity);
+    }
+    return (keyLength > 0) ? CFDataCreate(alloc, buffers->key, keyLength) : NULL;
+}
+
+static UCollator *__CFStringCheckOutCollationKeyCollator(CFLocaleRef locale, CFStringRef *collatorID) {
+    *collatorID = (NULL != locale) ? (CFStringRef)CFLocaleGetValue(locale, __kCFLocaleCollatorID) : CFSTR("");
+    if (NULL == *collatorID) return NULL;
+    return __CFStringCheckOutCollator(*collatorID);
+}
+#endif
+
+CFDataRef _CFStringCreateCollationKeyWithOptionsAndLocale(CFAllocatorRef alloc, CFStringRef string, CFRange range, CFStringCompareFlags options, CFLocaleRef locale) {
+    CFDataRef result = NULL;
+#if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
+    CFStringRef collatorID;
+    UCollator *collator = __CFStringCheckOutCollationKeyCollator(locale, &collatorID);
+
+    if (NULL != collator) {
+        __CFCollationKeyBuffers buffers;
+        buffers.characters = buffers.sCharacters;
+        buffers.charactersCapacity = kCFStringCompareAllocationIncrement;
+        buffers.key = buffers.sKey;
+        buffers.keyCapacity = kCFStringCompareAllocationIncrement;
+
+        __CFStringSetCollationKeyAttributes(collator, options);
+        result = __CFStringCreateCollationKeyWithCollator(alloc, collator, string, range, &buffers);
+        __CFStringResetCollatorAttributes(collator);
+        __CFStringCheckInCollator(collatorID, collator);
+
+        if (buffers.characters != buffers.sCharacters) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers.characters);
+        if (buffers.key != buffers.sKey) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers.key);
+    }
+#endif
+    return result;
+}
+
+CFArrayRef _CFStringCreateCollationKeysForArray(CFAllocatorRef alloc, CFArrayRef strings, CFStringCompareFlags options, CFLocaleRef locale) {
+    CFArrayRef result = NULL;
+#if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
+    CFStringRef collatorID;
+    UCollator *collator = __CFStringCheckOutCollationKeyCollator(locale, &collatorID);
+
+    if (NULL != collator) {
+        CFIndex count = CFArrayGetCount(strings);
+        CFMutableArrayRef keys = CFArrayCreateMutable(alloc, count, &kCFTypeArrayCallBacks);
+        __CFCollationKeyBuffers buffers;
+        buffers.characters = buffers.sCharacters;
+        buffers.charactersCapacity = kCFStringCompareAllocationIncrement;
+        buffers.key = buffers.sKey;
+        buffers.keyCapacity = kCFStringCompareAllocationIncrement;
+
+        // One collator set up once for the whole batch, with the character and key buffers reused between strings
+        __CFStringSetCollationKeyAttributes(collator, options);
+        for (CFIndex idx = 0; idx < count; idx++) {
+            CFStringRef string = (CFStringRef)CFArrayGetValueAtIndex(strings, idx);
+            CFDataRef key = __CFStringCreateCollationKeyWithCollator(alloc, collator, string, CFRangeMake(0, CFStringGetLength(string)), &buffers);
+            if (NULL == key) {
+                CFRelease(keys);
+                keys = NULL;
+                break;
+            }
+            CFArrayAppendValue(keys, key);
+            CFRelease(key);
+        }
+        __CFStringResetCollatorAttributes(collator);
+        __CFStringCheckInCollator(collatorID, collator);
+
+        if (buffers.characters != buffers.sCharacters) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers.characters);
+        if (buffers.key != buffers.sKey) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers.key);
+        result = keys;
+    }
+#endif
+    return result;
+}
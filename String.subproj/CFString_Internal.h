@@ -11,12 +11,15 @@
 #include <CoreFoundation/CFString.h>
 #include <CoreFoundation/CFStringEncodingConverterExt.h>
 #include "CFInternal.h"
+#include "CFCharacterSetPriv.h"
 
 CF_ASSUME_NONNULL_BEGIN
 
 CF_PRIVATE void __CFSetCharToUniCharFunc(CFStringEncodingCheapEightBitToUnicodeProc _Nullable func);
 CF_PRIVATE UniChar const * __CFCharToUniCharTable;
 CF_PRIVATE CFIndex CFUniCharCompatibilityDecompose(UTF32Char *convertedChars, CFIndex length, CFIndex maxBufferLength);
+// The compiled matcher of a predefined character set, shared for the life of the process; NULL for any other set
+CF_PRIVATE CFCharacterSetMatcherRef _Nullable __CFCharacterSetGetBuiltinMatcher(CFCharacterSetRef cset);
 __attribute__((cold))
 CF_PRIVATE void __CFStringHandleOutOfMemory(CFTypeRef _Nullable obj) CLANG_ANALYZER_NORETURN;
 
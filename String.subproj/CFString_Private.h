@@ -50,6 +50,30 @@ CF_EXPORT CFIndex _NSTaggedPointerStringGetLength(CFStringRef str)
 CF_EXPORT CFStringRef _CFStringCreateByParsingMarkdownAndInflectingIfNeeded(CFStringRef source, CFBundleRef _Nullable originBundle, CFURLRef _Nullable sourceStringsFileURLIfAny)
     API_UNAVAILABLE(macos, ios, watchos, tvos);
 
+/*
+ Returns the ICU sort key for the characters of \c string in \c range, as ordered by the collation of \c locale (the root collation if \c locale is NULL). kCFCompareCaseInsensitive, kCFCompareDiacriticInsensitive and kCFCompareNumerically select the collation strength and numeric ordering, as they do for CFStringCompareWithOptionsAndLocale.
+ Keys created with the same options and locale order their strings when compared with memcmp over the shorter of the two lengths, so they can be sorted or persisted in place of the strings. Ties between strings that collate as equal are not broken by code point, unlike CFStringCompareWithOptionsAndLocale.
+ Returns NULL if no collator is available.
+ */
+CF_EXPORT CFDataRef _Nullable _CFStringCreateCollationKeyWithOptionsAndLocale(CFAllocatorRef _Nullable alloc, CFStringRef string, CFRange range, CFStringCompareFlags options, CFLocaleRef _Nullable locale) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+// Returns an array with the collation keys of all the strings in \c strings, in the same order, using a single collator for the whole batch.
+CF_EXPORT CFArrayRef _Nullable _CFStringCreateCollationKeysForArray(CFAllocatorRef _Nullable alloc, CFArrayRef strings, CFStringCompareFlags options, CFLocaleRef _Nullable locale) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+/*
+ Stores the ranges of consecutive lines of \c string, in order, from the line containing \c range.location through the one containing the last character of \c range (just the first one if \c range is empty), up to \c maxCount of them, and returns the number stored. Each range includes the line's terminator; when \c contentsEnds is not NULL, the index where each line's contents end is stored at the same position. Lines are delimited as by CFStringGetLineBounds, with CR LF as a single terminator, so this is equivalent to calling it once per line.
+ */
+CF_EXPORT CFIndex _CFStringGetLineRanges(CFStringRef string, CFRange range, CFRange *lineRanges, CFIndex * _Nullable contentsEnds, CFIndex maxCount) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+// Same as _CFStringGetLineRanges, for paragraphs as delimited by CFStringGetParagraphBounds.
+CF_EXPORT CFIndex _CFStringGetParagraphRanges(CFStringRef string, CFRange range, CFRange *paragraphRanges, CFIndex * _Nullable contentsEnds, CFIndex maxCount) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+// Transforms each of the mutable strings in \c strings in place, over its whole length, as CFStringTransform would, using a single transliterator for the whole batch. Returns false if the transform is not valid or any of the strings could not be transformed.
+CF_EXPORT Boolean _CFStringTransformStrings(CFArrayRef strings, CFStringRef transform, Boolean reverse) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
+// Sets how many transliterators each thread keeps for reuse by CFStringTransform, across all transforms and both directions. 0 turns the per-thread cache off. The default is 8.
+CF_EXPORT void _CFStringTransformSetThreadCacheLimit(CFIndex limit) API_UNAVAILABLE(macos, ios, watchos, tvos);
+
 CF_EXTERN_C_END
 CF_ASSUME_NONNULL_END
 
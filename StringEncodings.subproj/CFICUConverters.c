@@ -19,10 +19,22 @@
 #include <stdio.h>
 
 // Thread data support
+#define ICU_CONVERTER_CACHE_SIZE (8)
+
+/* An idle converter kept for reuse by non-streaming conversions. ICU names come from __CFStringEncodingGetICUName(), which returns ICU's own alias strings, so they can be compared by address.
+*/
+typedef struct {
+    const char *_icuName;
+    UConverter *_converter;
+    char _lossyByte;
+} __CFICUCachedConverter;
+
 typedef struct {
     uint8_t _numSlots;
     uint8_t _nextSlot;
+    uint8_t _numCached;
     UConverter **_converters;
+    __CFICUCachedConverter _cache[ICU_CONVERTER_CACHE_SIZE]; // most recently used first
 } __CFICUThreadData;
 
 static void __CFICUThreadDataDestructor(void *context) {
@@ -33,11 +45,13 @@ static void __CFICUThreadDataDestructor(void *context) {
         UConverter **limit = converter + data->_numSlots;
         
         while (converter < limit) {
-            if (NULL != converter) ucnv_close(*converter);
+            if (NULL != *converter) ucnv_close(*converter);
             ++converter;
         }
         CFAllocatorDeallocate(NULL, data->_converters);
     }
+
+    for (CFIndex index = 0;index < data->_numCached;index++) ucnv_close(data->_cache[index]._converter);
     
     CFAllocatorDeallocate(NULL, data);
 }
@@ -107,32 +121,43 @@ CF_PRIVATE CFStringEncoding __CFStringEncodingGetFromICUName(const char *icuName
     return kCFStringEncodingInvalidId;
 }
 
-CF_INLINE UConverter *__CFStringEncodingConverterCreateICUConverter(const char *icuName, uint32_t flags, bool toUnicode) {
+CF_INLINE char __CFStringEncodingICUGetLossyByte(uint32_t flags) {
+    char lossyByte = CFStringEncodingMaskToLossyByte(flags);
+
+    if ((0 == lossyByte) && (0 != (flags & kCFStringEncodingAllowLossyConversion))) lossyByte = '?';
+
+    return lossyByte;
+}
+
+CF_INLINE UConverter *__CFStringEncodingConverterCreateICUConverter(const char *icuName, uint32_t flags) {
     UConverter *converter;
     UErrorCode errorCode = U_ZERO_ERROR;
     uint8_t streamID = CFStringEncodingStreamIDFromMask(flags);
+    char lossyByte = __CFStringEncodingICUGetLossyByte(flags);
+    __CFICUThreadData *data = __CFStringEncodingICUGetThreadData();
 
     if (0 != streamID) { // this is a part of streaming previously created
-        __CFICUThreadData *data = __CFStringEncodingICUGetThreadData();
-
         --streamID; // map to array index
 
         if ((streamID < data->_numSlots) && (NULL != data->_converters[streamID])) return data->_converters[streamID];
     }
 
+    // Take an idle converter set up for the same encoding and lossy byte out of the cache
+    for (CFIndex index = 0;index < data->_numCached;index++) {
+        if ((data->_cache[index]._icuName == icuName) && (data->_cache[index]._lossyByte == lossyByte)) {
+            converter = data->_cache[index]._converter;
+            --data->_numCached;
+            memmove(data->_cache + index, data->_cache + index + 1, sizeof(__CFICUCachedConverter) * (data->_numCached - index));
+            return converter;
+        }
+    }
+
     converter = ucnv_open(icuName, &errorCode);
 
     if (NULL != converter) {
-        char lossyByte = CFStringEncodingMaskToLossyByte(flags);
-
-        if ((0 == lossyByte) && (0 != (flags & kCFStringEncodingAllowLossyConversion))) lossyByte = '?';
-
-        if (0 ==lossyByte) {
-            if (toUnicode) {
-                ucnv_setToUCallBack(converter, &UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &errorCode);
-            } else {
-                ucnv_setFromUCallBack(converter, &UCNV_FROM_U_CALLBACK_STOP, NULL, NULL, NULL, &errorCode);
-            }
+        if (0 ==lossyByte) { // Both directions, since the converter may be reused for either one
+            ucnv_setToUCallBack(converter, &UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &errorCode);
+            ucnv_setFromUCallBack(converter, &UCNV_FROM_U_CALLBACK_STOP, NULL, NULL, NULL, &errorCode);
         } else {
             ucnv_setSubstChars(converter, &lossyByte, 1, &errorCode);
         }
@@ -141,10 +166,25 @@ CF_INLINE UConverter *__CFStringEncodingConverterCreateICUConverter(const char *
     return converter;
 }
 
+// Resets a converter that's done converting and keeps it for reuse, closing the least recently used one if the cache is full
+static void __CFStringEncodingConverterCacheICUConverter(const char *icuName, UConverter *converter, uint32_t flags) {
+    __CFICUThreadData *data = __CFStringEncodingICUGetThreadData();
+
+    ucnv_reset(converter);
+
+    if (ICU_CONVERTER_CACHE_SIZE == data->_numCached) ucnv_close(data->_cache[--data->_numCached]._converter);
+
+    memmove(data->_cache + 1, data->_cache, sizeof(__CFICUCachedConverter) * data->_numCached);
+    data->_cache[0]._icuName = icuName;
+    data->_cache[0]._converter = converter;
+    data->_cache[0]._lossyByte = __CFStringEncodingICUGetLossyByte(flags);
+    ++data->_numCached;
+}
+
 #define ICU_CONVERTER_SLOT_INCREMENT (10)
 #define ICU_CONVERTER_MAX_SLOT (255)
 
-static CFIndex __CFStringEncodingConverterReleaseICUConverter(UConverter *converter, uint32_t flags, CFIndex status) {
+static CFIndex __CFStringEncodingConverterReleaseICUConverter(const char *icuName, UConverter *converter, uint32_t flags, CFIndex status) {
     uint8_t streamID = CFStringEncodingStreamIDFromMask(flags);
 
     if ((kCFStringEncodingInvalidInputStream != status) && ((0 != (flags & kCFStringEncodingPartialInput)) || ((kCFStringEncodingInsufficientOutputBufferLength == status) && (0 != (flags & kCFStringEncodingPartialOutput))))) {
@@ -213,7 +253,7 @@ static CFIndex __CFStringEncodingConverterReleaseICUConverter(UConverter *conver
         }
     }
 
-    ucnv_close(converter);
+    __CFStringEncodingConverterCacheICUConverter(icuName, converter, flags);
 
     return 0;
 }
@@ -241,7 +281,7 @@ CF_PRIVATE CFIndex __CFStringEncodingICUToBytes(const char *icuName, uint32_t fl
     bool flush = ((0 == (flags & kCFStringEncodingPartialInput)) ? true : false);
     CFIndex status;
 
-    if (NULL == (converter = __CFStringEncodingConverterCreateICUConverter(icuName, flags, false))) return kCFStringEncodingConverterUnavailable;
+    if (NULL == (converter = __CFStringEncodingConverterCreateICUConverter(icuName, flags))) return kCFStringEncodingConverterUnavailable;
 
     if (0 == maxByteLen) {
         char buffer[MAX_BUFFER_SIZE];
@@ -328,7 +368,7 @@ CF_PRIVATE CFIndex __CFStringEncodingICUToBytes(const char *icuName, uint32_t fl
 	*usedCharLen = source - characters;
     }
 
-    status |= __CFStringEncodingConverterReleaseICUConverter(converter, flags, status);
+    status |= __CFStringEncodingConverterReleaseICUConverter(icuName, converter, flags, status);
 
     return status;
 }
@@ -343,7 +383,7 @@ CF_PRIVATE CFIndex __CFStringEncodingICUToUnicode(const char *icuName, uint32_t
     bool flush = ((0 == (flags & kCFStringEncodingPartialInput)) ? true : false);
     CFIndex status;
 
-    if (NULL == (converter = __CFStringEncodingConverterCreateICUConverter(icuName, flags, true))) return kCFStringEncodingConverterUnavailable;
+    if (NULL == (converter = __CFStringEncodingConverterCreateICUConverter(icuName, flags))) return kCFStringEncodingConverterUnavailable;
 
     if (0 == maxCharLen) {
         UTF16Char buffer[MAX_BUFFER_SIZE];
@@ -399,11 +439,63 @@ CF_PRIVATE CFIndex __CFStringEncodingICUToUnicode(const char *icuName, uint32_t
 	*usedByteLen = source - (const char *)bytes;
     }
     
-    status |= __CFStringEncodingConverterReleaseICUConverter(converter, flags, status);
+    status |= __CFStringEncodingConverterReleaseICUConverter(icuName, converter, flags, status);
 
     return status;
 }
 
+CF_PRIVATE bool __CFStringEncodingICUGetSingleByteMapping(const char *icuName, UniChar *toUnicode, bool *roundTrip) {
+    UErrorCode errorCode = U_ZERO_ERROR;
+    UConverter *converter = ucnv_open(icuName, &errorCode);
+    bool result = false;
+
+    if (NULL == converter) return false;
+
+    switch (ucnv_getType(converter)) {
+        case UCNV_SBCS: case UCNV_MBCS: case UCNV_LATIN_1: case UCNV_US_ASCII:
+            result = ((1 == ucnv_getMinCharSize(converter)) && (1 == ucnv_getMaxCharSize(converter)));
+            break;
+
+        default:
+            break;
+    }
+
+    if (result) {
+        ucnv_setToUCallBack(converter, &UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &errorCode);
+        ucnv_setFromUCallBack(converter, &UCNV_FROM_U_CALLBACK_STOP, NULL, NULL, NULL, &errorCode);
+        result = U_SUCCESS(errorCode); // Ambiguous aliases come back with a warning
+    }
+
+    for (CFIndex byte = 0;result && (byte < 256);byte++) {
+        char input = (char)byte, output = 0;
+        UChar characters[2];
+        const char *source = &input;
+        char *destination = &output;
+        const UChar *characterSource = characters;
+        UChar *characterDestination = characters;
+
+        toUnicode[byte] = 0xFFFF;
+        roundTrip[byte] = false;
+
+        errorCode = U_ZERO_ERROR;
+        ucnv_resetToUnicode(converter);
+        ucnv_toUnicode(converter, &characterDestination, characters + 2, &source, &input + 1, NULL, true, &errorCode);
+
+        // Bytes that don't map to exactly one BMP character are left for ICU to deal with
+        if ((U_ZERO_ERROR != errorCode) || (characterDestination != characters + 1) || (0xD800 == (characters[0] & 0xF800)) || (0xFFFF == characters[0])) continue;
+        toUnicode[byte] = characters[0];
+
+        errorCode = U_ZERO_ERROR;
+        ucnv_resetFromUnicode(converter);
+        ucnv_fromUnicode(converter, &destination, &output + 1, &characterSource, characters + 1, NULL, true, &errorCode);
+        roundTrip[byte] = ((U_ZERO_ERROR == errorCode) && (destination == &output + 1) && ((uint8_t)output == byte));
+    }
+
+    ucnv_close(converter);
+
+    return result;
+}
+
 CF_PRIVATE CFIndex __CFStringEncodingICUCharLength(const char *icuName, uint32_t flags, const uint8_t *bytes, CFIndex numBytes) {
     CFIndex usedCharLen;
     return (__CFStringEncodingICUToUnicode(icuName, flags, bytes, numBytes, NULL, NULL, 0, &usedCharLen) == kCFStringEncodingConversionSuccess ? usedCharLen : 0);
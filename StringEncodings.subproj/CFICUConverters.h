@@ -22,6 +22,9 @@ CF_PRIVATE CFIndex __CFStringEncodingICUToUnicode(const char *icuName, uint32_t
 CF_PRIVATE CFIndex __CFStringEncodingICUCharLength(const char *icuName, uint32_t flags, const uint8_t *bytes, CFIndex numBytes);
 CF_PRIVATE CFIndex __CFStringEncodingICUByteLength(const char *icuName, uint32_t flags, const UniChar *characters, CFIndex numChars);
 
+// Fills in the 256-entry byte to character table of a stateless single-byte encoding (0xFFFF for bytes ICU doesn't map to a single BMP character), and marks the bytes the character converts back to. Returns false for any other kind of encoding.
+CF_PRIVATE bool __CFStringEncodingICUGetSingleByteMapping(const char *icuName, UniChar *toUnicode, bool *roundTrip);
+
 // The caller is responsible for freeing the memory (use CFAllocatorDeallocate)
 CF_PRIVATE CFStringEncoding *__CFStringEncodingCreateICUEncodings(CFAllocatorRef allocator, CFIndex *numberOfIndex);
 
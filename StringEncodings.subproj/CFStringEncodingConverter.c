@@ -17,6 +17,7 @@
 #include "CFUnicodeDecomposition.h"
 #include "CFStringEncodingConverterExt.h"
 #include "CFStringEncodingConverterPriv.h"
+#include "CFVectorUtilities.h"
 #include <stdlib.h>
 
 #if __has_include(<os/lock.h>)
@@ -26,8 +27,22 @@
 typedef CFIndex (*_CFToBytesProc)(const void *converter, uint32_t flags, const UniChar *characters, CFIndex numChars, uint8_t *bytes, CFIndex maxByteLen, CFIndex *usedByteLen);
 typedef CFIndex (*_CFToUnicodeProc)(const void *converter, uint32_t flags, const uint8_t *bytes, CFIndex numBytes, UniChar *characters, CFIndex maxCharLen, CFIndex *usedCharLen);
 
+/* Tables for encodings that map every byte to at most one BMP character.
+   The byte to character direction is a flat table. The other direction is a two-level map indexed by the high, then the low, byte of the character; the byte found there is only used if it is marked as round-tripping to that very character, so slots for unmapped characters can simply stay zero.
+*/
+#define kCFSingleByteUnmapped (0xFFFF)
+
+typedef struct {
+    UniChar toUnicode[256];
+    uint8_t roundTrip[256 / 8];
+    uint8_t pageIndex[256]; // Into pages; page 0 is all zeros
+    bool asciiCompatible;
+    uint8_t pages[][256];
+} __CFSingleByteTable;
+
 typedef struct {
     const CFStringEncodingConverter *definition;
+    const __CFSingleByteTable *singleByteTable;
     _CFToBytesProc toBytes;
     _CFToUnicodeProc toUnicode;
     _CFToUnicodeProc toCanonicalUnicode;
@@ -215,6 +230,100 @@ static CFIndex __CFDefaultToUnicodeFallbackProc(const uint8_t *bytes, CFIndex nu
     return 1;
 }
 
+static const __CFSingleByteTable *__CFSingleByteTableCreate(const UniChar *toUnicode, const bool *roundTrip) {
+    uint8_t pageIndex[256];
+    CFIndex numPages = 1;
+    CFIndex byte;
+    __CFSingleByteTable *table;
+
+    memset(pageIndex, 0, sizeof(pageIndex));
+
+    for (byte = 0;byte < 256;byte++) {
+        if (!roundTrip[byte] || (0 != pageIndex[toUnicode[byte] >> 8])) continue;
+        if (numPages > UINT8_MAX) return NULL;
+        pageIndex[toUnicode[byte] >> 8] = numPages++;
+    }
+
+    table = (__CFSingleByteTable *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFSingleByteTable) + (numPages * 256), 0);
+    memset(table, 0, sizeof(__CFSingleByteTable) + (numPages * 256));
+    memmove(table->toUnicode, toUnicode, sizeof(table->toUnicode));
+    memmove(table->pageIndex, pageIndex, sizeof(table->pageIndex));
+    table->asciiCompatible = true;
+
+    for (byte = 0;byte < 256;byte++) {
+        if (roundTrip[byte]) {
+            table->roundTrip[byte >> 3] |= (1 << (byte & 7));
+            table->pages[pageIndex[toUnicode[byte] >> 8]][toUnicode[byte] & 0xFF] = byte;
+        }
+        if ((byte < 0x80) && ((toUnicode[byte] != byte) || !roundTrip[byte])) table->asciiCompatible = false;
+    }
+
+    return table;
+}
+
+static const __CFSingleByteTable *__CFSingleByteTableCreateWithCheapEightBit(const CFStringEncodingConverter *definition) {
+    UniChar toUnicode[256];
+    bool roundTrip[256];
+    uint8_t convertedByte;
+
+    // The cheap eight-bit converters don't look at the flags, so the tables are probed with none
+    for (CFIndex byte = 0;byte < 256;byte++) {
+        if (!definition->toUnicode.cheapEightBit(0, byte, toUnicode + byte)) {
+            toUnicode[byte] = kCFSingleByteUnmapped;
+        } else if (kCFSingleByteUnmapped == toUnicode[byte]) {
+            return NULL;
+        }
+        roundTrip[byte] = ((kCFSingleByteUnmapped != toUnicode[byte]) && definition->toBytes.cheapEightBit(0, toUnicode[byte], &convertedByte) && (convertedByte == byte));
+    }
+
+    return __CFSingleByteTableCreate(toUnicode, roundTrip);
+}
+
+CF_INLINE bool __CFSingleByteTableGetByte(const __CFSingleByteTable *table, UniChar character, uint8_t *byte) {
+    uint8_t candidate = table->pages[table->pageIndex[character >> 8]][character & 0xFF];
+
+    if ((table->toUnicode[candidate] != character) || (0 == (table->roundTrip[candidate >> 3] & (1 << (candidate & 7))))) return false;
+
+    *byte = candidate;
+    return true;
+}
+
+/* Convert up to the first character (or byte) without a mapping in the tables, and return the number converted. Runs of ASCII are copied a block at a time for encodings that are a superset of it. bytes (or characters) can be NULL to only measure.
+*/
+static CFIndex __CFSingleByteTableToBytes(const __CFSingleByteTable *table, const UniChar *characters, CFIndex numChars, uint8_t *bytes) {
+    CFIndex index = 0;
+    uint8_t byte;
+
+    while (index < numChars) {
+        if (table->asciiCompatible) index += (bytes ? __CFVectorASCIINarrow(characters + index, bytes + index, numChars - index) : __CFVectorASCIIPrefixLength16(characters + index, numChars - index));
+
+        while ((index < numChars) && (!table->asciiCompatible || (characters[index] >= 0x80))) {
+            if (!__CFSingleByteTableGetByte(table, characters[index], &byte)) return index;
+            if (bytes) bytes[index] = byte;
+            ++index;
+        }
+    }
+
+    return index;
+}
+
+static CFIndex __CFSingleByteTableToUnicode(const __CFSingleByteTable *table, const uint8_t *bytes, CFIndex numBytes, UniChar *characters) {
+    CFIndex index = 0;
+    UniChar character;
+
+    while (index < numBytes) {
+        if (table->asciiCompatible) index += (characters ? __CFVectorASCIIWiden(bytes + index, characters + index, numBytes - index) : __CFVectorASCIIPrefixLength8(bytes + index, numBytes - index));
+
+        while ((index < numBytes) && (!table->asciiCompatible || (bytes[index] >= 0x80))) {
+            if (kCFSingleByteUnmapped == (character = table->toUnicode[bytes[index]])) return index;
+            if (characters) characters[index] = character;
+            ++index;
+        }
+    }
+
+    return index;
+}
+
 #define TO_BYTE_FALLBACK(conv,chars,numChars,bytes,max,used) (conv->toBytesFallback(chars,numChars,bytes,max,used))
 #define TO_UNICODE_FALLBACK(conv,bytes,numBytes,chars,max,used) (conv->toUnicodeFallback(bytes,numBytes,chars,max,used))
 
@@ -223,11 +332,15 @@ static CFIndex __CFDefaultToUnicodeFallbackProc(const uint8_t *bytes, CFIndex nu
 /* Wrapper funcs for non-standard converters
 */
 static CFIndex __CFToBytesCheapEightBitWrapper(const void *converter, uint32_t flags, const UniChar *characters, CFIndex numChars, uint8_t *bytes, CFIndex maxByteLen, CFIndex *usedByteLen) {
+    const __CFSingleByteTable *table = ((const _CFEncodingConverter*)converter)->singleByteTable;
     CFIndex processedCharLen = 0;
     CFIndex length = (maxByteLen && (maxByteLen < numChars) ? maxByteLen : numChars);
     uint8_t byte;
 
     while (processedCharLen < length) {
+        if (table && ((processedCharLen += __CFSingleByteTableToBytes(table, characters + processedCharLen, length - processedCharLen, (maxByteLen ? bytes + processedCharLen : NULL))) >= length)) break;
+
+        // Characters with one-way mappings aren't in the tables
         if (!((const _CFEncodingConverter*)converter)->definition->toBytes.cheapEightBit(flags, characters[processedCharLen], &byte)) break;
 
         if (maxByteLen) bytes[processedCharLen] = byte;
@@ -239,10 +352,17 @@ static CFIndex __CFToBytesCheapEightBitWrapper(const void *converter, uint32_t f
 }
 
 static CFIndex __CFToUnicodeCheapEightBitWrapper(const void *converter, uint32_t flags, const uint8_t *bytes, CFIndex numBytes, UniChar *characters, CFIndex maxCharLen, CFIndex *usedCharLen) {
+    const __CFSingleByteTable *table = ((const _CFEncodingConverter*)converter)->singleByteTable;
     CFIndex processedByteLen = 0;
     CFIndex length = (maxCharLen && (maxCharLen < numBytes) ? maxCharLen : numBytes);
     UniChar character;
 
+    if (table) {
+        processedByteLen = __CFSingleByteTableToUnicode(table, bytes, length, (maxCharLen ? characters : NULL));
+        *usedCharLen = processedByteLen;
+        return processedByteLen;
+    }
+
     while (processedByteLen < length) {
         if (!((const _CFEncodingConverter*)converter)->definition->toUnicode.cheapEightBit(flags, bytes[processedByteLen], &character)) break;
 
@@ -516,6 +636,7 @@ CF_INLINE _CFEncodingConverter *__CFEncodingConverterFromDefinition(const CFStri
             break;
 
         case kCFStringEncodingConverterCheapEightBit:
+            converter->singleByteTable = __CFSingleByteTableCreateWithCheapEightBit(definition);
             converter->toBytes = __CFToBytesCheapEightBitWrapper;
             converter->toUnicode = __CFToUnicodeCheapEightBitWrapper;
             converter->toCanonicalUnicode = __CFToCanonicalUnicodeCheapEightBitWrapper;
@@ -536,6 +657,12 @@ CF_INLINE _CFEncodingConverter *__CFEncodingConverterFromDefinition(const CFStri
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
         case kCFStringEncodingConverterICU:
             converter->toBytes = (_CFToBytesProc)__CFStringEncodingGetICUName(encoding);
+            if (NULL != converter->toBytes) {
+                UniChar toUnicode[256];
+                bool roundTrip[256];
+
+                if (__CFStringEncodingICUGetSingleByteMapping((const char *)converter->toBytes, toUnicode, roundTrip)) converter->singleByteTable = __CFSingleByteTableCreate(toUnicode, roundTrip);
+            }
             break;
 #endif
 
@@ -646,6 +773,46 @@ static const _CFEncodingConverter *__CFGetConverter(uint32_t encoding) {
 #undef _CFGetConverter_Unlock
 }
 
+#if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
+/* ICU converters for single-byte encodings are stateless, so whatever prefix the tables map is converted here and ICU only sees the rest, starting with the first character (or byte) the tables couldn't handle. Streaming conversions are left to ICU entirely. A bounded output buffer is never filled by the tables, so running out of room is always reported by ICU, and if it is, the whole conversion is redone by ICU so that it can back up over combining sequences the way it would have.
+*/
+CF_INLINE bool __CFSingleByteTableCanConvert(const _CFEncodingConverter *converter, uint32_t flags) {
+    return ((NULL != converter->singleByteTable) && (0 == (flags & (kCFStringEncodingPartialInput|kCFStringEncodingPartialOutput))) && (0 == CFStringEncodingStreamIDFromMask(flags)));
+}
+
+static uint32_t __CFSingleByteICUToBytes(const _CFEncodingConverter *converter, uint32_t flags, const UniChar *characters, CFIndex numChars, CFIndex *usedCharLen, uint8_t *bytes, CFIndex maxByteLen, CFIndex *usedByteLen) {
+    CFIndex length = ((maxByteLen > 0) && (maxByteLen <= numChars) ? maxByteLen - 1 : numChars);
+    CFIndex convertedLen = __CFSingleByteTableToBytes(converter->singleByteTable, characters, length, (maxByteLen ? bytes : NULL));
+    CFIndex remainingCharLen = 0, remainingByteLen = 0;
+    uint32_t result = kCFStringEncodingConversionSuccess;
+
+    if (convertedLen < numChars) {
+        result = (uint32_t)__CFStringEncodingICUToBytes((const char *)converter->toBytes, flags, characters + convertedLen, numChars - convertedLen, &remainingCharLen, (maxByteLen ? bytes + convertedLen : NULL), (maxByteLen ? maxByteLen - convertedLen : 0), &remainingByteLen);
+
+        if (kCFStringEncodingInsufficientOutputBufferLength == result) return (uint32_t)__CFStringEncodingICUToBytes((const char *)converter->toBytes, flags, characters, numChars, usedCharLen, bytes, maxByteLen, usedByteLen);
+    }
+
+    if (usedCharLen) *usedCharLen = convertedLen + remainingCharLen;
+    if (usedByteLen) *usedByteLen = convertedLen + remainingByteLen;
+
+    return result;
+}
+
+static uint32_t __CFSingleByteICUToUnicode(const _CFEncodingConverter *converter, uint32_t flags, const uint8_t *bytes, CFIndex numBytes, CFIndex *usedByteLen, UniChar *characters, CFIndex maxCharLen, CFIndex *usedCharLen) {
+    CFIndex length = ((maxCharLen > 0) && (maxCharLen <= numBytes) ? maxCharLen - 1 : numBytes);
+    CFIndex convertedLen = __CFSingleByteTableToUnicode(converter->singleByteTable, bytes, length, (maxCharLen ? characters : NULL));
+    CFIndex remainingByteLen = 0, remainingCharLen = 0;
+    uint32_t result = kCFStringEncodingConversionSuccess;
+
+    if (convertedLen < numBytes) result = (uint32_t)__CFStringEncodingICUToUnicode((const char *)converter->toBytes, flags, bytes + convertedLen, numBytes - convertedLen, &remainingByteLen, (maxCharLen ? characters + convertedLen : NULL), (maxCharLen ? maxCharLen - convertedLen : 0), &remainingCharLen);
+
+    if (usedByteLen) *usedByteLen = convertedLen + remainingByteLen;
+    if (usedCharLen) *usedCharLen = convertedLen + remainingCharLen;
+
+    return result;
+}
+#endif
+
 /* Public API
 */
 uint32_t CFStringEncodingUnicodeToBytes(uint32_t encoding, uint32_t flags, const UniChar *characters, CFIndex numChars, CFIndex *usedCharLen, uint8_t *bytes, CFIndex maxByteLen, CFIndex *usedByteLen) {
@@ -700,7 +867,10 @@ uint32_t CFStringEncodingUnicodeToBytes(uint32_t encoding, uint32_t flags, const
         }
 
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
-        if (kCFStringEncodingConverterICU == converter->definition->encodingClass) return __CFStringEncodingICUToBytes((const char *)converter->toBytes, flags, characters, numChars, usedCharLen, bytes, maxByteLen, usedByteLen);
+        if (kCFStringEncodingConverterICU == converter->definition->encodingClass) {
+            if (__CFSingleByteTableCanConvert(converter, flags)) return __CFSingleByteICUToBytes(converter, flags, characters, numChars, usedCharLen, bytes, maxByteLen, usedByteLen);
+            return __CFStringEncodingICUToBytes((const char *)converter->toBytes, flags, characters, numChars, usedCharLen, bytes, maxByteLen, usedByteLen);
+        }
 #endif
 
         /* Platform converter */
@@ -845,7 +1015,10 @@ uint32_t CFStringEncodingBytesToUnicode(uint32_t encoding, uint32_t flags, const
     if (!converter) return kCFStringEncodingConverterUnavailable;
 
 #if TARGET_OS_MAC || TARGET_OS_WIN32 || TARGET_OS_LINUX
-    if (kCFStringEncodingConverterICU == converter->definition->encodingClass) return __CFStringEncodingICUToUnicode((const char *)converter->toBytes, flags, bytes, numBytes, usedByteLen, characters, maxCharLen, usedCharLen);
+    if (kCFStringEncodingConverterICU == converter->definition->encodingClass) {
+        if (__CFSingleByteTableCanConvert(converter, flags)) return __CFSingleByteICUToUnicode(converter, flags, bytes, numBytes, usedByteLen, characters, maxCharLen, usedCharLen);
+        return __CFStringEncodingICUToUnicode((const char *)converter->toBytes, flags, bytes, numBytes, usedByteLen, characters, maxCharLen, usedCharLen);
+    }
 #endif
 
     /* Platform converter */